@@ -0,0 +1,184 @@
+#pragma once
+#include <chrono>
+#include <fstream>
+#include <map>
+#include <memory>
+#include <stdexcept>
+#include <string>
+#include <vector>
+#include "Catalog.h"
+#include "FragmentCache.h"
+#include "Histogram.h"
+#include "PerfCounters.h"
+#include "QueryExecutor.h"
+#include "ThreadPool.h"
+#include "Trace.h"
+#include "json.hpp"
+
+// Settings for a headless batch run
+struct BatchOptions {
+    std::string inputPath;
+    std::string outputPath;
+    // optional JSON file for throughput and the latency histogram
+    std::string statsPath;
+    // worker threads, 0 uses the shared pool
+    size_t threads = 0;
+    // write the matching books themselves instead of their ids
+    bool embedBooks = false;
+    // byte budget of the query result cache, 0 turns it off
+    size_t resultCacheBytes = 64 * 1024 * 1024;
+    // read the hardware counters around every query, see BatchReport::counters
+    bool hardwareCounters = false;
+};
+
+// What a batch run did and how long it took
+struct BatchReport {
+    size_t queries = 0;
+    size_t errors = 0;
+    double seconds = 0;
+    // per-query parse plus execute time in nanoseconds
+    LatencyHistogram latency;
+    CacheStats resultCache;
+    // with hardwareCounters, the events of each query by its shape, lines that don't parse
+    // under "error"; cache hits count too, so turn the result cache off to profile kernels
+    std::map<std::string, CounterTotals> counters;
+};
+
+// Lines read and executed together; results of a block are written in input order
+const size_t BATCH_BLOCK_SIZE = 64 * 1024;
+// Queries handed to a worker at a time
+const size_t BATCH_MORSEL_SIZE = 256;
+
+// Reads a JSONL file of queries, runs them concurrently against the catalog and writes one
+// JSONL result per query, in input order. Blank lines are skipped.
+inline BatchReport runBatch(const Catalog& catalog, const BatchOptions& options) {
+    std::ifstream inFile(options.inputPath);
+    if (!inFile) {
+        throw std::runtime_error("Error opening file: " + options.inputPath);
+    }
+    std::ofstream outFile(options.outputPath, std::ios::binary);
+    if (!outFile) {
+        throw std::runtime_error("Error opening file: " + options.outputPath);
+    }
+
+    std::unique_ptr<ThreadPool> ownPool;
+    if (options.threads != 0) {
+        ownPool = std::make_unique<ThreadPool>(options.threads);
+    }
+    ThreadPool& pool = ownPool ? *ownPool : ThreadPool::shared();
+
+    // every book is encoded at most once however many queries return it
+    std::unique_ptr<FragmentCache> fragments;
+    if (options.embedBooks) {
+        fragments = std::make_unique<FragmentCache>();
+    }
+    std::unique_ptr<QueryCache> resultCache;
+    if (options.resultCacheBytes != 0) {
+        resultCache = std::make_unique<QueryCache>(options.resultCacheBytes);
+    }
+    QueryCaches caches;
+    caches.fragments = fragments.get();
+    caches.results = resultCache.get();
+    std::vector<MemoryAccounts::Registration> memory;
+    if (fragments) {
+        memory.push_back(MemoryAccounts::shared().track("cache.fragment", [&fragments] { return fragments->stats().bytes; }));
+    }
+    if (resultCache) {
+        memory.push_back(MemoryAccounts::shared().track("cache.query", [&resultCache] { return resultCache->stats().bytes; }));
+    }
+
+    BatchReport report;
+    auto started = std::chrono::steady_clock::now();
+    std::vector<std::string> lines;
+    std::vector<std::string> results;
+    std::string line;
+    bool more = true;
+    while (more) {
+        lines.clear();
+        while (lines.size() < BATCH_BLOCK_SIZE && (more = static_cast<bool>(std::getline(inFile, line)))) {
+            if (line.find_first_not_of(" \t\r") != std::string::npos) {
+                lines.push_back(line);
+            }
+        }
+        if (lines.empty()) {
+            break;
+        }
+
+        // a block sees one catalog version even if a writer publishes meanwhile
+        std::shared_ptr<const CatalogSnapshot> snapshot = catalog.snapshot();
+        results.assign(lines.size(), std::string());
+        size_t morsels = (lines.size() + BATCH_MORSEL_SIZE - 1) / BATCH_MORSEL_SIZE;
+        std::vector<LatencyHistogram> latencies(morsels);
+        std::vector<size_t> errors(morsels, 0);
+        std::vector<std::map<std::string, CounterTotals>> counters(options.hardwareCounters ? morsels : 0);
+        pool.forEachMorsel(lines.size(), BATCH_MORSEL_SIZE, [&](size_t morsel, size_t begin, size_t end) {
+            for (size_t i = begin; i < end; ++i) {
+                // the query is parsed again to name its shape, outside what's counted
+                std::string shape;
+                if (options.hardwareCounters) {
+                    try {
+                        shape = queryShape(parseQuery(nlohmann::json::parse(lines[i])));
+                    }
+                    catch (const std::exception&) {
+                        shape = "error";
+                    }
+                }
+                CounterScope events(options.hardwareCounters);
+                auto queryStart = std::chrono::steady_clock::now();
+                bool failed = false;
+                results[i] = runQueryLine(*snapshot, lines[i], failed, caches);
+                auto elapsed = std::chrono::steady_clock::now() - queryStart;
+                if (options.hardwareCounters) {
+                    events.stop(counters[morsel][shape]);
+                }
+                latencies[morsel].record(static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::nanoseconds>(elapsed).count()));
+                errors[morsel] += failed ? 1 : 0;
+            }
+        });
+
+        for (size_t m = 0; m < morsels; ++m) {
+            report.latency.merge(latencies[m]);
+            report.errors += errors[m];
+        }
+        for (const auto& morselCounters : counters) {
+            for (const auto& entry : morselCounters) {
+                report.counters[entry.first].merge(entry.second);
+            }
+        }
+        for (const std::string& result : results) {
+            outFile << result << '\n';
+        }
+        report.queries += lines.size();
+    }
+    outFile.flush();
+    report.seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - started).count();
+    if (resultCache) {
+        report.resultCache = resultCache->stats();
+    }
+
+    if (!options.statsPath.empty()) {
+        std::ofstream statsFile(options.statsPath);
+        if (!statsFile) {
+            throw std::runtime_error("Error opening file: " + options.statsPath);
+        }
+        nlohmann::json stats;
+        stats["queries"] = report.queries;
+        stats["errors"] = report.errors;
+        stats["seconds"] = report.seconds;
+        stats["qps"] = report.seconds > 0 ? report.queries / report.seconds : 0.0;
+        stats["threads"] = pool.size();
+        stats["latencyNs"] = latencyJson(report.latency);
+        stats["resultCache"] = cacheStatsJson(report.resultCache);
+        if (Tracer::shared().enabled()) {
+            stats["operationsNs"] = Tracer::shared().latencyReport();
+        }
+        if (options.hardwareCounters) {
+            stats["hardwareCounters"] = nlohmann::json::object();
+            for (const auto& entry : report.counters) {
+                stats["hardwareCounters"][entry.first] = counterJson(entry.second);
+            }
+        }
+        statsFile << stats.dump(2) << '\n';
+    }
+    return report;
+}
@@ -0,0 +1,947 @@
+// Microbenchmarks of the load, index, query and storage paths, run over generated catalogs
+// of several sizes:
+//   BooksBenchmarks [--sizes 1000,10000,100000] [--seed N] [--min-seconds S] [--filter text]
+//                   [--out results.json] [--directory <scratch>] [--counters 1]
+//                   [--threads 1,2,4,8,16,32] [--scaling-books 1000000]
+// Prints a table and writes every result as JSON, with ns, allocations and bytes allocated
+// per operation, so runs can be compared over time, the estimated bytes per book of every
+// in-memory structure at each size, and the read latency percentiles of a catalog while it
+// publishes. With --counters, the hardware counters of the benchmark thread add cycles,
+// instructions, IPC, LLC and branch misses per operation; work a benchmark hands to the
+// thread pool isn't counted. With --threads, the parallel scans also run on one catalog of
+// --scaling-books books with a pool of each size, for thread scaling curves.
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <ctime>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <map>
+#include <memory>
+#include <new>
+#include <string>
+#include <thread>
+#include <vector>
+#include "json.hpp"
+#include "BookFiles.h"
+#include "BookIdSet.h"
+#include "BookView.h"
+#include "Catalog.h"
+#include "CatalogGenerator.h"
+#include "CatalogLog.h"
+#include "ColumnStore.h"
+#include "DiffLoader.h"
+#include "FragmentCache.h"
+#include "Histogram.h"
+#include "Library.h"
+#include "LsmStore.h"
+#include "Memory.h"
+#include "Metrics.h"
+#include "PerfCounters.h"
+#include "Platform.h"
+#include "QueryCache.h"
+#include "SearchIndex.h"
+#include "SelectionLists.h"
+#include "SelectionStore.h"
+#include "ThreadPool.h"
+#include "Trace.h"
+using json = nlohmann::json;
+using namespace std;
+
+// GCC sees the replaced operators below inlined and takes free() of what operator new
+// returned for a mismatch
+#if defined(__GNUC__) && !defined(__clang__)
+#pragma GCC diagnostic ignored "-Wmismatched-new-delete"
+#endif
+
+// Every allocation made through operator new, on any thread
+static atomic<uint64_t> allocationCount{ 0 };
+static atomic<uint64_t> allocationBytes{ 0 };
+
+void* operator new(size_t size) {
+    allocationCount.fetch_add(1, memory_order_relaxed);
+    allocationBytes.fetch_add(size, memory_order_relaxed);
+    if (void* p = malloc(size == 0 ? 1 : size)) {
+        return p;
+    }
+    throw bad_alloc();
+}
+
+void* operator new[](size_t size) {
+    return operator new(size);
+}
+
+void* operator new(size_t size, const nothrow_t&) noexcept {
+    try {
+        return operator new(size);
+    }
+    catch (const bad_alloc&) {
+        return nullptr;
+    }
+}
+
+void* operator new[](size_t size, const nothrow_t&) noexcept {
+    return operator new(size, nothrow);
+}
+
+void operator delete(void* p) noexcept {
+    free(p);
+}
+
+void operator delete[](void* p) noexcept {
+    free(p);
+}
+
+void operator delete(void* p, size_t) noexcept {
+    free(p);
+}
+
+void operator delete[](void* p, size_t) noexcept {
+    free(p);
+}
+
+void operator delete(void* p, const nothrow_t&) noexcept {
+    free(p);
+}
+
+void operator delete[](void* p, const nothrow_t&) noexcept {
+    free(p);
+}
+
+// Results are added here so the compiler can't drop the work that made them
+static volatile size_t benchmarkSink;
+
+// Time, allocations and, if asked, hardware events of a benchmark while it runs. Setup between
+// pause() and resume() is neither timed nor counted, though allocations of background threads
+// during a run are.
+class Measurement {
+private:
+    bool counting;
+    chrono::steady_clock::time_point started;
+    uint64_t countAtStart = 0;
+    uint64_t bytesAtStart = 0;
+    CounterSample eventsAtStart;
+
+public:
+    uint64_t nanoseconds = 0;
+    uint64_t allocations = 0;
+    uint64_t bytes = 0;
+    // ops is left at 0, the runner knows how many there were
+    CounterTotals events;
+
+    explicit Measurement(bool counting = false) : counting(counting) {}
+
+    void resume() {
+        countAtStart = allocationCount.load(memory_order_relaxed);
+        bytesAtStart = allocationBytes.load(memory_order_relaxed);
+        if (counting) {
+            threadCounters().read(eventsAtStart);
+        }
+        started = chrono::steady_clock::now();
+    }
+
+    void pause() {
+        auto now = chrono::steady_clock::now();
+        if (counting) {
+            CounterSample eventsNow;
+            if (threadCounters().read(eventsNow)) {
+                events.add(eventsAtStart, eventsNow, 0);
+            }
+        }
+        nanoseconds += static_cast<uint64_t>(chrono::duration_cast<chrono::nanoseconds>(now - started).count());
+        allocations += allocationCount.load(memory_order_relaxed) - countAtStart;
+        bytes += allocationBytes.load(memory_order_relaxed) - bytesAtStart;
+    }
+};
+
+struct BenchmarkResult {
+    string name;
+    size_t books;
+    // what one operation is, e.g. "book" or "search"
+    string unit;
+    uint64_t ops;
+    double nsPerOp;
+    double allocsPerOp;
+    double bytesPerOp;
+    // empty unless hardware counters were read
+    CounterTotals events;
+};
+
+class BenchmarkRunner {
+private:
+    double minSeconds;
+    string filter;
+    bool counting;
+    vector<BenchmarkResult> results;
+
+public:
+    BenchmarkRunner(double minSeconds, const string& filter, bool counting)
+        : minSeconds(minSeconds), filter(filter), counting(counting) {}
+
+    bool countsEvents() const {
+        return counting;
+    }
+
+    bool selects(const string& name) const {
+        return name.find(filter) != string::npos;
+    }
+
+    double secondsPerRun() const {
+        return minSeconds;
+    }
+
+    // Runs body, which does some operations and returns how many, once to warm up and then
+    // until minSeconds have been measured. Body is called measuring and may pause around
+    // setup, resuming before it returns.
+    template <typename Body>
+    void run(const string& name, size_t books, const string& unit, Body body) {
+        if (!selects(name)) {
+            return;
+        }
+        Measurement warmup;
+        warmup.resume();
+        body(warmup);
+        warmup.pause();
+
+        Measurement measured(counting);
+        uint64_t ops = 0;
+        while (ops == 0 || measured.nanoseconds < minSeconds * 1e9) {
+            measured.resume();
+            uint64_t done = body(measured);
+            measured.pause();
+            if (done == 0) {
+                break;
+            }
+            ops += done;
+        }
+        double perOp = 1.0 / max<uint64_t>(ops, 1);
+        BenchmarkResult result{ name, books, unit, ops, measured.nanoseconds * perOp, measured.allocations * perOp, measured.bytes * perOp,
+            measured.events };
+        result.events.ops = counting ? ops : 0;
+        printf("%-36s %10zu %12.1f ns/%-7s %10.2f allocs %12.1f bytes", name.c_str(), books, result.nsPerOp, unit.c_str(),
+            result.allocsPerOp, result.bytesPerOp);
+        if (counting) {
+            const CounterTotals& events = result.events;
+            printf(" %10.0f cycles %5.2f IPC %8.3f LLC %8.3f br", events.perOp(events.cycles), events.ipc(),
+                events.perOp(events.llcMisses), events.perOp(events.branchMisses));
+        }
+        printf("\n");
+        fflush(stdout);
+        results.push_back(result);
+    }
+
+    const vector<BenchmarkResult>& all() const {
+        return results;
+    }
+};
+
+// One generated catalog, in every form the benchmarks start from
+struct BenchmarkCatalog {
+    size_t books;
+    string jsonPath;
+    string binaryPath;
+    json jsonData;
+    shared_ptr<const CatalogSnapshot> snapshot;
+    // values searched for, taken from the first books so popular ones come up most
+    vector<string> authors;
+    vector<string> languages;
+    vector<string> titleParts;
+};
+
+// Generates a catalog of books in both formats and loads it. withJson keeps the parsed JSON
+// too, which takes about 1 KB a book and only the load benchmarks need.
+BenchmarkCatalog generateCatalog(size_t books, uint64_t seed, const string& directory, bool withJson = true) {
+    BenchmarkCatalog catalog;
+    catalog.books = books;
+    catalog.jsonPath = directory + "/catalog-" + to_string(books) + ".json";
+    catalog.binaryPath = directory + "/catalog-" + to_string(books) + ".bin";
+    GeneratorOptions options;
+    options.books = books;
+    options.seed = seed;
+    if (withJson) {
+        options.format = CatalogFormat::JSON;
+        CatalogGenerator(options).write(catalog.jsonPath);
+        catalog.jsonData = loadJsonFile(catalog.jsonPath);
+    }
+    options.format = CatalogFormat::BINARY;
+    CatalogGenerator(options).write(catalog.binaryPath);
+
+    catalog.snapshot = Catalog(loadBinaryCatalog(catalog.binaryPath)).snapshot();
+    const Library<Book>& library = catalog.snapshot->library;
+    for (size_t i = 0; i < min<size_t>(library.getSize(), 64); ++i) {
+        const Book& book = library.getItem(i);
+        catalog.authors.push_back(book.getAuthor().getName());
+        if (i % 4 == 0) {
+            catalog.languages.push_back(book.getLanguage());
+            catalog.titleParts.push_back(book.getTitle().substr(0, 4));
+        }
+    }
+    return catalog;
+}
+
+// Estimated bytes of every in-memory structure built from catalog, by component
+map<string, size_t> catalogMemory(const BenchmarkCatalog& catalog) {
+    const CatalogSnapshot& snapshot = *catalog.snapshot;
+    map<string, size_t> bytes;
+    bytes["load.json_dom"] = jsonBytes(catalog.jsonData);
+    bytes["catalog.books"] = snapshot.library.storageBytes();
+    size_t strings = 0;
+    for (size_t i = 0; i < snapshot.library.getSize(); ++i) {
+        strings += snapshot.library.getItem(i).heapBytes();
+    }
+    bytes["catalog.strings"] = strings;
+    bytes["catalog.titles"] = snapshot.titles.bytes();
+    bytes["index.author"] = KeyIndex::build(snapshot.library, SearchField::AUTHOR).bytes();
+    bytes["index.language"] = KeyIndex::build(snapshot.library, SearchField::LANGUAGE).bytes();
+    return bytes;
+}
+
+void runLoadBenchmarks(BenchmarkRunner& runner, const BenchmarkCatalog& catalog) {
+    size_t books = catalog.books;
+    const Library<Book>& library = catalog.snapshot->library;
+    runner.run("loadJsonFile", books, "book", [&](Measurement&) {
+        benchmarkSink += loadJsonFile(catalog.jsonPath).size();
+        return books;
+    });
+    runner.run("loadBinaryCatalog", books, "book", [&](Measurement&) {
+        benchmarkSink += loadBinaryCatalog(catalog.binaryPath).getSize();
+        return books;
+    });
+    runner.run("Book(json)", books, "book", [&](Measurement&) {
+        for (const auto& bookData : catalog.jsonData) {
+            Book book(bookData);
+            benchmarkSink += book.getTitle().size();
+        }
+        return books;
+    });
+    runner.run("Library::addItem", books, "book", [&](Measurement& measurement) {
+        {
+            Library<Book> built;
+            for (size_t i = 0; i < books; ++i) {
+                built.addItem(library.getItem(i));
+            }
+            benchmarkSink += built.getSize();
+            measurement.pause();
+        }
+        measurement.resume();
+        return books;
+    });
+}
+
+void runSearchBenchmarks(BenchmarkRunner& runner, const BenchmarkCatalog& catalog) {
+    size_t books = catalog.books;
+    const CatalogSnapshot& snapshot = *catalog.snapshot;
+    runner.run("Library::searchBooksByAuthor", books, "search", [&](Measurement&) {
+        for (const string& author : catalog.authors) {
+            benchmarkSink += snapshot.library.searchBooksByAuthor(author).size();
+        }
+        return catalog.authors.size();
+    });
+    runner.run("Library::searchBooksByLanguage", books, "search", [&](Measurement&) {
+        for (const string& language : catalog.languages) {
+            benchmarkSink += snapshot.library.searchBooksByLanguage(language).size();
+        }
+        return catalog.languages.size();
+    });
+    runner.run("searchTitleContains", books, "search", [&](Measurement&) {
+        for (const string& part : catalog.titleParts) {
+            benchmarkSink += searchTitleContains(snapshot.titles, part, true).size();
+        }
+        return catalog.titleParts.size();
+    });
+}
+
+void runSelectionBenchmarks(BenchmarkRunner& runner, const BenchmarkCatalog& catalog, const string& directory) {
+    size_t books = catalog.books;
+    const Library<Book>& library = catalog.snapshot->library;
+    string journalPath = directory + "/selected.journal";
+    string savedPath = directory + "/selected_books.txt";
+    // a user saves a few books, however big the catalog
+    size_t saved = min<size_t>(books, 1000);
+    runner.run("SelectionStore::add", books, "book", [&](Measurement& measurement) {
+        measurement.pause();
+        remove(journalPath.c_str());
+        {
+            SelectionStore store(journalPath);
+            measurement.resume();
+            for (size_t i = 0; i < saved; ++i) {
+                store.add(library.getItem(i * 7 % books));
+            }
+            measurement.pause();
+        }
+        measurement.resume();
+        return saved;
+    });
+    remove(journalPath.c_str());
+    {
+        SelectionStore store(journalPath);
+        for (size_t i = 0; i < saved; ++i) {
+            store.add(library.getItem(i * 7 % books));
+        }
+        runner.run("saveSelectedBooks", books, "save", [&](Measurement&) {
+            saveSelectedBooks(store, savedPath);
+            return 1;
+        });
+    }
+    remove(journalPath.c_str());
+    remove(savedPath.c_str());
+
+    string listsPath = directory + "/lists.journal";
+    vector<BookId> listed;
+    for (size_t i = 0; i < saved; ++i) {
+        listed.push_back(static_cast<BookId>(i * 7 % books));
+    }
+    runner.run("SelectionLists::add", books, "book", [&](Measurement& measurement) {
+        measurement.pause();
+        remove(listsPath.c_str());
+        {
+            SelectionLists lists(listsPath);
+            measurement.resume();
+            benchmarkSink += lists.add("user", "to-read", *catalog.snapshot, listed);
+            measurement.pause();
+        }
+        measurement.resume();
+        return saved;
+    });
+    remove(listsPath.c_str());
+    {
+        SelectionLists lists(listsPath);
+        lists.add("user", "to-read", *catalog.snapshot, listed);
+        runner.run("SelectionLists::contains", books, "lookup", [&](Measurement&) {
+            for (size_t i = 0; i < saved; ++i) {
+                benchmarkSink += lists.contains("user", "to-read", *catalog.snapshot, static_cast<BookId>(i));
+            }
+            return saved;
+        });
+        // the id lookup and title order of the version are built by the warmup
+        TitleOrder titleOrder;
+        json request = { { "op", "show" }, { "user", "user" }, { "list", "to-read" } };
+        runner.run("SelectionLists::show", books, "show", [&](Measurement&) {
+            bool failed;
+            benchmarkSink += runSelectionLine(lists, titleOrder, *catalog.snapshot, request, failed).size();
+            return 1;
+        });
+        // a list read against every new version, as under continuous edits
+        Catalog edited(catalog.snapshot->library);
+        runner.run("SelectionLists::get(new version)", books, "get", [&](Measurement& measurement) {
+            measurement.pause();
+            edited.modify([](CatalogSnapshot&) { return true; });
+            shared_ptr<const CatalogSnapshot> version = edited.snapshot();
+            measurement.resume();
+            benchmarkSink += lists.get("user", "to-read", *version).size();
+            return 1;
+        });
+    }
+    remove(listsPath.c_str());
+}
+
+void runIndexBenchmarks(BenchmarkRunner& runner, const BenchmarkCatalog& catalog) {
+    size_t books = catalog.books;
+    const CatalogSnapshot& snapshot = *catalog.snapshot;
+    runner.run("ColumnStore::build", books, "book", [&](Measurement&) {
+        benchmarkSink += ColumnStore::build(snapshot.library).size();
+        return books;
+    });
+    runner.run("KeyIndex::build(author)", books, "book", [&](Measurement&) {
+        benchmarkSink += KeyIndex::build(snapshot.library, SearchField::AUTHOR).size();
+        return books;
+    });
+    runner.run("KeyIndex::build(language)", books, "book", [&](Measurement&) {
+        benchmarkSink += KeyIndex::build(snapshot.library, SearchField::LANGUAGE).size();
+        return books;
+    });
+    auto authors = make_shared<const KeyIndex>(KeyIndex::build(snapshot.library, SearchField::AUTHOR));
+    runner.run("IncrementalSearch::push", books, "key", [&](Measurement&) {
+        uint64_t keys = 0;
+        for (const string& author : catalog.authors) {
+            IncrementalSearch search(authors);
+            for (size_t i = 0; i < min<size_t>(author.size(), 8); ++i) {
+                search.push(author[i]);
+                benchmarkSink += search.matchCount();
+                ++keys;
+            }
+        }
+        return keys;
+    });
+    runner.run("SortedOrders::get(title)", books, "book", [&](Measurement&) {
+        SortedOrders orders;
+        benchmarkSink += orders.get(snapshot, ViewOrder::TITLE)->size();
+        return books;
+    });
+    auto orders = make_shared<SortedOrders>();
+    orders->get(snapshot, ViewOrder::TITLE);
+    runner.run("BookView::page(language)", books, "page", [&](Measurement&) {
+        uint64_t pages = 0;
+        for (const string& language : catalog.languages) {
+            Query query;
+            query.language = language;
+            BookView view(catalog.snapshot, query, ViewOrder::TITLE, orders);
+            for (size_t first = 0; first < 20 * 10; first += 20) {
+                benchmarkSink += view.page(first, 20).size();
+                ++pages;
+            }
+        }
+        return pages;
+    });
+    BookIdSet everyThird;
+    for (size_t i = 0; i < books; i += 3) {
+        everyThird.insert(static_cast<BookId>(i));
+    }
+    runner.run("BookIdSet::insert", books, "id", [&](Measurement&) {
+        BookIdSet set;
+        for (size_t i = 0; i < books; i += 3) {
+            set.insert(static_cast<BookId>(i));
+        }
+        benchmarkSink += set.size();
+        return (books + 2) / 3;
+    });
+    runner.run("BookIdSet::contains", books, "lookup", [&](Measurement&) {
+        for (size_t i = 0; i < books; ++i) {
+            benchmarkSink += everyThird.contains(static_cast<BookId>(i));
+        }
+        return books;
+    });
+    TitleOrder titleOrder;
+    titleOrder.ranks(snapshot);
+    runner.run("TitleOrder::arrange", books, "id", [&](Measurement&) {
+        benchmarkSink += titleOrder.arrange(snapshot, everyThird).size();
+        return everyThird.size();
+    });
+}
+
+void runCacheBenchmarks(BenchmarkRunner& runner, const BenchmarkCatalog& catalog) {
+    size_t books = catalog.books;
+    const CatalogSnapshot& snapshot = *catalog.snapshot;
+    vector<Query> queries;
+    for (size_t i = 0; i < catalog.titleParts.size(); ++i) {
+        Query query;
+        query.language = catalog.languages[i];
+        query.title = catalog.titleParts[i];
+        query.ignoreCase = true;
+        queries.push_back(query);
+    }
+    runner.run("QueryCache::run(miss)", books, "query", [&](Measurement&) {
+        QueryCache cache(0);
+        for (const Query& query : queries) {
+            benchmarkSink += cache.run(snapshot, query)->size();
+        }
+        return queries.size();
+    });
+    QueryCache warmQueries(0);
+    for (const Query& query : queries) {
+        warmQueries.run(snapshot, query);
+    }
+    runner.run("QueryCache::run(hit)", books, "query", [&](Measurement&) {
+        for (const Query& query : queries) {
+            benchmarkSink += warmQueries.run(snapshot, query)->size();
+        }
+        return queries.size();
+    });
+    size_t fragments = min<size_t>(books, 4096);
+    runner.run("FragmentCache::get(miss)", books, "get", [&](Measurement&) {
+        FragmentCache cold;
+        for (size_t i = 0; i < fragments; ++i) {
+            benchmarkSink += cold.get(snapshot, static_cast<BookId>(i))->size();
+        }
+        return fragments;
+    });
+    FragmentCache warmFragments;
+    for (size_t i = 0; i < fragments; ++i) {
+        warmFragments.get(snapshot, static_cast<BookId>(i));
+    }
+    runner.run("FragmentCache::get(hit)", books, "get", [&](Measurement&) {
+        for (size_t i = 0; i < fragments; ++i) {
+            benchmarkSink += warmFragments.get(snapshot, static_cast<BookId>(i))->size();
+        }
+        return fragments;
+    });
+}
+
+// The storage paths: incremental reloads of the catalog file, durable edits through the
+// write-ahead log and the log-structured store, and the store's compaction
+void runStorageBenchmarks(BenchmarkRunner& runner, const BenchmarkCatalog& catalog, const string& directory) {
+    size_t books = catalog.books;
+    string text;
+    {
+        ifstream in(catalog.jsonPath, ios::binary);
+        text.assign(istreambuf_iterator<char>(in), istreambuf_iterator<char>());
+    }
+    // the same file with the first title one letter longer
+    string edited = text;
+    edited.insert(edited.find("\"title\"") + 9, "X");
+    string reloadPath = directory + "/reload.json";
+    auto writeText = [](const string& path, const string& contents) {
+        ofstream out(path, ios::binary);
+        out << contents;
+    };
+    writeText(reloadPath, text);
+    {
+        Catalog reloaded;
+        DiffLoader loader(reloaded, reloadPath);
+        loader.reload();
+        runner.run("DiffLoader::reload(unchanged)", books, "reload", [&](Measurement&) {
+            benchmarkSink += loader.reload().books;
+            return 1;
+        });
+        bool editedNow = false;
+        runner.run("DiffLoader::reload(one edit)", books, "reload", [&](Measurement& measurement) {
+            measurement.pause();
+            editedNow = !editedNow;
+            writeText(reloadPath, editedNow ? edited : text);
+            measurement.resume();
+            benchmarkSink += loader.reload().books;
+            return 1;
+        });
+    }
+    remove(reloadPath.c_str());
+
+    const Library<Book>& library = catalog.snapshot->library;
+    // edits in a batch, so checking the clock isn't timed for every one
+    const size_t edits = 64;
+    for (SyncMode sync : { SyncMode::NONE, SyncMode::EACH }) {
+        string name = sync == SyncMode::NONE ? "CatalogLog::addBook(sync none)" : "CatalogLog::addBook(sync each)";
+        if (!runner.selects(name)) {
+            continue;
+        }
+        string logPath = directory + "/catalog.wal";
+        remove(logPath.c_str());
+        remove((logPath + ".snapshot").c_str());
+        {
+            LogOptions options;
+            options.sync = sync;
+            options.checkpointBytes = 0;
+            options.checkpointSeconds = 0;
+            Catalog logged;
+            CatalogLog log(logged, catalog.jsonPath, logPath, options);
+            runner.run(name, books, "edit", [&](Measurement&) {
+                for (size_t i = 0; i < edits; ++i) {
+                    benchmarkSink += log.addBook(library.getItem(i % books));
+                }
+                return edits;
+            });
+        }
+        remove(logPath.c_str());
+    }
+
+    string storePath = directory + "/store";
+    filesystem::remove_all(storePath);
+    {
+        LsmOptions options;
+        options.syncWrites = false;
+        options.compactAt = 0;
+        Catalog stored;
+        LsmStore store(stored, catalog.jsonPath, storePath, options);
+        // puts of books already stored, so the catalog keeps its size
+        size_t next = 0;
+        runner.run("LsmStore::addBook(put)", books, "edit", [&](Measurement&) {
+            for (size_t i = 0; i < edits; ++i, ++next) {
+                benchmarkSink += store.addBook(library.getItem(next % books));
+            }
+            return edits;
+        });
+        store.flushNow();
+    }
+    // opening reads every run back, newest first, which is how the store serves gets
+    runner.run("LsmStore::open", books, "book", [&](Measurement& measurement) {
+        measurement.pause();
+        {
+            LsmOptions options;
+            options.compactAt = 0;
+            Catalog stored;
+            measurement.resume();
+            LsmStore store(stored, catalog.jsonPath, storePath, options);
+            benchmarkSink += stored.snapshot()->library.getSize();
+            measurement.pause();
+        }
+        measurement.resume();
+        return books;
+    });
+    {
+        LsmOptions options;
+        options.syncWrites = false;
+        options.compactAt = 4;
+        options.compactionBytesPerSecond = 0;
+        Catalog stored;
+        LsmStore store(stored, catalog.jsonPath, storePath, options);
+        runner.run("LsmStore compaction", books, "book", [&](Measurement& measurement) {
+            measurement.pause();
+            // small runs on top of the one holding every book, until the last flush starts a merge
+            uint64_t compactions = store.stats().compactions;
+            size_t put = 0;
+            while (store.stats().runs + 1 < options.compactAt) {
+                store.addBook(library.getItem(put++ % books));
+                store.flushNow();
+            }
+            store.addBook(library.getItem(put % books));
+            measurement.resume();
+            store.flushNow();
+            while (store.stats().compactions == compactions) {
+                if (!store.stats().compactionError.empty()) {
+                    throw runtime_error("Compaction failed: " + store.stats().compactionError);
+                }
+                this_thread::yield();
+            }
+            return books;
+        });
+    }
+    filesystem::remove_all(storePath);
+}
+
+// The parallel scans on pools of each of threadCounts threads. Names end in the thread count,
+// e.g. "filterItems(language)/4t", and each result is also returned by name and thread count
+// with its speedup over the smallest pool, for the scaling curve.
+json runScalingBenchmarks(BenchmarkRunner& runner, const BenchmarkCatalog& catalog, const vector<size_t>& threadCounts) {
+    size_t books = catalog.books;
+    const CatalogSnapshot& snapshot = *catalog.snapshot;
+    const string& language = catalog.languages[0];
+    const string& titlePart = catalog.titleParts[0];
+    // ns per book of each benchmark at the smallest pool
+    map<string, double> baseline;
+    json scaling = json::array();
+    for (size_t threads : threadCounts) {
+        ThreadPool pool(threads);
+        ExecutionPolicy policy = ExecutionPolicy::parallel(pool);
+        string suffix = "/" + to_string(threads) + "t";
+        size_t first = runner.all().size();
+        runner.run("filterItems(language)" + suffix, books, "book", [&](Measurement&) {
+            benchmarkSink += snapshot.library.filterItems([&](const Book& book) { return book.getLanguage() == language; }, policy).size();
+            return books;
+        });
+        runner.run("searchTitleContains" + suffix, books, "book", [&](Measurement&) {
+            benchmarkSink += searchTitleContains(snapshot.titles, titlePart, true, policy).size();
+            return books;
+        });
+        runner.run("countBy(language)" + suffix, books, "book", [&](Measurement&) {
+            benchmarkSink += snapshot.library.countBy([](const Book& book) -> const string& { return book.getLanguage(); }, policy).size();
+            return books;
+        });
+        runner.run("sortedIds(title)" + suffix, books, "book", [&](Measurement&) {
+            benchmarkSink += snapshot.library.sortedIds([](const Book& a, const Book& b) { return a.getTitle() < b.getTitle(); }, policy).size();
+            return books;
+        });
+        for (size_t i = first; i < runner.all().size(); ++i) {
+            const BenchmarkResult& result = runner.all()[i];
+            string name = result.name.substr(0, result.name.size() - suffix.size());
+            baseline.emplace(name, result.nsPerOp);
+            scaling.push_back({ { "name", name }, { "books", books }, { "threads", threads }, { "nsPerOp", result.nsPerOp },
+                { "speedup", baseline[name] / result.nsPerOp } });
+        }
+    }
+    return scaling;
+}
+
+// Latency of single reads of a Catalog, each pinning the current version and reading one book,
+// first alone and then while another thread publishes a new version as fast as it can. Reads
+// never take the writer lock, so their p99 should hardly move. Returns one JSON entry per run.
+json runPublishLatency(BenchmarkRunner& runner, const BenchmarkCatalog& catalog) {
+    json runs = json::array();
+    for (bool publishing : { false, true }) {
+        string name = publishing ? "Catalog::snapshot(publishing)" : "Catalog::snapshot(idle)";
+        if (!runner.selects(name)) {
+            continue;
+        }
+        Catalog live(catalog.snapshot->library);
+        const Library<Book>& source = catalog.snapshot->library;
+        atomic<bool> stopping{ false };
+        atomic<uint64_t> publishes{ 0 };
+        thread publisher;
+        if (publishing) {
+            publisher = thread([&] {
+                for (size_t i = 0; !stopping.load(memory_order_relaxed); ++i) {
+                    live.addItem(source.getItem(i % source.getSize()));
+                    live.publish();
+                    publishes.fetch_add(1, memory_order_relaxed);
+                }
+            });
+        }
+        LatencyHistogram latency;
+        auto started = chrono::steady_clock::now();
+        auto deadline = started + chrono::duration_cast<chrono::steady_clock::duration>(chrono::duration<double>(runner.secondsPerRun()));
+        for (size_t i = 0;; ++i) {
+            auto readStart = chrono::steady_clock::now();
+            if (readStart >= deadline) {
+                break;
+            }
+            shared_ptr<const CatalogSnapshot> pinned = live.snapshot();
+            benchmarkSink += pinned->library.getItem(i % catalog.books).getTitle().size();
+            pinned.reset();
+            latency.record(static_cast<uint64_t>(chrono::duration_cast<chrono::nanoseconds>(chrono::steady_clock::now() - readStart).count()));
+        }
+        double seconds = chrono::duration<double>(chrono::steady_clock::now() - started).count();
+        stopping = true;
+        if (publisher.joinable()) {
+            publisher.join();
+        }
+        double publishRate = publishes.load() / seconds;
+        printf("%-36s %10zu p50 %8llu ns p99 %8llu ns p99.9 %8llu ns max %10llu ns %10.0f publishes/s\n", name.c_str(), catalog.books,
+            static_cast<unsigned long long>(latency.percentile(0.50)), static_cast<unsigned long long>(latency.percentile(0.99)),
+            static_cast<unsigned long long>(latency.percentile(0.999)), static_cast<unsigned long long>(latency.max()), publishRate);
+        fflush(stdout);
+        runs.push_back({ { "name", name }, { "books", catalog.books }, { "reads", latency.count() }, { "publishesPerSecond", publishRate },
+            { "p50", latency.percentile(0.50) }, { "p99", latency.percentile(0.99) }, { "p999", latency.percentile(0.999) },
+            { "max", latency.max() } });
+    }
+    return runs;
+}
+
+// Cost of a span while tracing is off, as everywhere by default, and while it's on
+void runTraceBenchmarks(BenchmarkRunner& runner, size_t books) {
+    const size_t spans = 100000;
+    runner.run("TraceSpan(off)", books, "span", [&](Measurement&) {
+        for (size_t i = 0; i < spans; ++i) {
+            TraceSpan span("benchmark.span");
+            benchmarkSink += i;
+        }
+        return spans;
+    });
+    runner.run("TraceSpan(on)", books, "span", [&](Measurement& measurement) {
+        measurement.pause();
+        Tracer::shared().start(false);
+        measurement.resume();
+        for (size_t i = 0; i < spans; ++i) {
+            TraceSpan span("benchmark.span");
+            benchmarkSink += i;
+        }
+        measurement.pause();
+        Tracer::shared().stop();
+        measurement.resume();
+        return spans;
+    });
+}
+
+// Recording metrics on the hot path, and exporting them
+void runMetricsBenchmarks(BenchmarkRunner& runner, size_t books) {
+    const size_t records = 100000;
+    Counter counter = MetricsRegistry::shared().counter("benchmark_records_total", "Benchmark counter");
+    Histogram histogram = MetricsRegistry::shared().histogram("benchmark_record_seconds", "Benchmark histogram");
+    runner.run("Counter::add", books, "record", [&](Measurement&) {
+        for (size_t i = 0; i < records; ++i) {
+            counter.add();
+        }
+        return records;
+    });
+    runner.run("Histogram::record", books, "record", [&](Measurement&) {
+        for (size_t i = 0; i < records; ++i) {
+            histogram.record(i);
+        }
+        return records;
+    });
+    runner.run("prometheusText", books, "export", [&](Measurement&) {
+        benchmarkSink += MetricsRegistry::shared().prometheusText().size();
+        return size_t(1);
+    });
+}
+
+// UTC time of the run, e.g. 2024-05-01T12:00:00Z
+string utcTimestamp() {
+    tm utc = utcTime(time(nullptr));
+    char text[32];
+    strftime(text, sizeof(text), "%Y-%m-%dT%H:%M:%SZ", &utc);
+    return text;
+}
+
+int main(int argc, char* argv[]) {
+    try {
+        map<string, string> flags;
+        for (int i = 1; i < argc; i += 2) {
+            if (i + 1 >= argc) {
+                throw runtime_error(string("Missing value for ") + argv[i]);
+            }
+            flags[argv[i]] = argv[i + 1];
+        }
+        auto optionOr = [&flags](const string& flag, const string& fallback) {
+            auto it = flags.find(flag);
+            return it == flags.end() ? fallback : it->second;
+        };
+        // comma separated positive numbers, e.g. 1000,10000
+        auto numberList = [](const string& list, const string& what) {
+            vector<size_t> numbers;
+            for (size_t start = 0; start < list.size();) {
+                size_t comma = list.find(',', start);
+                string number = list.substr(start, comma == string::npos ? string::npos : comma - start);
+                if (stoull(number) == 0) {
+                    throw runtime_error(what + " must be positive");
+                }
+                numbers.push_back(stoull(number));
+                start = comma == string::npos ? list.size() : comma + 1;
+            }
+            return numbers;
+        };
+        vector<size_t> sizes = numberList(optionOr("--sizes", "1000,10000,100000"), "Catalog sizes");
+        vector<size_t> threadCounts = numberList(optionOr("--threads", ""), "Thread counts");
+        size_t scalingBooks = stoull(optionOr("--scaling-books", "1000000"));
+        uint64_t seed = stoull(optionOr("--seed", "1"));
+        double minSeconds = stod(optionOr("--min-seconds", "0.2"));
+        string outputPath = optionOr("--out", "benchmarks.json");
+        string directory = optionOr("--directory", (filesystem::temp_directory_path() / "BooksBenchmarks").string());
+        filesystem::create_directories(directory);
+
+        bool counting = optionOr("--counters", "0") == "1";
+        if (counting && !threadCounters().available()) {
+            cerr << "Hardware counters unavailable, " << threadCounters().error() << endl;
+            counting = false;
+        }
+        BenchmarkRunner runner(minSeconds, optionOr("--filter", ""), counting);
+        json memory = json::array();
+        json readLatency = json::array();
+        for (size_t books : sizes) {
+            BenchmarkCatalog catalog = generateCatalog(books, seed, directory);
+            for (const auto& entry : catalogMemory(catalog)) {
+                memory.push_back({ { "books", books }, { "component", entry.first }, { "bytes", entry.second },
+                    { "bytesPerBook", static_cast<double>(entry.second) / books } });
+            }
+            runLoadBenchmarks(runner, catalog);
+            runSearchBenchmarks(runner, catalog);
+            runSelectionBenchmarks(runner, catalog, directory);
+            runIndexBenchmarks(runner, catalog);
+            runCacheBenchmarks(runner, catalog);
+            runStorageBenchmarks(runner, catalog, directory);
+            for (const json& run : runPublishLatency(runner, catalog)) {
+                readLatency.push_back(run);
+            }
+            runTraceBenchmarks(runner, books);
+            runMetricsBenchmarks(runner, books);
+            remove(catalog.jsonPath.c_str());
+            remove(catalog.binaryPath.c_str());
+        }
+
+        json report;
+        report["date"] = utcTimestamp();
+        report["seed"] = seed;
+        report["minSeconds"] = minSeconds;
+        report["threads"] = thread::hardware_concurrency();
+        report["benchmarks"] = json::array();
+        for (const BenchmarkResult& result : runner.all()) {
+            json entry = { { "name", result.name }, { "books", result.books }, { "unit", result.unit },
+                { "ops", result.ops }, { "nsPerOp", result.nsPerOp }, { "allocsPerOp", result.allocsPerOp },
+                { "bytesPerOp", result.bytesPerOp } };
+            if (runner.countsEvents()) {
+                entry["counters"] = counterJson(result.events);
+            }
+            report["benchmarks"].push_back(entry);
+        }
+        json scaling = json::array();
+        if (!threadCounts.empty()) {
+            BenchmarkCatalog catalog = generateCatalog(scalingBooks, seed, directory, false);
+            scaling = runScalingBenchmarks(runner, catalog, threadCounts);
+            remove(catalog.binaryPath.c_str());
+        }
+
+        report["memory"] = memory;
+        report["scaling"] = scaling;
+        report["readLatency"] = readLatency;
+        ofstream out(outputPath);
+        if (!out) {
+            throw runtime_error("Error opening file: " + outputPath);
+        }
+        out << report.dump(2) << '\n';
+        cout << "Wrote " << runner.all().size() << " results to " << outputPath << endl;
+    }
+    catch (const exception& e) {
+        cerr << "Error: " << e.what() << endl;
+        return 1;
+    }
+    return 0;
+}
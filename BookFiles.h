@@ -0,0 +1,50 @@
+#pragma once
+#include <fstream>
+#include <stdexcept>
+#include <string>
+#include "json.hpp"
+#include "DurableFile.h"
+#include "Library.h"
+#include "SelectionStore.h"
+#include "Trace.h"
+
+// Loads JSON file
+inline nlohmann::json loadJsonFile(const std::string& filename) {
+    TraceSpan span("load.parse");
+    std::ifstream inFile(filename);
+
+    if (!inFile) {
+        throw std::runtime_error("Error opening file: " + filename);
+    }
+
+    nlohmann::json jsonData;
+    inFile >> jsonData;
+    inFile.close();
+    MemoryAccounts::shared().notePeak("load.json_dom", jsonBytes(jsonData));
+    return jsonData;
+}
+
+// Loads every book of a JSON file into a library
+inline Library<Book> loadLibrary(const std::string& filename) {
+    TraceSpan span("load");
+    Library<Book> library;
+    nlohmann::json jsonData = loadJsonFile(filename);
+    TraceSpan build("load.build");
+    for (const auto& bookData : jsonData) {
+        library.addItem(Book(bookData));
+    }
+    countBooksLoaded(library.getSize());
+    return library;
+}
+
+// Saves the selected books
+inline void saveSelectedBooks(const SelectionStore& selectedBooks, const std::string& filename) {
+    TraceSpan span("save");
+    // the store keeps the books in title order, so nothing is sorted here
+    std::string text;
+    for (const std::string& title : selectedBooks.sortedTitles()) {
+        text += title;
+        text += '\n';
+    }
+    writeFileAtomically(filename, text);
+}
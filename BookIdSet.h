@@ -0,0 +1,270 @@
+#pragma once
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <string>
+#include <vector>
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif
+#include "Library.h"
+
+// Compressed set of book ids. Ids are split by their high 16 bits into blocks of 65536; a
+// block holding few ids stores them as a sorted array of their low 16 bits, and a block
+// holding more than ARRAY_LIMIT switches to a 8KB bitmap. Membership costs one binary search
+// over the blocks plus a bit test or a search of at most ARRAY_LIMIT entries, whatever the
+// set's size, and a set never takes more than about a bit per possible id.
+class BookIdSet {
+private:
+    // past this many ids a block's array would outgrow its bitmap
+    static constexpr size_t ARRAY_LIMIT = 4096;
+    static constexpr size_t BITMAP_WORDS = 65536 / 64;
+
+    static unsigned lowestSetBit(uint64_t word) {
+#ifdef _MSC_VER
+        unsigned long index;
+        _BitScanForward64(&index, word);
+        return static_cast<unsigned>(index);
+#else
+        return static_cast<unsigned>(__builtin_ctzll(word));
+#endif
+    }
+
+    struct Block {
+        uint16_t key;
+        size_t count = 0;
+        // sorted low bits while count <= ARRAY_LIMIT, otherwise empty
+        std::vector<uint16_t> array;
+        // BITMAP_WORDS words once count > ARRAY_LIMIT, otherwise empty
+        std::vector<uint64_t> bitmap;
+
+        bool contains(uint16_t low) const {
+            if (!bitmap.empty()) {
+                return (bitmap[low >> 6] >> (low & 63)) & 1;
+            }
+            return std::binary_search(array.begin(), array.end(), low);
+        }
+
+        bool insert(uint16_t low) {
+            if (!bitmap.empty()) {
+                uint64_t bit = uint64_t(1) << (low & 63);
+                if (bitmap[low >> 6] & bit) {
+                    return false;
+                }
+                bitmap[low >> 6] |= bit;
+                ++count;
+                return true;
+            }
+            auto it = std::lower_bound(array.begin(), array.end(), low);
+            if (it != array.end() && *it == low) {
+                return false;
+            }
+            array.insert(it, low);
+            ++count;
+            if (count > ARRAY_LIMIT) {
+                bitmap.assign(BITMAP_WORDS, 0);
+                for (uint16_t value : array) {
+                    bitmap[value >> 6] |= uint64_t(1) << (value & 63);
+                }
+                std::vector<uint16_t>().swap(array);
+            }
+            return true;
+        }
+
+        bool erase(uint16_t low) {
+            if (!bitmap.empty()) {
+                uint64_t bit = uint64_t(1) << (low & 63);
+                if (!(bitmap[low >> 6] & bit)) {
+                    return false;
+                }
+                bitmap[low >> 6] &= ~bit;
+                --count;
+                if (count <= ARRAY_LIMIT / 2) {
+                    // shrink back, leaving room so a set near the limit doesn't flip every call
+                    for (size_t w = 0; w < BITMAP_WORDS; ++w) {
+                        for (uint64_t word = bitmap[w]; word != 0; word &= word - 1) {
+                            array.push_back(static_cast<uint16_t>(w * 64 + lowestSetBit(word)));
+                        }
+                    }
+                    std::vector<uint64_t>().swap(bitmap);
+                }
+                return true;
+            }
+            auto it = std::lower_bound(array.begin(), array.end(), low);
+            if (it == array.end() || *it != low) {
+                return false;
+            }
+            array.erase(it);
+            --count;
+            return true;
+        }
+
+        template <typename Fn>
+        void forEach(Fn&& fn) const {
+            uint32_t high = static_cast<uint32_t>(key) << 16;
+            if (bitmap.empty()) {
+                for (uint16_t low : array) {
+                    fn(static_cast<BookId>(high | low));
+                }
+                return;
+            }
+            for (size_t w = 0; w < BITMAP_WORDS; ++w) {
+                for (uint64_t word = bitmap[w]; word != 0; word &= word - 1) {
+                    fn(static_cast<BookId>(high | (w * 64 + lowestSetBit(word))));
+                }
+            }
+        }
+    };
+
+    // sorted by key
+    std::vector<Block> blocks;
+    size_t total = 0;
+
+    std::vector<Block>::iterator find(uint16_t key) {
+        return std::lower_bound(blocks.begin(), blocks.end(), key, [](const Block& block, uint16_t k) { return block.key < k; });
+    }
+
+    std::vector<Block>::const_iterator find(uint16_t key) const {
+        return std::lower_bound(blocks.begin(), blocks.end(), key, [](const Block& block, uint16_t k) { return block.key < k; });
+    }
+
+public:
+    bool contains(BookId id) const {
+        auto it = find(static_cast<uint16_t>(id >> 16));
+        return it != blocks.end() && it->key == (id >> 16) && it->contains(static_cast<uint16_t>(id));
+    }
+
+    // adds id; false if it was already there
+    bool insert(BookId id) {
+        uint16_t key = static_cast<uint16_t>(id >> 16);
+        auto it = find(key);
+        if (it == blocks.end() || it->key != key) {
+            Block block;
+            block.key = key;
+            it = blocks.insert(it, std::move(block));
+        }
+        if (!it->insert(static_cast<uint16_t>(id))) {
+            return false;
+        }
+        ++total;
+        return true;
+    }
+
+    // removes id; false if it wasn't there
+    bool erase(BookId id) {
+        uint16_t key = static_cast<uint16_t>(id >> 16);
+        auto it = find(key);
+        if (it == blocks.end() || it->key != key || !it->erase(static_cast<uint16_t>(id))) {
+            return false;
+        }
+        if (it->count == 0) {
+            blocks.erase(it);
+        }
+        --total;
+        return true;
+    }
+
+    size_t size() const {
+        return total;
+    }
+
+    // bytes of the blocks with their arrays and bitmaps
+    size_t bytes() const {
+        size_t result = vectorBytes(blocks);
+        for (const Block& block : blocks) {
+            result += vectorBytes(block.array) + vectorBytes(block.bitmap);
+        }
+        return result;
+    }
+
+    bool empty() const {
+        return total == 0;
+    }
+
+    // calls fn with every id in increasing order
+    template <typename Fn>
+    void forEach(Fn&& fn) const {
+        for (const Block& block : blocks) {
+            block.forEach(fn);
+        }
+    }
+
+    // largest id in the set, 0 if it's empty
+    BookId last() const {
+        BookId largest = 0;
+        if (!blocks.empty()) {
+            blocks.back().forEach([&largest](BookId id) { largest = id; });
+        }
+        return largest;
+    }
+
+    std::vector<BookId> toVector() const {
+        std::vector<BookId> ids;
+        ids.reserve(total);
+        forEach([&ids](BookId id) { ids.push_back(id); });
+        return ids;
+    }
+
+    // Appends the set to out: the block count, then per block its key, whether it's a bitmap,
+    // its id count and its array or bitmap words, all little-endian
+    void serialize(std::string& out) const {
+        auto put = [&out](const void* data, size_t size) { out.append(static_cast<const char*>(data), size); };
+        uint32_t count = static_cast<uint32_t>(blocks.size());
+        put(&count, 4);
+        for (const Block& block : blocks) {
+            uint8_t isBitmap = block.bitmap.empty() ? 0 : 1;
+            uint32_t ids = static_cast<uint32_t>(block.count);
+            put(&block.key, 2);
+            put(&isBitmap, 1);
+            put(&ids, 4);
+            if (isBitmap) {
+                put(block.bitmap.data(), BITMAP_WORDS * 8);
+            }
+            else {
+                put(block.array.data(), block.array.size() * 2);
+            }
+        }
+    }
+
+    // Reads a set written by serialize from data, moving data past it; false if it's malformed
+    bool deserialize(const char*& data, const char* end) {
+        auto get = [&data, end](void* value, size_t size) {
+            if (static_cast<size_t>(end - data) < size) {
+                return false;
+            }
+            memcpy(value, data, size);
+            data += size;
+            return true;
+        };
+        blocks.clear();
+        total = 0;
+        uint32_t count;
+        if (!get(&count, 4)) {
+            return false;
+        }
+        for (uint32_t b = 0; b < count; ++b) {
+            Block block;
+            uint8_t isBitmap;
+            uint32_t ids;
+            if (!get(&block.key, 2) || !get(&isBitmap, 1) || !get(&ids, 4) || ids > 65536 || (!isBitmap && ids > ARRAY_LIMIT)) {
+                return false;
+            }
+            block.count = ids;
+            if (isBitmap) {
+                block.bitmap.resize(BITMAP_WORDS);
+                if (!get(block.bitmap.data(), BITMAP_WORDS * 8)) {
+                    return false;
+                }
+            }
+            else {
+                block.array.resize(ids);
+                if (!get(block.array.data(), ids * 2)) {
+                    return false;
+                }
+            }
+            total += ids;
+            blocks.push_back(std::move(block));
+        }
+        return true;
+    }
+};
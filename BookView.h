@@ -0,0 +1,220 @@
+#pragma once
+#include <algorithm>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+#include "Catalog.h"
+#include "ColumnStore.h"
+#include "Library.h"
+#include "Query.h"
+#include "ThreadPool.h"
+
+// Order of the books in a view. Titles and authors sort ignoring ASCII case.
+enum class ViewOrder { CATALOG, TITLE, AUTHOR };
+
+// the string a view in order is sorted by; CATALOG has none
+inline const std::string& viewKey(const Book& book, ViewOrder order) {
+    return order == ViewOrder::AUTHOR ? book.getAuthor().getName() : book.getTitle();
+}
+
+inline bool lessIgnoringCase(const std::string& a, const std::string& b) {
+    return std::lexicographical_compare(a.begin(), a.end(), b.begin(), b.end(),
+        [](char x, char y) { return detail::foldAscii(x) < detail::foldAscii(y); });
+}
+
+// Every book of one catalog version sorted by title and by author, each sorted once the
+// first time a view asks for it and shared by all views of that version
+class SortedOrders {
+private:
+    std::mutex lock;
+    uint64_t version = 0;
+    std::shared_ptr<const std::vector<BookId>> byTitle;
+    std::shared_ptr<const std::vector<BookId>> byAuthor;
+
+public:
+    std::shared_ptr<const std::vector<BookId>> get(const CatalogSnapshot& snapshot, ViewOrder order) {
+        std::lock_guard<std::mutex> guard(lock);
+        if (version != snapshot.version) {
+            byTitle.reset();
+            byAuthor.reset();
+            version = snapshot.version;
+        }
+        auto& sorted = order == ViewOrder::AUTHOR ? byAuthor : byTitle;
+        if (sorted == nullptr) {
+            TraceSpan span("index.sort");
+            sorted = std::make_shared<const std::vector<BookId>>(snapshot.library.sortedIds(
+                [order](const Book& a, const Book& b) { return lessIgnoringCase(viewKey(a, order), viewKey(b, order)); },
+                ExecutionPolicy::parallel()));
+        }
+        return sorted;
+    }
+
+    // bytes of the orders sorted so far
+    size_t bytes() {
+        std::lock_guard<std::mutex> guard(lock);
+        return (byTitle == nullptr ? 0 : vectorBytes(*byTitle)) + (byAuthor == nullptr ? 0 : vectorBytes(*byAuthor));
+    }
+};
+
+// The books of one catalog version that match a query, in a given order, computed only as
+// far as they're asked for. Creating a view costs nothing: the sorted order is shared
+// through SortedOrders, and a filtered view walks it and keeps the matches found so far, so
+// reading a page scans only up to that page. An unfiltered view reads the order directly,
+// so any page costs its size. Pages ahead are found in the background with prefetch().
+class BookView {
+private:
+    struct State {
+        std::shared_ptr<const CatalogSnapshot> snapshot;
+        Query query;
+        std::string titlePattern;
+        ViewOrder order;
+        std::shared_ptr<SortedOrders> orders;
+
+        std::mutex lock;
+        // all books in view order, or null for catalog order
+        std::shared_ptr<const std::vector<BookId>> base;
+        bool baseReady = false;
+        // matches found in base[0, scanned), only kept for filtered views
+        std::vector<BookId> matches;
+        size_t scanned = 0;
+        bool prefetching = false;
+
+        bool filtered() const {
+            return !query.author.empty() || !query.language.empty() || !query.title.empty();
+        }
+
+        size_t baseSize() const {
+            return snapshot->library.getSize();
+        }
+
+        BookId baseAt(size_t position) const {
+            return base == nullptr ? static_cast<BookId>(position) : (*base)[position];
+        }
+
+        bool accepts(const Book& book) const {
+            const std::string& title = book.getTitle();
+            return (query.author.empty() || book.getAuthor().getName() == query.author)
+                && (query.language.empty() || book.getLanguage() == query.language)
+                && (titlePattern.empty()
+                    || detail::findScalar(title.data(), 0, title.size(), titlePattern, query.ignoreCase) != std::string::npos);
+        }
+
+        // sorts the order on first use; called with lock held
+        void prepare() {
+            if (!baseReady) {
+                if (order != ViewOrder::CATALOG) {
+                    base = orders->get(*snapshot, order);
+                }
+                baseReady = true;
+            }
+        }
+
+        // Scans until count matches are known and base[0, through) is scanned, or the books
+        // run out; called with lock held
+        void resolve(size_t count, size_t through = 0) {
+            prepare();
+            while ((matches.size() < count || scanned < through) && scanned < baseSize()) {
+                BookId id = baseAt(scanned++);
+                if (accepts(snapshot->library.getItem(id))) {
+                    matches.push_back(id);
+                }
+            }
+        }
+    };
+
+    std::shared_ptr<State> state;
+
+public:
+    BookView(std::shared_ptr<const CatalogSnapshot> snapshot, const Query& query, ViewOrder order, std::shared_ptr<SortedOrders> orders)
+        : state(std::make_shared<State>()) {
+        state->snapshot = std::move(snapshot);
+        state->query = query;
+        state->titlePattern = query.title;
+        if (query.ignoreCase) {
+            std::transform(state->titlePattern.begin(), state->titlePattern.end(), state->titlePattern.begin(), detail::foldAscii);
+        }
+        state->order = order;
+        state->orders = std::move(orders);
+    }
+
+    const CatalogSnapshot& snapshot() const {
+        return *state->snapshot;
+    }
+
+    ViewOrder order() const {
+        return state->order;
+    }
+
+    // the ids at positions [first, first + count) of the view, fewer past its end
+    std::vector<BookId> page(size_t first, size_t count) {
+        TraceSpan span("view.page");
+        std::lock_guard<std::mutex> guard(state->lock);
+        std::vector<BookId> ids;
+        if (!state->filtered()) {
+            state->prepare();
+            for (size_t i = first; i < std::min(first + count, state->baseSize()); ++i) {
+                ids.push_back(state->baseAt(i));
+            }
+            return ids;
+        }
+        state->resolve(first + count);
+        for (size_t i = first; i < std::min(first + count, state->matches.size()); ++i) {
+            ids.push_back(state->matches[i]);
+        }
+        return ids;
+    }
+
+    // Books known to be in the view, and whether that's all of them. Unfiltered views
+    // always know their size; filtered ones know it once scanned to the end.
+    size_t knownSize(bool& complete) {
+        std::lock_guard<std::mutex> guard(state->lock);
+        if (!state->filtered()) {
+            complete = true;
+            return state->baseSize();
+        }
+        complete = state->scanned == state->baseSize();
+        return state->matches.size();
+    }
+
+    // Position of the first book whose sort key isn't below prefix, ignoring case, or the
+    // view's size if there is none. Catalog order has no key and always gives 0.
+    size_t positionOf(const std::string& prefix) {
+        std::lock_guard<std::mutex> guard(state->lock);
+        ViewOrder order = state->order;
+        if (order == ViewOrder::CATALOG) {
+            return 0;
+        }
+        state->prepare();
+        const Library<Book>& library = state->snapshot->library;
+        auto below = [&](BookId id, const std::string& key) { return lessIgnoringCase(viewKey(library.getItem(id), order), key); };
+        const std::vector<BookId>& base = *state->base;
+        size_t position = std::lower_bound(base.begin(), base.end(), prefix, below) - base.begin();
+        if (!state->filtered()) {
+            return position;
+        }
+        // the matches before position in the order are the ones before it in the view
+        state->resolve(0, position);
+        return std::lower_bound(state->matches.begin(), state->matches.end(), prefix, below) - state->matches.begin();
+    }
+
+    // Finds the first count books of the view on the shared pool, so paging up to there
+    // doesn't wait. Does nothing if they're known already or a prefetch is running.
+    void prefetch(size_t count) {
+        {
+            std::lock_guard<std::mutex> guard(state->lock);
+            if (state->prefetching || (state->baseReady && (!state->filtered() || state->matches.size() >= count
+                || state->scanned == state->baseSize()))) {
+                return;
+            }
+            state->prefetching = true;
+        }
+        std::shared_ptr<State> pinned = state;
+        ThreadPool::shared().submit([pinned, count] {
+            std::lock_guard<std::mutex> guard(pinned->lock);
+            pinned->resolve(pinned->filtered() ? count : 0);
+            pinned->prefetching = false;
+        });
+    }
+};
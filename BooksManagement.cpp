@@ -1,259 +1,161 @@
 #include <iostream>
 #include <vector>
 #include <fstream>
-#include <Windows.h>
-#include <shellapi.h>
+#include <limits>
+#include <csignal>
+#include <map>
+#include <mutex>
+#include <thread>
 #include "json.hpp"
+#include "Library.h"
+#include "BatchMode.h"
+#include "BookFiles.h"
+#include "CatalogGenerator.h"
+#include "CatalogLog.h"
+#include "CatalogWatcher.h"
+#include "ColumnStore.h"
+#include "BookView.h"
+#include "DiffLoader.h"
+#include "HttpServer.h"
+#include "LinkOpener.h"
+#include "LoadGenerator.h"
+#include "LsmStore.h"
+#include "QueryServer.h"
+#include "SearchIndex.h"
+#include "SelectionStore.h"
+#include "Terminal.h"
+#include "Trace.h"
 using json = nlohmann::json;
 using namespace std;
-// BookData structure
-struct BookData {
-    string author;
-    string title;
-    string link;
-    string language;
-};
-
-// Person class
-class Person {
-protected:
-    string name;
-
-public:
-    // Default constructor
-    Person() : name("") {}
-
-    // Constructor for initialzing objects in person
-    Person(const string& name) : name(name) {}
-
-    string getName() const {
-        return name;
-    }
-
-    void setName(const string& name) {
-        this->name = name;
-    }
-};
-
-// Author class
-class Author : public Person {
-public:
-    // Default constructor
-    Author() : Person() {}
-
-    // Constructor for initialzing objects in author
-    Author(const string& name) : Person(name) {}
-
-    Author(const nlohmann::json& jsonData) : Person(jsonData["author"]) {}
-};
-
-// Book class is represting books like the book's link, title, language, and author
-class Book {
-private:
-    string title;
-    Author author;
-    string link;
-    string language;
-public:
-    // Constructor for provided title, author, link, and language.
-    Book(const string& title, const string& author, const string& link, const string& language)
-        : title(title), author(author), link(link), language(language) {}
-
-
-    // Overloaded operator to compare books on title
-    bool operator==(const Book& other) const {
-        return title == other.title;
-    }
-
-    // Overloaded operator for language
-    bool operator<(const Book& other) const {
-        return language < other.language;
-    }
-    
-    // grabs book's title
-    string getTitle() const {
-        return title;
-    }
-
-    // grabs book's language
-    string getLanguage() const {
-        return language;
-    }
-
-    // grabs book's link
-    string getLink() const {
-        return link;
-    }
-
-    // grabs book's author
-    Author getAuthor() const {
-        return author;
-    }
-
-    // Constructor that takes the JSON data
-    Book(const nlohmann::json& jsonData)
-        : title(jsonData["title"]), author(jsonData), link(jsonData["link"]), language(jsonData["language"]) {}
-};
-
-// Template class representing a library
-template <typename T>
-class Library {
-private:
-    // Vector storing items for library
-    vector<T> items;
-
-public:
-    // adds item to library
-    void addItem(const T& item) {
-        items.push_back(item);
+// What became of a request to open a book's link, to show the user; the link opens in the background
+string openLinkNotice(LinkOpener& links, const Book& book) {
+    switch (links.open(book.getLink())) {
+    case LinkOpener::QUEUED:
+        return "Opening " + book.getLink();
+    case LinkOpener::COALESCED:
+        return "Already opening " + book.getLink();
+    case LinkOpener::DROPPED:
+        return "Too many links opening at once, try again in a moment";
+    default:
+        return "Link is not available";
     }
-
-    // seraches for books written by author selected
-    vector<const Book*> searchBooksByAuthor(const string& authorName) const {
-        vector<const Book*> result;
-        for (size_t i = 0; i < items.size(); ++i) {
-            const Book& book = items[i];
-            if (book.getAuthor().getName() == authorName) {
-                result.push_back(&book);
-            }
-        }
-        return result;
-    }
-
-    // seraches for books written by language selected
-    vector<const Book*> searchBooksByLanguage(const string& language) const {
-        vector<const Book*> result;
-        for (size_t i = 0; i < items.size(); ++i) {
-            const Book& book = items[i];
-            if (book.getLanguage() == language) {
-                result.push_back(&book);
-            }
-        }
-        return result;
-    }
-
-    // returns item from the library
-    const T& getItem(size_t index) const {
-        return items[index];
-    }
-
-    // returns number of item to the library
-    size_t getSize() const {
-        return items.size();
-    }
-};
-
-// Parses JSON data
-vector<BookData> parseJsonData(const nlohmann::json& jsonData) {
-    vector<BookData> booksData;
-
-    for (const auto& bookData : jsonData) {
-        BookData data;
-        data.author = bookData["author"];
-        data.link = bookData["link"];
-        data.title = bookData["title"];
-        data.language = bookData["language"];
-
-        booksData.push_back(data);
-    }
-
-    return booksData;
 }
 
-// Loads JSON file
-json loadJsonFile(const string& filename) {
-    ifstream inFile(filename);
-
-    if (!inFile) {
-        throw runtime_error("Error opening file: " + filename);
+// Asks which book of the page shown to act on; null if the answer isn't one of them
+const Book* chooseBookOnPage(const CatalogSnapshot& snapshot, const vector<BookId>& ids, const string& action) {
+    int selectedIndex;
+    cout << "Enter the index of the book you want to " << action << " (1-" << ids.size() << "): ";
+    cin >> selectedIndex;
+    cin.ignore();
+    if (selectedIndex < 1 || selectedIndex > static_cast<int>(ids.size())) {
+        cout << "Invalid index. Press Enter to continue...";
+        cin.get();
+        return nullptr;
     }
+    return &snapshot.library.getItem(ids[selectedIndex - 1]);
+}
 
-    json jsonData;
-    inFile >> jsonData;
-    inFile.close();
-    return jsonData;
+const char* viewOrderName(ViewOrder order) {
+    return order == ViewOrder::TITLE ? "title" : order == ViewOrder::AUTHOR ? "author" : "catalog";
 }
 
-// displays the books in a paginated matter
-void displayBooksInPages(const Library<Book>& library, const json& jsonData, const vector<BookData>& booksData, vector<const Book*>& selectedBooks) {
+// Pages through the books of snapshot that match query. Pages are read from a view, so only
+// the page shown is looked up however many books match, and the next page is prefetched
+// while this one is read.
+void displayBooksInPages(shared_ptr<const CatalogSnapshot> snapshot, const Query& query, ViewOrder order, shared_ptr<SortedOrders> orders,
+    SelectionStore& selectedBooks, LinkOpener& links, Screen& screen) {
     // Constants
-    const int booksPerPage = 5;
-    int totalPages = (library.getSize() + booksPerPage - 1) / booksPerPage;
-    int currentPage = 0;
+    const size_t booksPerPage = 5;
+    BookView view(snapshot, query, order, orders);
+    size_t currentPage = 0;
+    // shown above the options until the next choice
+    string notice;
 
     // main loop
     while (true) {
-        system("cls"); // Clear the screen
-        int start = currentPage * booksPerPage;
-        int end = min(start + booksPerPage, static_cast<int>(library.getSize()));
-
-        for (int i = start; i < end; i++) {
-            cout << i + 1 << ". " << library.getItem(i).getTitle() << endl;
+        vector<BookId> ids = view.page(currentPage * booksPerPage, booksPerPage);
+        bool complete;
+        size_t known = view.knownSize(complete);
+        size_t totalPages = (known + booksPerPage - 1) / booksPerPage;
+        if (ids.empty() && currentPage > 0) {
+            // asked for a page past the end, which is known now
+            currentPage = totalPages > 0 ? totalPages - 1 : 0;
+            continue;
+        }
+        view.prefetch((currentPage + 2) * booksPerPage);
+
+        // the time shown is the previous frame's
+        screen.begin();
+        for (size_t i = 0; i < ids.size(); i++) {
+            const Book& book = snapshot->library.getItem(ids[i]);
+            screen.line(to_string(currentPage * booksPerPage + i + 1) + ". " + book.getTitle()
+                + (view.order() == ViewOrder::AUTHOR ? " - " + book.getAuthor().getName() : ""));
         }
+        if (ids.empty()) {
+            screen.line("No books found.");
+        }
+        screen.line("Page " + to_string(currentPage + 1) + " of " + (complete ? "" : "at least ") + to_string(max<size_t>(totalPages, 1))
+            + ", " + viewOrderName(view.order()) + " order (drawn in " + to_string(screen.lastFrameNanoseconds() / 1000) + " us)");
         // displays options
-        cout << "n: Next page | p: Previous page | o: Open book link | s: Save book | q: Quit" << endl;
-        cout << "Enter your choice: ";
+        string failure = links.takeError();
+        if (!failure.empty() || !notice.empty()) {
+            screen.line(failure.empty() ? notice : failure);
+        }
+        notice.clear();
+        screen.line("n: Next page | p: Previous page | g: Go to page | j: Jump to letter | r: Change order");
+        screen.line("o: Open book link | s: Save book | q: Quit");
+        screen.prompt("Enter your choice: ");
+        screen.present();
         char choice;
         cin >> choice;
 
         // Users choices
         if (tolower(choice) == 'o') { // Open book link
-            int selectedIndex;
-            cout << "Enter the index of the book you want to select (1-" << (end - start) << "): ";
-            cin >> selectedIndex;
-            selectedIndex--;
-
-            if (selectedIndex >= 0 && selectedIndex < (end - start)) {
-                int dataIdx = start + selectedIndex;
-                if (dataIdx >= 0 && dataIdx < library.getSize()) {
-                    const Book& selectedBook = library.getItem(dataIdx);
-                    string link = selectedBook.getLink();
-                    if (!link.empty()) {
-                        ShellExecuteA(NULL, "open", link.c_str(), NULL, NULL, SW_SHOWNORMAL);
-                    }
-                    else {
-                        cout << "Link is not available. Press Enter to continue...";
-                        cin.get();
-                    }
-                }
-                else {
-                    cout << "Invalid index. Press Enter to continue...";
-                    cin.get();
-                }
-            }
-            else {
-                cout << "Invalid index. Press Enter to continue...";
-                cin.get();
+            const Book* selectedBook = chooseBookOnPage(*snapshot, ids, "select");
+            if (selectedBook != nullptr) {
+                notice = openLinkNotice(links, *selectedBook);
             }
         }
         else if (tolower(choice) == 's') { // Save book
-            int selectedIndex;
-            cout << "Enter the index of the book you want to save (1-" << (end - start) << "): ";
-            cin >> selectedIndex;
-            selectedIndex--;
-
-            if (selectedIndex >= 0 && selectedIndex < (end - start)) {
-                int dataIdx = start + selectedIndex;
-                if (dataIdx >= 0 && dataIdx < library.getSize()) {
-                    const Book& selectedBook = library.getItem(dataIdx);
-                    selectedBooks.push_back(&selectedBook);
+            const Book* selectedBook = chooseBookOnPage(*snapshot, ids, "save");
+            if (selectedBook != nullptr) {
+                try {
+                    selectedBooks.add(*selectedBook);
                     cout << "Book saved. Press Enter to continue...";
-                    cin.ignore();
-                    cin.get();
                 }
-                else {
-                    cout << "Invalid index. Press Enter to continue...";
-                    cin.ignore();
-                    cin.get();
+                catch (const exception& e) {
+                    cout << "Error: " << e.what() << ". Press Enter to continue...";
                 }
-            }
-            else {
-                cout << "Invalid index. Press Enter to continue...";
-                cin.ignore();
                 cin.get();
             }
         }
-        else if (tolower(choice) == 'n' && currentPage < totalPages - 1) {
+        else if (tolower(choice) == 'g') { // Go to page
+            size_t page;
+            cout << "Enter the page number: ";
+            if (cin >> page && page > 0) {
+                currentPage = page - 1;
+            }
+            cin.clear();
+            cin.ignore(numeric_limits<streamsize>::max(), '\n');
+        }
+        else if (tolower(choice) == 'j') { // Jump to letter
+            string prefix;
+            cin.ignore();
+            cout << "Enter the first letters of the " << (view.order() == ViewOrder::AUTHOR ? "author" : "title") << ": ";
+            getline(cin, prefix);
+            if (view.order() == ViewOrder::CATALOG) {
+                // catalog order has no key to jump along, so sort by title first
+                view = BookView(snapshot, query, ViewOrder::TITLE, orders);
+            }
+            currentPage = view.positionOf(prefix) / booksPerPage;
+        }
+        else if (tolower(choice) == 'r') { // Change order
+            ViewOrder next = view.order() == ViewOrder::CATALOG ? ViewOrder::TITLE
+                : view.order() == ViewOrder::TITLE ? ViewOrder::AUTHOR : ViewOrder::CATALOG;
+            view = BookView(snapshot, query, next, orders);
+            currentPage = 0;
+        }
+        else if (tolower(choice) == 'n' && (!complete || currentPage + 1 < totalPages)) {
             currentPage++;
         }
         else if (tolower(choice) == 'p' && currentPage > 0) {
@@ -265,39 +167,115 @@ void displayBooksInPages(const Library<Book>& library, const json& jsonData, con
     }
 }
 
-// Searches for books by a specific author
-void searchBooksByAuthor(const Library<Book>& library, vector<const Book*>& selectedBooks) {
-    string authorName;
-    cout << "Enter the name of the author: ";
-    getline(cin, authorName);
+// Lets the user pick a value of field by typing any part of it. The matches are refined with
+// every key typed, values starting with the text first; the arrows move the selection and
+// Enter picks it. False if the user backs out with Escape.
+bool pickAsYouType(const CatalogSnapshot& snapshot, SearchField field, SearchIndexes& indexes, Screen& screen, string& picked) {
+    const size_t shown = 10;
+    string label = field == SearchField::AUTHOR ? "author" : "language";
+    screen.begin();
+    screen.prompt("Indexing " + label + "s...");
+    screen.present();
+    IncrementalSearch search(indexes.get(snapshot, field));
+    size_t selected = 0;
+    RawKeyboard keyboard;
+    screen.begin();
+    while (true) {
+        const KeyIndex& index = *indexes.get(snapshot, field);
+        vector<uint32_t> top = search.top(shown);
+        selected = top.empty() ? 0 : min(selected, top.size() - 1);
+        // the time shown is the previous key's, from reading it to drawing its matches
+        screen.line("Type part of the " + label + "; Up/Down to choose, Enter to pick, Esc to go back");
+        screen.line(to_string(search.matchCount()) + " " + label + "s match (updated in "
+            + to_string(screen.lastFrameNanoseconds() / 1000) + " us)");
+        for (size_t i = 0; i < top.size(); i++) {
+            screen.line((i == selected ? "> " : "  ") + index.value(top[i]) + " (" + to_string(index.bookCount(top[i])) + " books)");
+        }
+        screen.prompt(string(1, static_cast<char>(toupper(label[0]))) + label.substr(1) + ": " + search.text());
+        screen.present();
 
-    vector<const Book*> booksByAuthor;
-    for (size_t i = 0; i < library.getSize(); ++i) {
-        const Book& book = library.getItem(i);
-        if (book.getAuthor().getName() == authorName) {
-            booksByAuthor.push_back(&book);
-            cout << booksByAuthor.size() << ". " << book.getTitle() << endl;
+        int key = keyboard.readKey();
+        screen.begin();
+        if (key == KEY_NONE || key == KEY_ESCAPE) {
+            return false;
+        }
+        if (key == KEY_ENTER && !top.empty()) {
+            picked = index.value(top[selected]);
+            return true;
         }
+        if (key == KEY_UP && selected > 0) {
+            selected--;
+        }
+        else if (key == KEY_DOWN) {
+            selected++;
+        }
+        else if (key == KEY_BACKSPACE) {
+            search.pop();
+            selected = 0;
+        }
+        else if (key >= 32 && key < 256) {
+            search.push(static_cast<char>(key));
+            selected = 0;
+        }
+    }
+}
+
+// Pages through the books of an author picked as it's typed
+void searchBooksByAuthor(shared_ptr<const CatalogSnapshot> snapshot, shared_ptr<SortedOrders> orders, SearchIndexes& indexes,
+    SelectionStore& selectedBooks, LinkOpener& links, Screen& screen) {
+    Query query;
+    if (pickAsYouType(*snapshot, SearchField::AUTHOR, indexes, screen, query.author)) {
+        displayBooksInPages(snapshot, query, ViewOrder::TITLE, orders, selectedBooks, links, screen);
+    }
+}
+
+// Pages through the books in a language picked as it's typed
+void searchBooksByLanguage(shared_ptr<const CatalogSnapshot> snapshot, shared_ptr<SortedOrders> orders, SearchIndexes& indexes,
+    SelectionStore& selectedBooks, LinkOpener& links, Screen& screen) {
+    Query query;
+    if (pickAsYouType(*snapshot, SearchField::LANGUAGE, indexes, screen, query.language)) {
+        displayBooksInPages(snapshot, query, ViewOrder::TITLE, orders, selectedBooks, links, screen);
+    }
+}
+
+// Searches for books whose title contains the text entered
+void searchBooksByTitle(const Library<Book>& library, const ColumnStore& titles, SelectionStore& selectedBooks, LinkOpener& links) {
+    string text;
+    cout << "Enter part of the title: ";
+    getline(cin, text);
+    cout << "Ignore case? (y/n): ";
+    char caseChoice;
+    cin >> caseChoice;
+    cin.ignore();
+
+    vector<BookId> matches = searchTitleContains(titles, text, tolower(caseChoice) == 'y', ExecutionPolicy::parallel());
+    vector<const Book*> booksByTitle;
+    for (BookId id : matches) {
+        const Book& book = library.getItem(id);
+        booksByTitle.push_back(&book);
+        cout << booksByTitle.size() << ". " << book.getTitle() << '\n';
     }
 
-    if (!booksByAuthor.empty()) {
+    if (!booksByTitle.empty()) {
         cout << "Select a book to open its link (or enter 0 to go back): ";
         int selectedIndex;
         cin >> selectedIndex;
         cin.ignore();
 
-        if (selectedIndex >= 1 && selectedIndex <= static_cast<int>(booksByAuthor.size())) {
-            const Book& selectedBook = *booksByAuthor[selectedIndex - 1];
-            string link = selectedBook.getLink();
-            if (!link.empty()) {
-                ShellExecuteA(NULL, "open", link.c_str(), NULL, NULL, SW_SHOWNORMAL);
-            }
+        if (selectedIndex >= 1 && selectedIndex <= static_cast<int>(booksByTitle.size())) {
+            const Book& selectedBook = *booksByTitle[selectedIndex - 1];
+            cout << openLinkNotice(links, selectedBook) << '\n';
             cout << "Enter 's' to save the book or any other key to continue: ";
             char saveChoice;
             cin >> saveChoice;
             if (tolower(saveChoice) == 's') {
-                selectedBooks.push_back(&selectedBook);
-                cout << "Book saved. Press Enter to continue...";
+                try {
+                    selectedBooks.add(selectedBook);
+                    cout << "Book saved. Press Enter to continue...";
+                }
+                catch (const exception& e) {
+                    cout << "Error: " << e.what() << ". Press Enter to continue...";
+                }
                 cin.ignore();
                 cin.get();
             }
@@ -305,130 +283,551 @@ void searchBooksByAuthor(const Library<Book>& library, vector<const Book*>& sele
     }
 }
 
-// Searches for books by a specific language
-void searchBooksByLanguage(const Library<Book>& library, vector<const Book*>& selectedBooks) {
-    string language;
-    cout << "Enter the language: ";
-    getline(cin, language);
-
-    vector<const Book*> booksByLanguage;
+// Debugging code
+// prints what the catalog keeps of every book, in catalog order
+void printBooks(const Library<Book>& library) {
     for (size_t i = 0; i < library.getSize(); ++i) {
         const Book& book = library.getItem(i);
-        if (book.getLanguage() == language) {
-            booksByLanguage.push_back(&book);
-            cout << booksByLanguage.size() << ". " << book.getTitle() << endl;
+        cout << "Title: " << json(book.getTitle()) << endl;
+        cout << "Author: " << json(book.getAuthor().getName()) << endl;
+        cout << "Language: " << json(book.getLanguage()) << endl;
+        cout << "Link: " << json(book.getLink()) << endl;
+        cout << "-----------------------------" << endl;
+    }
+}
+
+const string DATA_FILE_PATH = "TestData/";
+
+// Stops tracing, prints the latency of each operation and writes the spans to tracePath
+void finishTrace(const string& tracePath) {
+    Tracer& tracer = Tracer::shared();
+    tracer.stop();
+    tracer.writeSummary(cout);
+    tracer.writeChromeTrace(tracePath);
+    cout << "Wrote trace to " << tracePath << " (open it in chrome://tracing or ui.perfetto.dev)" << endl;
+}
+
+// Reads "--flag value" pairs starting at argv[first]. Throws on a flag without a value.
+map<string, string> parseOptions(int argc, char* argv[], int first) {
+    map<string, string> options;
+    for (int i = first; i < argc; i += 2) {
+        string flag = argv[i];
+        if (flag.compare(0, 2, "--") != 0 || i + 1 >= argc) {
+            throw runtime_error("Expected --option value, got: " + flag);
         }
+        options[flag] = argv[i + 1];
     }
+    return options;
+}
 
-    if (!booksByLanguage.empty()) {
-        cout << "Select a book to open its link (or enter 0 to go back): ";
-        int selectedIndex;
-        cin >> selectedIndex;
-        cin.ignore();
+// returns the value of flag, or fallback when it wasn't given
+string optionOr(const map<string, string>& options, const string& flag, const string& fallback) {
+    auto it = options.find(flag);
+    return it == options.end() ? fallback : it->second;
+}
+
+// describes what a reload changed, e.g. "+3 -1 ~2"
+string reloadChanges(const ReloadStats& stats) {
+    return "+" + to_string(stats.added) + " -" + to_string(stats.removed) + " ~" + to_string(stats.updated);
+}
+
+// Applies changes to the catalog file whenever it changes when --watch 1 was given, reporting on stdout
+unique_ptr<CatalogWatcher> watchCatalogIfAsked(const map<string, string>& flags, DiffLoader& loader) {
+    if (optionOr(flags, "--watch", "0") != "1") {
+        return nullptr;
+    }
+    return make_unique<CatalogWatcher>(loader.filePath(), [&loader] { return loader.reload(); },
+        [](const ReloadStats& stats) {
+            cout << "Reloaded " << stats.books << " books (" << reloadChanges(stats) << ") as version " << stats.version << " in "
+                << stats.loadSeconds * 1000 << " ms, swap paused " << stats.swapSeconds * 1e6 << " us" << endl;
+        },
+        [](const string& message) {
+            cerr << "Reload failed: " << message << endl;
+        });
+}
 
-        if (selectedIndex >= 1 && selectedIndex <= static_cast<int>(booksByLanguage.size())) {
-            const Book& selectedBook = *booksByLanguage[selectedIndex - 1];
-            string link = selectedBook.getLink();
-            if (!link.empty()) {
-                ShellExecuteA(NULL, "open", link.c_str(), NULL, NULL, SW_SHOWNORMAL);
+// reads the catalog log settings given on the command line
+LogOptions logOptions(const map<string, string>& flags) {
+    LogOptions options;
+    string sync = optionOr(flags, "--sync", "group");
+    if (sync == "none") {
+        options.sync = SyncMode::NONE;
+    }
+    else if (sync == "each") {
+        options.sync = SyncMode::EACH;
+    }
+    else if (sync != "group") {
+        throw runtime_error("Unknown sync mode " + sync);
+    }
+    options.checkpointBytes = stoull(optionOr(flags, "--checkpoint-bytes", to_string(options.checkpointBytes)));
+    options.checkpointSeconds = stod(optionOr(flags, "--checkpoint-seconds", to_string(options.checkpointSeconds)));
+    return options;
+}
+
+// Writes a synthetic catalog for scale testing:
+//   BooksManagement --generate <output> [--books N] [--format json|jsonl|binary] [--seed N] [--threads N]
+//                   [--title-words MIN-MAX] [--unicode <share>]
+// The format defaults to the output's extension: .jsonl, .bin or JSON.
+int runGenerateMode(int argc, char* argv[]) {
+    if (argc < 3) {
+        cerr << "Usage: BooksManagement --generate <output> [--books N] [--format json|jsonl|binary] [--seed N] [--threads N]"
+            << " [--title-words MIN-MAX] [--unicode <share>]" << endl;
+        return 2;
+    }
+    try {
+        string output = argv[2];
+        map<string, string> flags = parseOptions(argc, argv, 3);
+        GeneratorOptions options;
+        options.books = stoull(optionOr(flags, "--books", to_string(options.books)));
+        options.seed = stoull(optionOr(flags, "--seed", to_string(options.seed)));
+        options.threads = stoul(optionOr(flags, "--threads", to_string(options.threads)));
+        options.unicodeShare = stod(optionOr(flags, "--unicode", to_string(options.unicodeShare)));
+        string words = optionOr(flags, "--title-words", to_string(options.minTitleWords) + "-" + to_string(options.maxTitleWords));
+        size_t dash = words.find('-');
+        options.minTitleWords = stoul(words.substr(0, dash));
+        options.maxTitleWords = dash == string::npos ? options.minTitleWords : stoul(words.substr(dash + 1));
+        auto endsWith = [&output](const string& suffix) {
+            return output.size() >= suffix.size() && output.compare(output.size() - suffix.size(), suffix.size(), suffix) == 0;
+        };
+        string format = optionOr(flags, "--format", endsWith(".jsonl") ? "jsonl" : endsWith(".bin") ? "binary" : "json");
+        if (format != "json" && format != "jsonl" && format != "binary") {
+            throw runtime_error("Unknown format: " + format);
+        }
+        options.format = format == "jsonl" ? CatalogFormat::JSONL : format == "binary" ? CatalogFormat::BINARY : CatalogFormat::JSON;
+
+        auto started = chrono::steady_clock::now();
+        CatalogGenerator(options).write(output);
+        double seconds = chrono::duration<double>(chrono::steady_clock::now() - started).count();
+        cout << "Wrote " << options.books << " books to " << output << " in " << seconds << " s ("
+            << static_cast<uint64_t>(options.books / max(seconds, 1e-9)) << " books/s)" << endl;
+    }
+    catch (const exception& e) {
+        cerr << "Error: " << e.what() << endl;
+        return 1;
+    }
+    return 0;
+}
+
+// Measures durable add throughput of the catalog log with each sync mode:
+//   BooksManagement --wal-bench <directory> [--writers N] [--mutations N]
+int runLogBenchMode(int argc, char* argv[]) {
+    if (argc < 3) {
+        cerr << "Usage: BooksManagement --wal-bench <directory> [--writers N] [--mutations N]" << endl;
+        return 2;
+    }
+    try {
+        string directory = argv[2];
+        map<string, string> flags = parseOptions(argc, argv, 3);
+        size_t writers = max<size_t>(stoul(optionOr(flags, "--writers", "8")), 1);
+        size_t mutations = stoul(optionOr(flags, "--mutations", "20000"));
+        string seedPath = directory + "/bench-seed.json";
+        string logPath = directory + "/bench.wal";
+        ofstream(seedPath) << "[]";
+
+        pair<const char*, SyncMode> modes[] = { { "none", SyncMode::NONE }, { "each", SyncMode::EACH }, { "group", SyncMode::GROUP } };
+        for (const auto& mode : modes) {
+            remove(logPath.c_str());
+            remove((logPath + ".snapshot").c_str());
+            LogOptions options;
+            options.sync = mode.second;
+            options.checkpointBytes = 0;
+            options.checkpointSeconds = 0;
+            Catalog catalog;
+            CatalogLog log(catalog, seedPath, logPath, options);
+            auto started = chrono::steady_clock::now();
+            vector<thread> threads;
+            for (size_t w = 0; w < writers; ++w) {
+                threads.emplace_back([&log, w, writers, mutations] {
+                    for (size_t i = w; i < mutations; i += writers) {
+                        log.addBook(Book("Title " + to_string(i), "Author " + to_string(i % 100), "https://example.org/" + to_string(i), "English"));
+                    }
+                });
             }
-            cout << "Enter 's' to save the book or any other key to continue: ";
-            char saveChoice;
-            cin >> saveChoice;
-            if (tolower(saveChoice) == 's') {
-                selectedBooks.push_back(&selectedBook);
-                cout << "Book saved. Press Enter to continue...";
-                cin.ignore();
-                cin.get();
+            for (thread& t : threads) {
+                t.join();
             }
+            double seconds = chrono::duration<double>(chrono::steady_clock::now() - started).count();
+            LogStats stats = log.stats();
+            cout << "sync=" << mode.first << ": " << static_cast<uint64_t>(stats.mutations / seconds) << " mutations/s, "
+                << stats.commits << " commits, " << static_cast<double>(stats.mutations) / max<uint64_t>(stats.commits, 1)
+                << " mutations per commit, " << writers << " writers" << endl;
         }
+        remove(logPath.c_str());
+        remove(seedPath.c_str());
     }
+    catch (const exception& e) {
+        cerr << "Error: " << e.what() << endl;
+        return 1;
+    }
+    return 0;
 }
 
-// Debugging code
-void printJsonData(const nlohmann::json& jsonData) {
-    for (const auto& bookData : jsonData) {
-        cout << "Title: " << bookData["title"] << endl;
-        cout << "Author: " << bookData["author"] << endl;
-        cout << "Country: " << bookData["country"] << endl;
-        cout << "Image Link: " << bookData["imageLink"] << endl;
-        cout << "Language: " << bookData["language"] << endl;
-        cout << "Link: " << bookData["link"] << endl;
-        cout << "Pages: " << bookData["pages"] << endl;
-        cout << "Year: " << bookData["year"] << endl;
-        cout << "-----------------------------" << endl;
+// Runs the queries of a JSONL file without any prompts:
+//   BooksManagement --batch <queries.jsonl> <results.jsonl> [--threads N] [--stats <file>] [--catalog <books.json>]
+//                   [--embed-books 1] [--result-cache <bytes>] [--trace <trace.json>]
+//                   [--metrics <file> [--metrics-interval <ms>]] [--counters 1]
+int runBatchMode(int argc, char* argv[]) {
+    if (argc < 4) {
+        cerr << "Usage: " << argv[0] << " --batch <queries.jsonl> <results.jsonl> [--threads N] [--stats <file>] [--catalog <books.json>]" << endl;
+        return 2;
     }
-}
-// Saves the selected books
-void saveSelectedBooks(const vector<const Book*>& selectedBooks, const string& filename) {
-    ofstream outFile(filename);
+    try {
+        map<string, string> flags = parseOptions(argc, argv, 4);
+        BatchOptions options;
+        options.inputPath = argv[2];
+        options.outputPath = argv[3];
+        options.threads = stoul(optionOr(flags, "--threads", "0"));
+        options.statsPath = optionOr(flags, "--stats", "");
+        options.embedBooks = optionOr(flags, "--embed-books", "0") == "1";
+        options.resultCacheBytes = stoull(optionOr(flags, "--result-cache", to_string(options.resultCacheBytes)));
+        options.hardwareCounters = optionOr(flags, "--counters", "0") == "1";
+        if (options.hardwareCounters && !threadCounters().available()) {
+            cerr << "Hardware counters unavailable, " << threadCounters().error() << endl;
+            options.hardwareCounters = false;
+        }
+        string tracePath = optionOr(flags, "--trace", "");
+        if (!tracePath.empty()) {
+            Tracer::shared().start(true);
+        }
+        // the metrics file is rewritten every interval while the batch runs, and once at the end
+        unique_ptr<MetricsDumper> metrics;
+        string metricsPath = optionOr(flags, "--metrics", "");
+        if (!metricsPath.empty()) {
+            metrics = make_unique<MetricsDumper>(metricsPath, chrono::milliseconds(stoul(optionOr(flags, "--metrics-interval", "1000"))));
+        }
 
-    if (!outFile) {
-        throw runtime_error("Error opening file: " + filename);
+        Catalog catalog(loadLibrary(optionOr(flags, "--catalog", DATA_FILE_PATH + "books.json")));
+        vector<MemoryAccounts::Registration> memory = trackCatalogMemory(catalog);
+        MemoryAccounts::shared().writeReport(cout, catalog.snapshot()->library.getSize());
+        BatchReport report = runBatch(catalog, options);
+        cout << report.queries << " queries, " << report.errors << " errors in " << report.seconds << " s ("
+            << (report.seconds > 0 ? report.queries / report.seconds : 0.0) << " queries/s)" << '\n';
+        cout << "latency ns: p50 " << report.latency.percentile(0.50) << ", p99 " << report.latency.percentile(0.99)
+            << ", p99.9 " << report.latency.percentile(0.999) << ", max " << report.latency.max() << '\n';
+        cout << "result cache: " << report.resultCache.hitRatio() * 100 << "% hits, " << report.resultCache.bytes << " bytes" << endl;
+        if (options.hardwareCounters) {
+            writeCounterTable(cout, report.counters);
+        }
+        if (!tracePath.empty()) {
+            finishTrace(tracePath);
+        }
+        metrics.reset();
+    }
+    catch (const exception& e) {
+        cerr << "Error: " << e.what() << endl;
+        return 1;
     }
+    return 0;
+}
 
-    // Sort the selected books by title
-    vector<const Book*> sortedSelectedBooks = selectedBooks;
-    sort(sortedSelectedBooks.begin(), sortedSelectedBooks.end(), [](const Book* a, const Book* b) {
-        return a->getTitle() < b->getTitle();
-        });
+#ifndef _WIN32
+// Server being run, so a signal can stop it
+EventServer* activeServer = nullptr;
 
-    // Save the sorted selected books to the file
-    for (const Book* book : sortedSelectedBooks) {
-        outFile << book->getTitle() << endl;
+void stopActiveServer(int) {
+    if (activeServer != nullptr) {
+        activeServer->stop();
     }
+}
 
-    outFile.close();
+// Serves catalog queries to local processes until interrupted:
+//   BooksManagement --serve [--socket <path>] [--port N] [--workers N] [--catalog <books.json>] [--result-cache <bytes>]
+//                   [--watch 1 | --wal <log> [--sync none|each|group] [--checkpoint-bytes N] [--checkpoint-seconds N]
+//                    | --lsm <directory> [--sync none|each] [--memtable-bytes N] [--compact-at N] [--compaction-rate <bytes/s>]
+//                      [--publish-milliseconds N]]
+//                   [--lists <journal>]
+int runServerMode(int argc, char* argv[]) {
+    try {
+        map<string, string> flags = parseOptions(argc, argv, 2);
+        ServerOptions options;
+        options.socketPath = optionOr(flags, "--socket", options.socketPath);
+        options.tcpPort = stoi(optionOr(flags, "--port", "0"));
+        options.workers = stoul(optionOr(flags, "--workers", "0"));
+        options.resultCacheBytes = stoull(optionOr(flags, "--result-cache", to_string(options.resultCacheBytes)));
+
+        string catalogPath = optionOr(flags, "--catalog", DATA_FILE_PATH + "books.json");
+        Catalog catalog;
+        unique_ptr<CatalogLog> log;
+        unique_ptr<LsmStore> store;
+        CatalogWriter* writer = nullptr;
+        unique_ptr<DiffLoader> catalogLoader;
+        unique_ptr<CatalogWatcher> watcher;
+        // with a log or a store, it owns every change from here on and the catalog file isn't watched
+        if (flags.count("--wal") != 0) {
+            log = make_unique<CatalogLog>(catalog, catalogPath, flags["--wal"], logOptions(flags));
+            writer = log.get();
+            cout << "Replayed " << log->stats().replayed << " logged mutations from " << flags["--wal"] << endl;
+        }
+        else if (flags.count("--lsm") != 0) {
+            LsmOptions lsmOptions;
+            lsmOptions.memtableBytes = stoull(optionOr(flags, "--memtable-bytes", to_string(lsmOptions.memtableBytes)));
+            lsmOptions.compactAt = stoul(optionOr(flags, "--compact-at", to_string(lsmOptions.compactAt)));
+            lsmOptions.compactionBytesPerSecond = stoull(optionOr(flags, "--compaction-rate", to_string(lsmOptions.compactionBytesPerSecond)));
+            lsmOptions.syncWrites = optionOr(flags, "--sync", "each") != "none";
+            lsmOptions.publishMilliseconds = stoul(optionOr(flags, "--publish-milliseconds", to_string(lsmOptions.publishMilliseconds)));
+            store = make_unique<LsmStore>(catalog, catalogPath, flags["--lsm"], lsmOptions);
+            writer = store.get();
+            cout << "Opened store " << flags["--lsm"] << " with " << store->stats().runs << " runs" << endl;
+        }
+        else {
+            catalogLoader = make_unique<DiffLoader>(catalog, catalogPath);
+            catalogLoader->reload();
+            watcher = watchCatalogIfAsked(flags, *catalogLoader);
+        }
+        unique_ptr<SelectionLists> lists;
+        if (flags.count("--lists") != 0) {
+            lists = make_unique<SelectionLists>(flags["--lists"]);
+            if (lists->skipped() != 0) {
+                cerr << "Skipped " << lists->skipped() << " records of " << flags["--lists"] << " that couldn't be applied" << endl;
+            }
+        }
+        unique_ptr<QueryCache> results;
+        QueryCaches caches;
+        if (options.resultCacheBytes != 0) {
+            results = make_unique<QueryCache>(options.resultCacheBytes);
+            caches.results = results.get();
+        }
+        vector<MemoryAccounts::Registration> memory = trackCatalogMemory(catalog);
+        if (results) {
+            memory.push_back(MemoryAccounts::shared().track("cache.query", [&results] { return results->stats().bytes; }));
+        }
+        if (lists) {
+            memory.push_back(MemoryAccounts::shared().track("selections", [&lists] { return lists->bytes(); }));
+        }
+        if (store) {
+            memory.push_back(MemoryAccounts::shared().track("store.memtable", [&store] { return store->stats().memtableBytes; }));
+        }
+        MemoryAccounts::shared().writeReport(cout, catalog.snapshot()->library.getSize());
+        EventServer server(queryLineHandler(catalog, caches, writer, lists.get()), options.workers);
+        server.listenUnix(options.socketPath);
+        if (options.tcpPort != 0) {
+            server.listenTcp(options.tcpPort);
+        }
+        activeServer = &server;
+        signal(SIGINT, stopActiveServer);
+        signal(SIGTERM, stopActiveServer);
+        cout << "Serving " << catalog.snapshot()->library.getSize() << " books on " << options.socketPath;
+        if (options.tcpPort != 0) {
+            cout << " and 127.0.0.1:" << options.tcpPort;
+        }
+        cout << " with " << server.workers() << " workers" << endl;
+        server.run();
+        activeServer = nullptr;
+    }
+    catch (const exception& e) {
+        cerr << "Error: " << e.what() << endl;
+        return 1;
+    }
+    return 0;
 }
 
-const string DATA_FILE_PATH = "TestData/";
-int main() {
-    Library<Book> library;
-    vector<BookData> booksData;
-    json jsonData;
-    vector<const Book*> selectedBooks;
+// Serves the HTTP read API on 127.0.0.1 until interrupted:
+//   BooksManagement --http [--port N] [--workers N] [--catalog <books.json>] [--fragment-budget <bytes>]
+//                  [--result-cache <bytes>] [--watch 1]
+int runHttpMode(int argc, char* argv[]) {
+    try {
+        map<string, string> flags = parseOptions(argc, argv, 2);
+        int port = stoi(optionOr(flags, "--port", "8080"));
+        string catalogPath = optionOr(flags, "--catalog", DATA_FILE_PATH + "books.json");
+        Catalog catalog;
+        DiffLoader catalogLoader(catalog, catalogPath);
+        catalogLoader.reload();
+        unique_ptr<CatalogWatcher> watcher = watchCatalogIfAsked(flags, catalogLoader);
+        // an unbounded fragment cache is filled at load time, a bounded one on first use
+        size_t fragmentBudget = stoull(optionOr(flags, "--fragment-budget", "0"));
+        FragmentCache fragments(fragmentBudget);
+        if (fragmentBudget == 0) {
+            fragments.warm(*catalog.snapshot());
+        }
+        size_t resultCacheBytes = stoull(optionOr(flags, "--result-cache", to_string(64 * 1024 * 1024)));
+        unique_ptr<QueryCache> results;
+        if (resultCacheBytes != 0) {
+            results = make_unique<QueryCache>(resultCacheBytes);
+        }
+        vector<MemoryAccounts::Registration> memory = trackCatalogMemory(catalog);
+        memory.push_back(MemoryAccounts::shared().track("cache.fragment", [&fragments] { return fragments.stats().bytes; }));
+        if (results) {
+            memory.push_back(MemoryAccounts::shared().track("cache.query", [&results] { return results->stats().bytes; }));
+        }
+        MemoryAccounts::shared().writeReport(cout, catalog.snapshot()->library.getSize());
+        HttpApi api(catalog, fragments, results.get());
+        EventServer server([&api](Connection& conn) { return api.handle(conn); }, stoul(optionOr(flags, "--workers", "0")));
+        server.listenTcp(port);
+        activeServer = &server;
+        signal(SIGINT, stopActiveServer);
+        signal(SIGTERM, stopActiveServer);
+        cout << "Serving " << catalog.snapshot()->library.getSize() << " books on http://127.0.0.1:" << port
+            << "/books with " << server.workers() << " workers" << endl;
+        server.run();
+        activeServer = nullptr;
+    }
+    catch (const exception& e) {
+        cerr << "Error: " << e.what() << endl;
+        return 1;
+    }
+    return 0;
+}
 
-    // Load the JSON data
+// Measures a running query or HTTP server:
+//   BooksManagement --loadgen [--socket <path> | --port N] [--protocol line|http] [--connections N]
+//                   [--pipeline N] [--requests N] [--queries <file.jsonl>]
+int runLoadMode(int argc, char* argv[]) {
     try {
-        json jsonData = loadJsonFile(DATA_FILE_PATH + "books.json");
+        map<string, string> flags = parseOptions(argc, argv, 2);
+        LoadOptions options;
+        options.socketPath = optionOr(flags, "--socket", options.socketPath);
+        options.tcpPort = stoi(optionOr(flags, "--port", "0"));
+        options.connections = stoul(optionOr(flags, "--connections", "4"));
+        options.pipeline = stoul(optionOr(flags, "--pipeline", "16"));
+        options.requests = stoul(optionOr(flags, "--requests", "100000"));
+        bool http = optionOr(flags, "--protocol", "line") == "http";
+        options.responseLength = http ? httpResponseLength : lineResponseLength;
+
+        string queriesPath = optionOr(flags, "--queries", DATA_FILE_PATH + "queries.jsonl");
+        ifstream queries(queriesPath);
+        if (!queries) {
+            throw runtime_error("Error opening file: " + queriesPath);
+        }
+        string line;
+        while (getline(queries, line)) {
+            if (line.find_first_not_of(" \t\r") == string::npos) {
+                continue;
+            }
+            if (!http) {
+                options.payloads.push_back(line + "\n");
+                continue;
+            }
+            Query query = parseQuery(json::parse(line));
+            string target = "/books?author=" + urlEncode(query.author) + "&lang=" + urlEncode(query.language)
+                + "&title=" + urlEncode(query.title) + (query.ignoreCase ? "&icase=1" : "");
+            options.payloads.push_back("GET " + target + " HTTP/1.1\r\nHost: localhost\r\n\r\n");
+        }
 
-        printJsonData(jsonData);
+        LoadReport report = runLoad(options);
+        cout << report.requests << " requests in " << report.seconds << " s ("
+            << (report.seconds > 0 ? report.requests / report.seconds : 0.0) << " requests/s)" << '\n';
+        cout << "latency ns: p50 " << report.latency.percentile(0.50) << ", p99 " << report.latency.percentile(0.99)
+            << ", p99.9 " << report.latency.percentile(0.999) << ", max " << report.latency.max() << endl;
+    }
+    catch (const exception& e) {
+        cerr << "Error: " << e.what() << endl;
+        return 1;
+    }
+    return 0;
+}
+#endif
 
-        for (const auto& bookData : jsonData) {
-            library.addItem(Book(bookData));
+int main(int argc, char* argv[]) {
+    if (argc > 1 && string(argv[1]) == "--batch") {
+        return runBatchMode(argc, argv);
+    }
+    if (argc > 1 && string(argv[1]) == "--wal-bench") {
+        return runLogBenchMode(argc, argv);
+    }
+    if (argc > 1 && string(argv[1]) == "--generate") {
+        return runGenerateMode(argc, argv);
+    }
+    if (argc > 1 && (string(argv[1]) == "--serve" || string(argv[1]) == "--http" || string(argv[1]) == "--loadgen")) {
+#ifndef _WIN32
+        string mode = argv[1];
+        if (mode == "--serve") {
+            return runServerMode(argc, argv);
         }
+        return mode == "--http" ? runHttpMode(argc, argv) : runLoadMode(argc, argv);
+#else
+        cerr << "Server mode is only available on Linux" << endl;
+        return 2;
+#endif
+    }
+
+    // "--trace <file>" times every operation of the session, written as a trace on quit
+    string tracePath = argc > 2 && string(argv[1]) == "--trace" ? argv[2] : "";
+    if (!tracePath.empty()) {
+        Tracer::shared().start(true);
+    }
+
+    Catalog catalog;
+    DiffLoader catalogLoader(catalog, DATA_FILE_PATH + "books.json");
+
+    // Load the JSON data; the loader parses the file once and later reloads apply only changes
+    try {
+        catalogLoader.reload();
+
+        printBooks(catalog.snapshot()->library);
     }
     catch (const exception& e) {
         cerr << "Error: " << e.what() << endl;
     }
-    printJsonData(jsonData);
+
+    // Saved books are journaled as they're saved, so a crash doesn't lose them
+    SelectionStore selectedBooks("selected_books.journal");
+
+    // Picks up edits to books.json while the menu is open, applying only the books that
+    // changed. Each menu action works on the version current when it started.
+    mutex reloadNoticeLock;
+    string reloadNotice;
+    CatalogWatcher watcher(catalogLoader.filePath(), [&catalogLoader] { return catalogLoader.reload(); },
+        [&](const ReloadStats& stats) {
+            lock_guard<mutex> guard(reloadNoticeLock);
+            reloadNotice = "Catalog reloaded: " + to_string(stats.books) + " books (" + reloadChanges(stats) + ") in "
+                + to_string(stats.loadSeconds * 1000) + " ms, swap paused " + to_string(stats.swapSeconds * 1e6) + " us";
+        },
+        [&](const string& message) {
+            lock_guard<mutex> guard(reloadNoticeLock);
+            reloadNotice = "Catalog reload failed: " + message;
+        });
+    Screen screen;
+    // sorted orders are shared by every view of a catalog version
+    auto orders = make_shared<SortedOrders>();
+    SearchIndexes indexes;
+    // links open on a background thread, so a slow browser never holds up the menu
+    LinkOpener links;
+    vector<MemoryAccounts::Registration> memory = trackCatalogMemory(catalog);
+    memory.push_back(MemoryAccounts::shared().track("index.author", [&indexes] { return indexes.bytes(SearchField::AUTHOR); }));
+    memory.push_back(MemoryAccounts::shared().track("index.language", [&indexes] { return indexes.bytes(SearchField::LANGUAGE); }));
+    memory.push_back(MemoryAccounts::shared().track("index.sorted", [orders] { return orders->bytes(); }));
+    memory.push_back(MemoryAccounts::shared().track("selections", [&selectedBooks] { return selectedBooks.bytes(); }));
+    MemoryAccounts::shared().writeReport(cout, catalog.snapshot()->library.getSize());
     while (true) {
-        system("cls"); // Clear the screen
-        cout << "Select an option:" << endl;
-        cout << "1. Display all books" << endl;
-        cout << "2. Search books by author" << endl;
-        cout << "3. Search books by language" << endl;
-        cout << "4. Quit" << endl;
-        cout << "Enter your choice: ";
+        shared_ptr<const CatalogSnapshot> session = catalog.snapshot();
+        const Library<Book>& library = session->library;
+        const ColumnStore& titles = session->titles;
+
+        screen.begin();
+        {
+            lock_guard<mutex> guard(reloadNoticeLock);
+            if (!reloadNotice.empty()) {
+                screen.line(reloadNotice);
+            }
+        }
+        screen.line("Select an option:");
+        screen.line("1. Display all books");
+        screen.line("2. Search books by author");
+        screen.line("3. Search books by language");
+        screen.line("4. Search books by title");
+        screen.line("5. Quit");
+        screen.prompt("Enter your choice: ");
+        screen.present();
         int choice;
         cin >> choice;
         cin.ignore();
 
         // processes the choices for the users
         if (choice == 1) {
-            displayBooksInPages(library, jsonData, booksData, selectedBooks);
+            displayBooksInPages(session, Query(), ViewOrder::CATALOG, orders, selectedBooks, links, screen);
         }
         else if (choice == 2) {
-            searchBooksByAuthor(library, selectedBooks);
-            cout << "Press Enter to continue...";
-            cin.get();
+            searchBooksByAuthor(session, orders, indexes, selectedBooks, links, screen);
         }
         else if (choice == 3) {
-            searchBooksByLanguage(library, selectedBooks);
+            searchBooksByLanguage(session, orders, indexes, selectedBooks, links, screen);
+        }
+        else if (choice == 4) {
+            searchBooksByTitle(library, titles, selectedBooks, links);
             cout << "Press Enter to continue...";
             cin.get();
         }
-        else if (choice == 4) {
+        else if (choice == 5) {
             break;
         }
         else {
@@ -440,10 +839,22 @@ int main() {
     // Saves selected books to the file
     try {
         saveSelectedBooks(selectedBooks, "selected_books.txt");
+        selectedBooks.compact();
     }
     catch (const exception& e) {
         cerr << "Error: " << e.what() << endl;
     }
+    const LatencyHistogram& frames = screen.frameNanoseconds();
+    cout << "Drew " << frames.count() << " screens: p50 " << frames.percentile(0.5) / 1000 << " us, p99 "
+        << frames.percentile(0.99) / 1000 << " us, max " << frames.max() / 1000 << " us" << endl;
+    if (!tracePath.empty()) {
+        try {
+            finishTrace(tracePath);
+        }
+        catch (const exception& e) {
+            cerr << "Error: " << e.what() << endl;
+        }
+    }
 
     return 0;
 }
@@ -0,0 +1,185 @@
+#pragma once
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <utility>
+#include <vector>
+#include "ColumnStore.h"
+#include "Library.h"
+#include "Memory.h"
+#include "Metrics.h"
+
+// One immutable version of the catalog. Readers keep the version they started with
+// alive through its shared_ptr, so nothing they hold can change or be freed under them.
+struct CatalogSnapshot {
+    uint64_t version = 0;
+    Library<Book> library;
+    ColumnStore titles;
+};
+
+// Versioned catalog with lock-free reads. Readers pin the current snapshot with an
+// atomic load; writers queue books and publish them as a new version in one atomic store.
+// Snapshots share every storage chunk and append past each other's ends, so publishing
+// costs only the new books; a replaced or removed book costs a copy of its chunk.
+class Catalog {
+private:
+    std::shared_ptr<const CatalogSnapshot> current;
+    // serializes writers only, readers never take it
+    std::mutex writeLock;
+    std::vector<Book> pending;
+
+    // sets the catalog gauges to what snapshot holds
+    static void recordMetrics(const CatalogSnapshot& snapshot) {
+        static const Gauge books = MetricsRegistry::shared().gauge("books_catalog_books", "Books in the current catalog version");
+        static const Gauge version = MetricsRegistry::shared().gauge("books_catalog_version", "Number of the current catalog version");
+        static const Gauge titleBytes = MetricsRegistry::shared().gauge("books_title_column_bytes", "Bytes of the title column buffers of the current version");
+        books.set(static_cast<int64_t>(snapshot.library.getSize()));
+        version.set(static_cast<int64_t>(snapshot.version));
+        titleBytes.set(static_cast<int64_t>(snapshot.titles.bytes()));
+    }
+
+    // publishes next and hands back the version it replaced, so the caller can let go of it
+    // outside any lock and timing
+    std::shared_ptr<const CatalogSnapshot> install(std::shared_ptr<const CatalogSnapshot> next) {
+        recordMetrics(*next);
+        return std::atomic_exchange_explicit(&current, std::move(next), std::memory_order_acq_rel);
+    }
+
+public:
+    Catalog() : current(std::make_shared<CatalogSnapshot>()) {}
+
+    explicit Catalog(const Library<Book>& library) {
+        auto first = std::make_shared<CatalogSnapshot>();
+        first->version = 1;
+        first->library = library;
+        first->titles = ColumnStore::build(library);
+        recordMetrics(*first);
+        current = first;
+    }
+
+    Catalog(const Catalog&) = delete;
+    Catalog& operator=(const Catalog&) = delete;
+
+    // Pins the current version. The result stays valid however many versions follow it.
+    std::shared_ptr<const CatalogSnapshot> snapshot() const {
+        return std::atomic_load_explicit(&current, std::memory_order_acquire);
+    }
+
+    uint64_t version() const {
+        return snapshot()->version;
+    }
+
+    // queues a book for the next publish(); readers don't see it until then
+    void addItem(const Book& book) {
+        std::lock_guard<std::mutex> guard(writeLock);
+        pending.push_back(book);
+    }
+
+    // number of books waiting for publish()
+    size_t pendingCount() {
+        std::lock_guard<std::mutex> guard(writeLock);
+        return pending.size();
+    }
+
+    // Applies every queued book as one new version and returns its number.
+    // Returns the current version unchanged when nothing is queued.
+    uint64_t publish() {
+        std::shared_ptr<const CatalogSnapshot> previous;
+        uint64_t version;
+        {
+            std::lock_guard<std::mutex> guard(writeLock);
+            std::shared_ptr<const CatalogSnapshot> base = snapshot();
+            if (pending.empty()) {
+                return base->version;
+            }
+            auto next = std::make_shared<CatalogSnapshot>(*base);
+            next->version = base->version + 1;
+            for (const Book& book : pending) {
+                next->library.addItem(book);
+                next->titles.append(book);
+            }
+            pending.clear();
+            version = next->version;
+            previous = install(std::move(next));
+        }
+        // the old version is freed here, outside the lock, unless a reader still pins it
+        previous.reset();
+        return version;
+    }
+
+    // Replaces the whole catalog, e.g. after reloading it from disk. The indexes are built
+    // before anything is locked; swapSeconds, when given, receives how long the swap took.
+    // Queued books are kept and land on top of the new library at the next publish().
+    uint64_t replace(const Library<Book>& library, double* swapSeconds = nullptr) {
+        auto next = std::make_shared<CatalogSnapshot>();
+        next->library = library;
+        next->titles = ColumnStore::build(library);
+        std::shared_ptr<const CatalogSnapshot> previous;
+        uint64_t version;
+        {
+            auto swapStart = std::chrono::steady_clock::now();
+            std::lock_guard<std::mutex> guard(writeLock);
+            next->version = snapshot()->version + 1;
+            version = next->version;
+            previous = install(std::move(next));
+            if (swapSeconds != nullptr) {
+                *swapSeconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - swapStart).count();
+            }
+        }
+        // the old version is freed here unless a reader still pins it
+        previous.reset();
+        return version;
+    }
+
+    // Publishes a new version made by change, which edits a copy of the current one in place
+    // and returns whether it changed anything. The copy shares every storage chunk change
+    // leaves alone. change runs under the writer lock, so it sees no concurrent publish; if it
+    // throws or returns false nothing is published and the current version is returned.
+    uint64_t modify(const std::function<bool(CatalogSnapshot& next)>& change, double* swapSeconds = nullptr) {
+        std::shared_ptr<const CatalogSnapshot> previous;
+        uint64_t version;
+        {
+            std::lock_guard<std::mutex> guard(writeLock);
+            auto next = std::make_shared<CatalogSnapshot>(*snapshot());
+            if (!change(*next)) {
+                return next->version;
+            }
+            next->version = snapshot()->version + 1;
+            version = next->version;
+            auto swapStart = std::chrono::steady_clock::now();
+            previous = install(std::move(next));
+            if (swapSeconds != nullptr) {
+                *swapSeconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - swapStart).count();
+            }
+        }
+        previous.reset();
+        return version;
+    }
+};
+
+// Registers the memory of catalog's current version: catalog.books for the book objects and
+// their chunks, catalog.strings for what the books' strings own and catalog.titles for the
+// title columns. The strings are walked once per version. catalog must outlive the result.
+inline std::vector<MemoryAccounts::Registration> trackCatalogMemory(const Catalog& catalog) {
+    std::vector<MemoryAccounts::Registration> registrations;
+    MemoryAccounts& accounts = MemoryAccounts::shared();
+    registrations.push_back(accounts.track("catalog.books", [&catalog] { return catalog.snapshot()->library.storageBytes(); }));
+    // version and bytes of the last walk; estimators run one at a time
+    auto strings = std::make_shared<std::pair<uint64_t, size_t>>(UINT64_MAX, 0);
+    registrations.push_back(accounts.track("catalog.strings", [&catalog, strings] {
+        std::shared_ptr<const CatalogSnapshot> snapshot = catalog.snapshot();
+        if (strings->first != snapshot->version) {
+            size_t total = 0;
+            for (size_t i = 0; i < snapshot->library.getSize(); ++i) {
+                total += snapshot->library.getItem(i).heapBytes();
+            }
+            *strings = { snapshot->version, total };
+        }
+        return strings->second;
+    }));
+    registrations.push_back(accounts.track("catalog.titles", [&catalog] { return catalog.snapshot()->titles.bytes(); }));
+    return registrations;
+}
@@ -0,0 +1,432 @@
+#pragma once
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <condition_variable>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <mutex>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <vector>
+#include "DurableFile.h"
+#include "Library.h"
+
+// Output formats of the catalog generator
+enum class CatalogFormat { JSON, JSONL, BINARY };
+
+// Settings of a synthetic catalog. The same settings always give the same catalog, whatever
+// the number of threads.
+struct GeneratorOptions {
+    uint64_t books = 1000;
+    uint64_t seed = 1;
+    CatalogFormat format = CatalogFormat::JSON;
+    size_t threads = std::thread::hardware_concurrency();
+    size_t minTitleWords = 1;
+    size_t maxTitleWords = 6;
+    // share of words and names written in other scripts than plain ASCII
+    double unicodeShare = 0.1;
+};
+
+// One book in the books.json schema
+struct GeneratedBook {
+    std::string author;
+    std::string country;
+    std::string imageLink;
+    std::string language;
+    std::string link;
+    uint32_t pages;
+    std::string title;
+    int32_t year;
+};
+
+// First bytes of a binary catalog; the books follow as DurableFile.h records
+const char BINARY_CATALOG_MAGIC[8] = { 'B', 'O', 'O', 'K', 'C', 'A', 'T', '1' };
+
+// Payload of one book's binary record: its strings each prefixed by their uint32 length in
+// schema order, with pages and year as uint32 in their places
+inline std::string encodeBinaryBook(const GeneratedBook& book) {
+    std::string payload;
+    putString(payload, book.author);
+    putString(payload, book.country);
+    putString(payload, book.imageLink);
+    putString(payload, book.language);
+    putString(payload, book.link);
+    putU32(payload, book.pages);
+    putString(payload, book.title);
+    putU32(payload, static_cast<uint32_t>(book.year));
+    return payload;
+}
+
+// Loads a binary catalog, reading it a record at a time. Fields the Book model has no place
+// for are skipped.
+inline Library<Book> loadBinaryCatalog(const std::string& path) {
+    FILE* in = fopen(path.c_str(), "rb");
+    if (in == nullptr) {
+        throw std::runtime_error("Error opening file: " + path);
+    }
+    char magic[8];
+    if (fread(magic, 1, 8, in) != 8 || memcmp(magic, BINARY_CATALOG_MAGIC, 8) != 0) {
+        fclose(in);
+        throw std::runtime_error("Not a binary catalog: " + path);
+    }
+    Library<Book> library;
+    std::string record(8, '\0');
+    std::string payload;
+    while (fread(&record[0], 1, 8, in) == 8) {
+        uint32_t length;
+        memcpy(&length, record.data(), 4);
+        record.resize(8 + length);
+        if (fread(&record[8], 1, length, in) != length || readRecord(record, 0, payload) == 0) {
+            fclose(in);
+            throw std::runtime_error("Corrupt binary catalog: " + path);
+        }
+        record.resize(8);
+        std::string author, country, imageLink, language, link, title;
+        const char* p = payload.data();
+        const char* end = p + payload.size();
+        if (!getString(p, end, author) || !getString(p, end, country) || !getString(p, end, imageLink)
+            || !getString(p, end, language) || !getString(p, end, link) || end - p < 4) {
+            fclose(in);
+            throw std::runtime_error("Corrupt binary catalog: " + path);
+        }
+        p += 4;
+        if (!getString(p, end, title)) {
+            fclose(in);
+            throw std::runtime_error("Corrupt binary catalog: " + path);
+        }
+        library.addItem(Book(title, author, link, language));
+    }
+    fclose(in);
+    countBooksLoaded(library.getSize());
+    return library;
+}
+
+// Samples ranks 0..n-1 with probability proportional to 1 / (rank + 1)^exponent
+class ZipfTable {
+private:
+    std::vector<double> cumulative;
+
+public:
+    ZipfTable(size_t n, double exponent) : cumulative(n) {
+        double sum = 0;
+        for (size_t i = 0; i < n; ++i) {
+            sum += 1.0 / std::pow(static_cast<double>(i + 1), exponent);
+            cumulative[i] = sum;
+        }
+        for (double& c : cumulative) {
+            c /= sum;
+        }
+    }
+
+    // u is uniform in [0, 1)
+    size_t sample(double u) const {
+        return std::min<size_t>(std::lower_bound(cumulative.begin(), cumulative.end(), u) - cumulative.begin(), cumulative.size() - 1);
+    }
+};
+
+// Generates synthetic catalogs in the books.json schema, book by book or streamed to a file.
+// Authors, and the languages and countries they write from, follow Zipf distributions: a
+// few are very common and most are rare. Every book is a pure function of the seed and its
+// position, so the books can be made in parallel and in any order.
+class CatalogGenerator {
+private:
+    struct Language {
+        const char* name;
+        // 0 Latin, 1 Cyrillic, 2 Greek, 3 CJK
+        int script;
+        std::vector<const char*> countries;
+    };
+
+    // books made and written at a time; a few blocks per thread are all that's ever in memory
+    static constexpr size_t BLOCK_BOOKS = 16 * 1024;
+
+    GeneratorOptions options;
+    std::vector<Language> languages;
+    ZipfTable languageRanks;
+    ZipfTable countryRanks;
+    size_t authorCount;
+    ZipfTable authorRanks;
+
+    // SplitMix64, a counter-based generator: any stream of numbers is reached in O(1)
+    struct Random {
+        uint64_t state;
+
+        uint64_t next() {
+            uint64_t z = (state += 0x9E3779B97F4A7C15ull);
+            z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ull;
+            z = (z ^ (z >> 27)) * 0x94D049BB133111EBull;
+            return z ^ (z >> 31);
+        }
+
+        double uniform() {
+            return static_cast<double>(next() >> 11) * (1.0 / 9007199254740992.0);
+        }
+
+        size_t below(size_t n) {
+            return static_cast<size_t>(next() % n);
+        }
+    };
+
+    Random stream(uint64_t kind, uint64_t index) const {
+        Random random{ options.seed * 0x100000001B3ull ^ (kind << 56) ^ index };
+        random.next();
+        return random;
+    }
+
+    static const std::vector<Language>& languageTable() {
+        static const std::vector<Language> table = {
+            { "English", 0, { "United States", "United Kingdom", "Canada", "Australia", "Ireland", "New Zealand" } },
+            { "Spanish", 0, { "Spain", "Mexico", "Argentina", "Colombia", "Chile", "Peru" } },
+            { "French", 0, { "France", "Belgium", "Switzerland", "Canada", "Senegal" } },
+            { "German", 0, { "Germany", "Austria", "Switzerland" } },
+            { "Russian", 1, { "Russia", "Ukraine", "Belarus", "Kazakhstan" } },
+            { "Chinese", 3, { "China", "Taiwan", "Singapore" } },
+            { "Japanese", 3, { "Japan" } },
+            { "Italian", 0, { "Italy", "Switzerland" } },
+            { "Portuguese", 0, { "Portugal", "Brazil", "Angola", "Mozambique" } },
+            { "Arabic", 0, { "Egypt", "Lebanon", "Morocco", "Syria", "Sudan" } },
+            { "Polish", 0, { "Poland" } },
+            { "Dutch", 0, { "Netherlands", "Belgium" } },
+            { "Swedish", 0, { "Sweden", "Finland" } },
+            { "Greek", 2, { "Greece", "Cyprus" } },
+            { "Turkish", 0, { "Turkey" } },
+            { "Czech", 0, { "Czech Republic" } },
+            { "Norwegian", 0, { "Norway" } },
+            { "Danish", 0, { "Denmark" } },
+            { "Hungarian", 0, { "Hungary" } },
+            { "Hindi", 0, { "India" } },
+            { "Korean", 3, { "South Korea" } },
+            { "Hebrew", 0, { "Israel" } },
+            { "Finnish", 0, { "Finland" } },
+            { "Icelandic", 0, { "Iceland" } },
+            { "Yiddish", 0, { "Poland", "United States" } },
+            { "Persian", 0, { "Iran", "Afghanistan" } },
+            { "Romanian", 0, { "Romania", "Moldova" } },
+            { "Serbian", 1, { "Serbia" } },
+            { "Swahili", 0, { "Kenya", "Tanzania" } },
+            { "Vietnamese", 0, { "Vietnam" } },
+        };
+        return table;
+    }
+
+    // one syllable in script; Latin ones sometimes carry an accent
+    static std::string syllable(Random& random, int script) {
+        static const char* latin[] = { "ka", "lo", "mi", "ra", "ten", "vor", "sa", "bel", "dun", "ie", "mar", "os", "qui",
+            "stan", "ul", "wer", "an", "ber", "cor", "el", "fin", "gar", "hol", "jo", "nor", "pet", "ros", "tha", "ven", "zen" };
+        static const char* accented[] = { "é", "ö", "ñ", "ç", "å", "ø", "ü", "ł", "ș", "á" };
+        static const char* cyrillic[] = { "ка", "ло", "ми", "ра", "тен", "вор", "са", "бел", "дун", "ин", "ов", "ска" };
+        static const char* greek[] = { "κα", "λο", "μι", "ρα", "τεν", "σα", "φι", "νος", "ης", "δη" };
+        static const char* cjk[] = { "山", "川", "田", "中", "本", "木", "林", "花", "海", "月", "星", "風", "雪", "春", "秋" };
+        switch (script) {
+        case 1:
+            return cyrillic[random.below(sizeof(cyrillic) / sizeof(*cyrillic))];
+        case 2:
+            return greek[random.below(sizeof(greek) / sizeof(*greek))];
+        case 3:
+            return cjk[random.below(sizeof(cjk) / sizeof(*cjk))];
+        case 4: {
+            std::string text = latin[random.below(sizeof(latin) / sizeof(*latin))];
+            return text.substr(0, 1) + accented[random.below(sizeof(accented) / sizeof(*accented))];
+        }
+        default:
+            return latin[random.below(sizeof(latin) / sizeof(*latin))];
+        }
+    }
+
+    // a word of a few syllables, capitalized when it's ASCII
+    static std::string word(Random& random, int script) {
+        std::string text;
+        size_t syllables = 1 + random.below(3);
+        for (size_t i = 0; i < syllables; ++i) {
+            text += syllable(random, script);
+        }
+        if (text[0] >= 'a' && text[0] <= 'z') {
+            text[0] = static_cast<char>(text[0] - 'a' + 'A');
+        }
+        return text;
+    }
+
+    // script of a word: ASCII, unless it falls in the Unicode share, then the language's own
+    // script or accented Latin
+    int scriptOf(Random& random, const Language& language) const {
+        if (random.uniform() >= options.unicodeShare) {
+            return 0;
+        }
+        return language.script == 0 ? 4 : language.script;
+    }
+
+    static void appendJsonString(std::string& out, const std::string& value) {
+        out.push_back('"');
+        for (char c : value) {
+            if (c == '"' || c == '\\') {
+                out.push_back('\\');
+                out.push_back(c);
+            }
+            else if (static_cast<unsigned char>(c) < 0x20) {
+                char escaped[8];
+                snprintf(escaped, sizeof(escaped), "\\u%04x", c);
+                out += escaped;
+            }
+            else {
+                out.push_back(c);
+            }
+        }
+        out.push_back('"');
+    }
+
+    static void appendJson(std::string& out, const GeneratedBook& book) {
+        out += "{\"author\":";
+        appendJsonString(out, book.author);
+        out += ",\"country\":";
+        appendJsonString(out, book.country);
+        out += ",\"imageLink\":";
+        appendJsonString(out, book.imageLink);
+        out += ",\"language\":";
+        appendJsonString(out, book.language);
+        out += ",\"link\":";
+        appendJsonString(out, book.link);
+        out += ",\"pages\":";
+        out += std::to_string(book.pages);
+        out += ",\"title\":";
+        appendJsonString(out, book.title);
+        out += ",\"year\":";
+        out += std::to_string(book.year);
+        out.push_back('}');
+    }
+
+    // books [first, last) in the output format, each followed by its separator
+    std::string encodeBlock(uint64_t first, uint64_t last) const {
+        std::string out;
+        for (uint64_t i = first; i < last; ++i) {
+            GeneratedBook generated = book(i);
+            if (options.format == CatalogFormat::BINARY) {
+                appendRecord(out, encodeBinaryBook(generated));
+                continue;
+            }
+            appendJson(out, generated);
+            if (options.format == CatalogFormat::JSON && i + 1 < options.books) {
+                out.push_back(',');
+            }
+            out.push_back('\n');
+        }
+        return out;
+    }
+
+public:
+    explicit CatalogGenerator(const GeneratorOptions& options)
+        : options(options), languages(languageTable()), languageRanks(languages.size(), 1.1), countryRanks(8, 1.3),
+        authorCount(static_cast<size_t>(std::min<uint64_t>(std::max<uint64_t>(options.books / 20, 100), 1000000))),
+        authorRanks(authorCount, 1.0) {
+        if (options.minTitleWords == 0 || options.minTitleWords > options.maxTitleWords) {
+            throw std::runtime_error("Title words must be a range like 1-6");
+        }
+    }
+
+    // book number index of the catalog
+    GeneratedBook book(uint64_t index) const {
+        Random random = stream(0, index);
+        size_t authorIndex = authorRanks.sample(random.uniform());
+        // an author always has the same name, language and country
+        Random author = stream(1, authorIndex);
+        const Language& language = languages[languageRanks.sample(author.uniform())];
+        GeneratedBook generated;
+        generated.language = language.name;
+        generated.country = language.countries[countryRanks.sample(author.uniform()) % language.countries.size()];
+        int nameScript = scriptOf(author, language);
+        generated.author = word(author, nameScript) + (nameScript == 3 ? "" : " ") + word(author, nameScript);
+
+        size_t words = options.minTitleWords + random.below(options.maxTitleWords - options.minTitleWords + 1);
+        for (size_t w = 0; w < words; ++w) {
+            int script = scriptOf(random, language);
+            if (w > 0 && script != 3) {
+                generated.title.push_back(' ');
+            }
+            generated.title += word(random, script);
+        }
+        std::string slug = generated.title;
+        std::replace(slug.begin(), slug.end(), ' ', '_');
+        generated.link = "https://en.wikipedia.org/wiki/" + slug;
+        generated.imageLink = "images/book-" + std::to_string(index) + ".jpg";
+        // most books are a few hundred pages, a few run to thousands
+        generated.pages = 40 + static_cast<uint32_t>(std::pow(random.uniform(), 3) * 1500);
+        // skewed towards recent years, reaching back to antiquity
+        generated.year = 2024 - static_cast<int32_t>(std::pow(random.uniform(), 4) * 3000);
+        return generated;
+    }
+
+    // Writes the whole catalog to path. Threads make blocks of books ahead of the writer, at
+    // most a few blocks per thread, so memory stays flat however big the catalog.
+    void write(const std::string& path) const {
+        FILE* out = fopen(path.c_str(), "wb");
+        if (out == nullptr) {
+            throw std::runtime_error("Error opening file: " + path);
+        }
+        std::string head = options.format == CatalogFormat::BINARY ? std::string(BINARY_CATALOG_MAGIC, 8)
+            : options.format == CatalogFormat::JSON ? "[\n" : "";
+        bool failed = fwrite(head.data(), 1, head.size(), out) != head.size();
+
+        uint64_t blocks = (options.books + BLOCK_BOOKS - 1) / BLOCK_BOOKS;
+        size_t threads = std::max<size_t>(options.threads, 1);
+        size_t window = 2 * threads;
+        std::vector<std::string> slots(window);
+        std::vector<bool> ready(window, false);
+        std::mutex lock;
+        std::condition_variable changed;
+        uint64_t written = 0;
+        std::atomic<uint64_t> nextBlock{ 0 };
+        bool stopping = false;
+
+        std::vector<std::thread> workers;
+        for (size_t t = 0; t < threads; ++t) {
+            workers.emplace_back([&] {
+                uint64_t block;
+                while ((block = nextBlock.fetch_add(1)) < blocks) {
+                    {
+                        // a block waits until the writer is within the window of it
+                        std::unique_lock<std::mutex> guard(lock);
+                        changed.wait(guard, [&] { return stopping || block < written + window; });
+                        if (stopping) {
+                            return;
+                        }
+                    }
+                    std::string text = encodeBlock(block * BLOCK_BOOKS, std::min<uint64_t>((block + 1) * BLOCK_BOOKS, options.books));
+                    std::lock_guard<std::mutex> guard(lock);
+                    slots[block % window] = std::move(text);
+                    ready[block % window] = true;
+                    changed.notify_all();
+                }
+            });
+        }
+        while (written < blocks && !failed) {
+            std::string text;
+            {
+                std::unique_lock<std::mutex> guard(lock);
+                changed.wait(guard, [&] { return ready[written % window]; });
+                text.swap(slots[written % window]);
+                ready[written % window] = false;
+            }
+            failed = fwrite(text.data(), 1, text.size(), out) != text.size();
+            std::lock_guard<std::mutex> guard(lock);
+            written++;
+            changed.notify_all();
+        }
+        {
+            std::lock_guard<std::mutex> guard(lock);
+            stopping = true;
+        }
+        changed.notify_all();
+        for (std::thread& worker : workers) {
+            worker.join();
+        }
+        if (options.format == CatalogFormat::JSON && !failed) {
+            failed = fputs("]\n", out) == EOF;
+        }
+        failed = fclose(out) != 0 || failed;
+        if (failed) {
+            throw std::runtime_error("Error writing file: " + path);
+        }
+    }
+};
@@ -0,0 +1,519 @@
+#pragma once
+#include <algorithm>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <mutex>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <system_error>
+#include <thread>
+#include <vector>
+#include "Catalog.h"
+#include "DurableFile.h"
+#include "Library.h"
+#include "json.hpp"
+// Durable catalog edits by book id, as the line protocol's "op" requests make them
+class CatalogWriter {
+public:
+    virtual ~CatalogWriter() = default;
+    virtual BookId addBook(const Book& book) = 0;
+    virtual void updateBook(BookId id, const Book& book) = 0;
+    virtual void removeBook(BookId id) = 0;
+};
+
+// One change to the catalog as the log records it
+struct Mutation {
+    enum Kind : uint8_t { ADD = 1, UPDATE = 2, REMOVE = 3 };
+    Kind kind = ADD;
+    // position in the log; replay skips what a checkpoint already holds
+    uint64_t sequence = 0;
+    // the book changed, or for ADD the id it got
+    BookId id = 0;
+    // unused for REMOVE
+    Book book{ "", "", "", "" };
+};
+
+// When the log forces records to disk
+enum class SyncMode {
+    // leave it to the OS; a crash of the machine may lose recent mutations
+    NONE,
+    // one write and fsync per mutation
+    EACH,
+    // one write and fsync for every mutation queued while the previous one ran
+    GROUP,
+};
+
+struct LogOptions {
+    SyncMode sync = SyncMode::GROUP;
+    // checkpoint once the log grows past this many bytes, 0 never
+    size_t checkpointBytes = 64 * 1024 * 1024;
+    // and at least this often while there are mutations to fold in, 0 never
+    double checkpointSeconds = 300;
+};
+
+struct LogStats {
+    uint64_t mutations = 0;
+    // writes to the log, each followed by an fsync unless sync is NONE
+    uint64_t commits = 0;
+    uint64_t checkpoints = 0;
+    size_t logBytes = 0;
+    // mutations the last open replayed from the log
+    size_t replayed = 0;
+    std::string checkpointError;
+};
+
+// Durable catalog mutations. Every add, update and remove is appended to a checksummed log
+// and forced to disk before it's applied to the catalog and acknowledged; mutations from
+// concurrent writers share one write and fsync (group commit) and are published as one
+// catalog version. Opening loads the last checkpoint, or the seed catalog if there's none,
+// and replays the log on top, dropping a torn record at its end. Checkpoints write the whole
+// catalog to a new snapshot file and cut the log down to what came after it.
+//
+// Ids follow Library: an added book takes the next id and a removed one is replaced by the
+// last book. The log must be the catalog's only writer while it's open.
+//
+// Log record payload: kind, sequence, id, and title, author, language and link each
+// prefixed by their uint32 length.
+class CatalogLog : public CatalogWriter {
+private:
+    struct Pending {
+        Mutation mutation;
+        std::string record;
+    };
+
+    Catalog& catalog;
+    std::string logPath;
+    std::string snapshotPath;
+    LogOptions options;
+
+    std::mutex lock;
+    std::condition_variable committed;
+    std::vector<Pending> queued;
+    uint64_t nextSequence = 0;
+    uint64_t durableSequence = 0;
+    bool flushing = false;
+    std::string failure;
+    // catalog size once every queued mutation is applied, to validate and number new ones
+    size_t logicalSize = 0;
+    FILE* file = nullptr;
+    LogStats counters;
+
+    std::mutex checkpointLock;
+    std::condition_variable checkpointWake;
+    bool stopping = false;
+    std::thread checkpointer;
+
+    static std::string encode(const Mutation& mutation) {
+        std::string payload;
+        payload.push_back(static_cast<char>(mutation.kind));
+        char sequence[8];
+        memcpy(sequence, &mutation.sequence, 8);
+        payload.append(sequence, 8);
+        putU32(payload, mutation.id);
+        if (mutation.kind != Mutation::REMOVE) {
+            putString(payload, mutation.book.getTitle());
+            putString(payload, mutation.book.getAuthor().getName());
+            putString(payload, mutation.book.getLanguage());
+            putString(payload, mutation.book.getLink());
+        }
+        std::string record;
+        appendRecord(record, payload);
+        return record;
+    }
+
+    // Decodes the record at offset; returns its size, or 0 if it's torn or corrupt
+    static size_t decode(const std::string& log, size_t offset, Mutation& mutation) {
+        std::string payload;
+        size_t used = readRecord(log, offset, payload);
+        if (used == 0 || payload.size() < 13) {
+            return 0;
+        }
+        const char* p = payload.data();
+        const char* end = p + payload.size();
+        mutation.kind = static_cast<Mutation::Kind>(*p++);
+        memcpy(&mutation.sequence, p, 8);
+        p += 8;
+        memcpy(&mutation.id, p, 4);
+        p += 4;
+        if (mutation.kind != Mutation::REMOVE) {
+            std::string title, author, language, link;
+            if (!getString(p, end, title) || !getString(p, end, author) || !getString(p, end, language) || !getString(p, end, link)) {
+                return 0;
+            }
+            mutation.book = Book(title, author, link, language);
+        }
+        return used;
+    }
+
+    // applies mutations in order, collecting the title chunks they touch
+    static void apply(Library<Book>& library, const Mutation& mutation, std::vector<size_t>& dirtyChunks) {
+        if (mutation.kind == Mutation::ADD) {
+            library.addItem(mutation.book);
+            return;
+        }
+        if (mutation.kind == Mutation::UPDATE) {
+            library.setItem(mutation.id, mutation.book);
+        }
+        else {
+            dirtyChunks.push_back((library.getSize() - 1) / LIBRARY_CHUNK_SIZE);
+            library.swapRemove(mutation.id);
+        }
+        dirtyChunks.push_back(mutation.id / LIBRARY_CHUNK_SIZE);
+    }
+
+    // returns the file from offset on, or nothing if it doesn't exist
+    static std::string readFile(const std::string& filename, size_t offset = 0) {
+        std::ifstream inFile(filename, std::ios::binary);
+        if (!inFile) {
+            return std::string();
+        }
+        inFile.seekg(static_cast<std::streamoff>(offset));
+        std::ostringstream contents;
+        contents << inFile.rdbuf();
+        return contents.str();
+    }
+
+    static FILE* openAppend(const std::string& path) {
+        FILE* opened = fopen(path.c_str(), "ab");
+        if (opened == nullptr) {
+            throw std::runtime_error("Error opening file: " + path);
+        }
+        return opened;
+    }
+
+    // loads the checkpoint or the seed catalog, replays the log and opens it for appending
+    void open(const std::string& seedPath) {
+        Library<Book> library;
+        uint64_t baseSequence = 0;
+        bool fromCheckpoint = std::filesystem::exists(snapshotPath);
+        std::ifstream inFile(fromCheckpoint ? snapshotPath : seedPath);
+        if (!inFile) {
+            throw std::runtime_error("Error opening file: " + (fromCheckpoint ? snapshotPath : seedPath));
+        }
+        nlohmann::json jsonData;
+        inFile >> jsonData;
+        if (fromCheckpoint) {
+            baseSequence = jsonData["sequence"].get<uint64_t>();
+            jsonData = std::move(jsonData["books"]);
+        }
+        for (const auto& bookData : jsonData) {
+            library.addItem(Book(bookData));
+        }
+
+        std::string log = readFile(logPath);
+        size_t offset = 0;
+        size_t used;
+        Mutation mutation;
+        std::vector<size_t> dirtyChunks;
+        while ((used = decode(log, offset, mutation)) > 0) {
+            if (mutation.sequence > baseSequence) {
+                apply(library, mutation, dirtyChunks);
+                ++counters.replayed;
+            }
+            baseSequence = std::max(baseSequence, mutation.sequence);
+            offset += used;
+        }
+        if (offset < log.size()) {
+            // a crash cut the last write short; what follows it was never acknowledged
+            std::filesystem::resize_file(logPath, offset);
+        }
+        nextSequence = durableSequence = baseSequence;
+        logicalSize = library.getSize();
+        counters.logBytes = offset;
+        catalog.replace(library);
+        file = openAppend(logPath);
+    }
+
+    // Queues mutation and waits until it's on disk and applied. Returns the id it applied to.
+    BookId submit(Mutation mutation) {
+        std::unique_lock<std::mutex> guard(lock);
+        if (!failure.empty()) {
+            throw std::runtime_error("Catalog log failed: " + failure);
+        }
+        if (mutation.kind == Mutation::ADD) {
+            mutation.id = static_cast<BookId>(logicalSize++);
+        }
+        else if (mutation.id >= logicalSize) {
+            throw std::runtime_error("No book with id " + std::to_string(mutation.id));
+        }
+        else if (mutation.kind == Mutation::REMOVE) {
+            --logicalSize;
+        }
+        mutation.sequence = ++nextSequence;
+        uint64_t mine = mutation.sequence;
+        BookId id = mutation.id;
+        queued.push_back(Pending{ mutation, encode(mutation) });
+
+        while (durableSequence < mine) {
+            if (!failure.empty()) {
+                throw std::runtime_error("Catalog log failed: " + failure);
+            }
+            if (flushing) {
+                committed.wait(guard);
+                continue;
+            }
+            // lead the next commit: write what's queued, or just the oldest record without batching
+            flushing = true;
+            size_t take = options.sync == SyncMode::EACH ? 1 : queued.size();
+            std::vector<Pending> group(std::make_move_iterator(queued.begin()), std::make_move_iterator(queued.begin() + take));
+            queued.erase(queued.begin(), queued.begin() + take);
+            guard.unlock();
+            std::string batch;
+            for (const Pending& pending : group) {
+                batch += pending.record;
+            }
+            bool written = fwrite(batch.data(), 1, batch.size(), file) == batch.size() && fflush(file) == 0;
+            if (written && options.sync != SyncMode::NONE) {
+                written = syncFile(file);
+            }
+            if (written) {
+                catalog.modify([&group](CatalogSnapshot& next) {
+                    std::vector<size_t> dirtyChunks;
+                    for (const Pending& pending : group) {
+                        apply(next.library, pending.mutation, dirtyChunks);
+                    }
+                    std::sort(dirtyChunks.begin(), dirtyChunks.end());
+                    dirtyChunks.erase(std::unique(dirtyChunks.begin(), dirtyChunks.end()), dirtyChunks.end());
+                    next.titles.refresh(next.library, dirtyChunks);
+                    return true;
+                });
+            }
+            guard.lock();
+            flushing = false;
+            if (!written) {
+                // the file may hold part of the batch now, so nothing more can be appended safely
+                failure = "write or sync of " + logPath + " failed";
+            }
+            else {
+                durableSequence = group.back().mutation.sequence;
+                counters.mutations += group.size();
+                counters.commits++;
+                counters.logBytes += batch.size();
+                if (options.checkpointBytes != 0 && counters.logBytes > options.checkpointBytes) {
+                    checkpointWake.notify_one();
+                }
+            }
+            committed.notify_all();
+        }
+        return id;
+    }
+
+    void checkpointLoop() {
+        std::unique_lock<std::mutex> guard(lock);
+        auto last = std::chrono::steady_clock::now();
+        while (!stopping) {
+            auto period = std::chrono::duration<double>(options.checkpointSeconds > 0 ? options.checkpointSeconds : 3600.0);
+            checkpointWake.wait_for(guard, period);
+            bool due = options.checkpointSeconds > 0 && std::chrono::steady_clock::now() - last >= period;
+            bool large = options.checkpointBytes != 0 && counters.logBytes > options.checkpointBytes;
+            if (stopping || counters.logBytes == 0 || !(due || large)) {
+                continue;
+            }
+            guard.unlock();
+            try {
+                checkpoint();
+            }
+            catch (const std::exception& e) {
+                std::lock_guard<std::mutex> errorGuard(lock);
+                counters.checkpointError = e.what();
+            }
+            guard.lock();
+            last = std::chrono::steady_clock::now();
+        }
+    }
+
+public:
+    // logPath is created if missing; the checkpoint goes next to it as logPath + ".snapshot"
+    CatalogLog(Catalog& catalog, const std::string& seedPath, const std::string& logPath, LogOptions options = LogOptions())
+        : catalog(catalog), logPath(logPath), snapshotPath(logPath + ".snapshot"), options(options) {
+        open(seedPath);
+        if (options.checkpointBytes != 0 || options.checkpointSeconds > 0) {
+            checkpointer = std::thread([this] { checkpointLoop(); });
+        }
+    }
+
+    ~CatalogLog() {
+        {
+            std::lock_guard<std::mutex> guard(lock);
+            stopping = true;
+        }
+        checkpointWake.notify_one();
+        if (checkpointer.joinable()) {
+            checkpointer.join();
+        }
+        if (file != nullptr) {
+            fclose(file);
+        }
+    }
+
+    CatalogLog(const CatalogLog&) = delete;
+    CatalogLog& operator=(const CatalogLog&) = delete;
+
+    // adds book once it's durable and returns its id
+    BookId addBook(const Book& book) override {
+        Mutation mutation;
+        mutation.kind = Mutation::ADD;
+        mutation.book = book;
+        return submit(mutation);
+    }
+
+    // replaces book id once the change is durable; throws if there's no such book
+    void updateBook(BookId id, const Book& book) override {
+        Mutation mutation;
+        mutation.kind = Mutation::UPDATE;
+        mutation.id = id;
+        mutation.book = book;
+        submit(mutation);
+    }
+
+    // removes book id once the removal is durable; the last book takes over its id
+    void removeBook(BookId id) override {
+        Mutation mutation;
+        mutation.kind = Mutation::REMOVE;
+        mutation.id = id;
+        submit(mutation);
+    }
+
+    // Writes the catalog as of the last commit to the snapshot file and drops the log records
+    // it holds. Writers only wait for the final step, which copies the records they added
+    // while the snapshot was being written.
+    void checkpoint() {
+        std::lock_guard<std::mutex> checkpointGuard(checkpointLock);
+        std::shared_ptr<const CatalogSnapshot> pinned;
+        uint64_t sequence;
+        size_t pinnedBytes;
+        {
+            std::unique_lock<std::mutex> guard(lock);
+            committed.wait(guard, [this] { return !flushing; });
+            pinned = catalog.snapshot();
+            sequence = durableSequence;
+            pinnedBytes = counters.logBytes;
+        }
+
+        std::string temporary = snapshotPath + ".tmp";
+        FILE* out = fopen(temporary.c_str(), "wb");
+        if (out == nullptr) {
+            throw std::runtime_error("Error opening file: " + temporary);
+        }
+        std::string text = "{\"sequence\":" + std::to_string(sequence) + ",\"books\":[";
+        bool written = true;
+        for (size_t i = 0; i < pinned->library.getSize(); ++i) {
+            const Book& book = pinned->library.getItem(i);
+            nlohmann::json bookJson;
+            bookJson["title"] = book.getTitle();
+            bookJson["author"] = book.getAuthor().getName();
+            bookJson["language"] = book.getLanguage();
+            bookJson["link"] = book.getLink();
+            text += i == 0 ? "\n" : ",\n";
+            text += bookJson.dump();
+            if (text.size() >= 1024 * 1024) {
+                written = written && fwrite(text.data(), 1, text.size(), out) == text.size();
+                text.clear();
+            }
+        }
+        text += "\n]}\n";
+        written = written && fwrite(text.data(), 1, text.size(), out) == text.size();
+        written = written && syncFile(out);
+        fclose(out);
+        if (!written) {
+            // a short snapshot must never replace the last good one
+            std::filesystem::remove(temporary);
+            throw std::runtime_error("Error writing file: " + temporary);
+        }
+        std::filesystem::rename(temporary, snapshotPath);
+        std::filesystem::path parent = std::filesystem::path(snapshotPath).parent_path();
+        if (!syncDirectory(parent.empty() ? "." : parent.string())) {
+            // the log isn't trimmed, so its records still cover a snapshot the rename may lose
+            throw std::runtime_error("Error syncing directory of " + snapshotPath);
+        }
+
+        // the snapshot holds everything up to sequence, so the log can start after it
+        std::unique_lock<std::mutex> guard(lock);
+        committed.wait(guard, [this] { return !flushing; });
+        if (!failure.empty()) {
+            return;
+        }
+        std::string tail = readFile(logPath, pinnedBytes);
+        std::string trimmed = logPath + ".tmp";
+        FILE* next = fopen(trimmed.c_str(), "wb");
+        if (next == nullptr) {
+            throw std::runtime_error("Error opening file: " + trimmed);
+        }
+        written = fwrite(tail.data(), 1, tail.size(), next) == tail.size() && syncFile(next);
+        fclose(next);
+        if (!written) {
+            std::filesystem::remove(trimmed);
+            throw std::runtime_error("Error writing file: " + trimmed);
+        }
+        fclose(file);
+        file = nullptr;
+        std::error_code renameError;
+        std::filesystem::rename(trimmed, logPath, renameError);
+        if (renameError) {
+            std::filesystem::remove(trimmed);
+        }
+        // after a failed rename the untrimmed log is still whole, so appends go on to it
+        file = fopen(logPath.c_str(), "ab");
+        if (file == nullptr) {
+            // nothing can be appended from here on; writers see failure rather than the closed file
+            failure = "reopening " + logPath + " failed";
+            committed.notify_all();
+            throw std::runtime_error("Error opening file: " + logPath);
+        }
+        if (renameError) {
+            throw std::runtime_error("Error renaming " + trimmed + ": " + renameError.message());
+        }
+        counters.logBytes = tail.size();
+        counters.checkpoints++;
+        if (!syncDirectory(parent.empty() ? "." : parent.string())) {
+            // a crash may bring back the untrimmed log, which replays on top of the snapshot all the same
+            throw std::runtime_error("Error syncing directory of " + logPath);
+        }
+    }
+
+    LogStats stats() {
+        std::lock_guard<std::mutex> guard(lock);
+        return counters;
+    }
+};
+
+// Applies one mutation line of the query protocol, e.g. {"op":"add","title":...} or
+// {"op":"remove","book":12}, and returns the response line
+inline std::string runMutationLine(CatalogWriter& writer, const Catalog& catalog, const nlohmann::json& request, bool& failed) {
+    nlohmann::json result;
+    if (request.contains("id")) {
+        result["id"] = request["id"];
+    }
+    try {
+        std::string op = request["op"].get<std::string>();
+        if (op == "add") {
+            result["book"] = writer.addBook(Book(request));
+        }
+        else if (op == "update") {
+            BookId id = request["book"].get<BookId>();
+            writer.updateBook(id, Book(request));
+            result["book"] = id;
+        }
+        else if (op == "remove") {
+            BookId id = request["book"].get<BookId>();
+            writer.removeBook(id);
+            result["book"] = id;
+        }
+        else {
+            throw std::runtime_error("Unknown op " + op);
+        }
+        result["version"] = catalog.version();
+        failed = false;
+    }
+    catch (const std::exception& e) {
+        result["error"] = e.what();
+        failed = true;
+    }
+    return result.dump();
+}
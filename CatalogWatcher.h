@@ -0,0 +1,216 @@
+#pragma once
+#include <atomic>
+#include <chrono>
+#include <filesystem>
+#include <functional>
+#include <mutex>
+#include <string>
+#include <thread>
+#include "Catalog.h"
+#include "Library.h"
+#ifdef __linux__
+#include <poll.h>
+#include <sys/eventfd.h>
+#include <sys/inotify.h>
+#include <unistd.h>
+#endif
+
+// Outcome of one catalog reload
+struct ReloadStats {
+    uint64_t version = 0;
+    size_t books = 0;
+    // parsing the file and building the library and its indexes, off the query path
+    double loadSeconds = 0;
+    // how long the new version took to publish; the only part readers could notice
+    double swapSeconds = 0;
+    // set by incremental reloads: books changed against the previous version
+    bool incremental = false;
+    size_t added = 0;
+    size_t removed = 0;
+    size_t updated = 0;
+};
+
+// Watches a catalog file and reloads it in the background when it changes. The new library
+// and its indexes are built on the watcher thread and swapped in as a new catalog version;
+// queries already running finish on the version they pinned. A file that fails to load
+// leaves the current version in place.
+class CatalogWatcher {
+public:
+    using Loader = std::function<Library<Book>(const std::string& path)>;
+    // brings the catalog up to date with the file itself and reports what it did
+    using Reloader = std::function<ReloadStats()>;
+    using ReloadCallback = std::function<void(const ReloadStats& stats)>;
+    using ErrorCallback = std::function<void(const std::string& message)>;
+
+private:
+    // quiet time after the last change before reloading, so a file written in pieces loads once
+    static constexpr int SETTLE_MILLISECONDS = 200;
+    static constexpr int POLL_MILLISECONDS = 500;
+
+    std::string path;
+    Reloader reloader;
+    ReloadCallback onReload;
+    ErrorCallback onError;
+    std::atomic<bool> stopping{ false };
+    std::mutex reloadLock;
+    ReloadStats last;
+    std::thread thread;
+#ifdef __linux__
+    int stopFd = -1;
+    int inotifyFd = -1;
+#endif
+
+    void reloadQuietly() {
+        try {
+            ReloadStats stats = reloadNow();
+            if (onReload) {
+                onReload(stats);
+            }
+        }
+        catch (const std::exception& e) {
+            if (onError) {
+                onError(e.what());
+            }
+        }
+    }
+
+#ifdef __linux__
+    // Watches the catalog's directory, as editors often replace the file by rename; false if
+    // inotify can't. Called before the thread starts so no change after construction is missed.
+    bool watchDirectory() {
+        std::filesystem::path file(path);
+        std::string directory = file.has_parent_path() ? file.parent_path().string() : ".";
+        inotifyFd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+        if (inotifyFd >= 0 && inotify_add_watch(inotifyFd, directory.c_str(), IN_CLOSE_WRITE | IN_MOVED_TO | IN_CREATE) >= 0) {
+            return true;
+        }
+        if (onError) {
+            onError("Cannot watch " + directory + ", falling back to polling");
+        }
+        if (inotifyFd >= 0) {
+            close(inotifyFd);
+            inotifyFd = -1;
+        }
+        return false;
+    }
+
+    // waits on inotify for changes to the catalog file
+    void watchLoop() {
+        std::string name = std::filesystem::path(path).filename().string();
+
+        bool changed = false;
+        while (!stopping) {
+            pollfd fds[2] = { { inotifyFd, POLLIN, 0 }, { stopFd, POLLIN, 0 } };
+            int ready = poll(fds, 2, changed ? SETTLE_MILLISECONDS : -1);
+            if (ready < 0) {
+                continue;
+            }
+            if (fds[1].revents & POLLIN) {
+                break;
+            }
+            if (ready == 0) {
+                changed = false;
+                reloadQuietly();
+                continue;
+            }
+            alignas(inotify_event) char buffer[4096];
+            ssize_t n;
+            while ((n = read(inotifyFd, buffer, sizeof(buffer))) > 0) {
+                for (char* p = buffer; p < buffer + n;) {
+                    inotify_event* event = reinterpret_cast<inotify_event*>(p);
+                    if (event->len > 0 && name == event->name) {
+                        changed = true;
+                    }
+                    p += sizeof(inotify_event) + event->len;
+                }
+            }
+        }
+    }
+#endif
+
+    // portable fallback: compares the file's modification time to seen every POLL_MILLISECONDS
+    void pollLoop(std::filesystem::file_time_type seen) {
+        std::error_code error;
+        while (!stopping) {
+            std::this_thread::sleep_for(std::chrono::milliseconds(POLL_MILLISECONDS));
+            auto now = std::filesystem::last_write_time(path, error);
+            if (!error && now != seen) {
+                std::this_thread::sleep_for(std::chrono::milliseconds(SETTLE_MILLISECONDS));
+                seen = std::filesystem::last_write_time(path, error);
+                reloadQuietly();
+            }
+        }
+    }
+
+    void start() {
+        std::error_code error;
+        auto seen = std::filesystem::last_write_time(path, error);
+#ifdef __linux__
+        stopFd = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+        if (watchDirectory()) {
+            thread = std::thread([this] { watchLoop(); });
+        }
+        else {
+            thread = std::thread([this, seen] { pollLoop(seen); });
+        }
+#else
+        thread = std::thread([this, seen] { pollLoop(seen); });
+#endif
+    }
+
+public:
+    // reloads by loading the whole file and replacing the catalog with it
+    CatalogWatcher(Catalog& catalog, const std::string& path, Loader loader, ReloadCallback onReload = nullptr,
+        ErrorCallback onError = nullptr)
+        : path(path), onReload(std::move(onReload)), onError(std::move(onError)) {
+        reloader = [&catalog, path, loader] {
+            auto started = std::chrono::steady_clock::now();
+            Library<Book> library = loader(path);
+            ReloadStats stats;
+            stats.books = library.getSize();
+            stats.version = catalog.replace(library, &stats.swapSeconds);
+            stats.loadSeconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - started).count() - stats.swapSeconds;
+            return stats;
+        };
+        start();
+    }
+
+    // reloads through reloader, e.g. one that applies only what changed in the file
+    CatalogWatcher(const std::string& path, Reloader reloader, ReloadCallback onReload = nullptr, ErrorCallback onError = nullptr)
+        : path(path), reloader(std::move(reloader)), onReload(std::move(onReload)), onError(std::move(onError)) {
+        start();
+    }
+
+    ~CatalogWatcher() {
+        stopping = true;
+#ifdef __linux__
+        uint64_t one = 1;
+        ssize_t ignored = write(stopFd, &one, sizeof(one));
+        (void)ignored;
+#endif
+        thread.join();
+#ifdef __linux__
+        close(stopFd);
+        if (inotifyFd >= 0) {
+            close(inotifyFd);
+        }
+#endif
+    }
+
+    CatalogWatcher(const CatalogWatcher&) = delete;
+    CatalogWatcher& operator=(const CatalogWatcher&) = delete;
+
+    // Loads the file and swaps it in right away. Throws if the file can't be loaded.
+    ReloadStats reloadNow() {
+        std::lock_guard<std::mutex> guard(reloadLock);
+        ReloadStats stats = reloader();
+        last = stats;
+        return stats;
+    }
+
+    // the most recent successful reload, all zero before the first one
+    ReloadStats lastReload() {
+        std::lock_guard<std::mutex> guard(reloadLock);
+        return last;
+    }
+};
@@ -0,0 +1,297 @@
+#pragma once
+#include <algorithm>
+#include <atomic>
+#include <cctype>
+#include <cstring>
+#include <memory>
+#include <string>
+#include <string_view>
+#include <vector>
+#include "Library.h"
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif
+#define BOOKS_HAVE_SSE2 1
+#endif
+
+// Books per title chunk, one chunk is one parallel morsel
+const size_t COLUMN_CHUNK_SIZE = MORSEL_SIZE;
+
+// Titles of up to COLUMN_CHUNK_SIZE consecutive books, back to back in one buffer and each
+// followed by a '\0' so a match can never run from one title into the next. Like a Library
+// chunk, copies of the store append to it in place past what the others see, so its buffers
+// never grow once made; claimed counts the titles any copy has put in.
+struct TitleChunk {
+    std::string titles;
+    // offsets[i] is where the chunk's i-th title starts, offsets[size] the end of the last title
+    std::vector<uint32_t> offsets{ 0 };
+    std::atomic<size_t> claimed{ 0 };
+
+    TitleChunk(size_t titleBytes, size_t count) {
+        titles.reserve(titleBytes);
+        offsets.reserve(count + 1);
+    }
+
+    // the first count titles of other, with room for titleBytes and capacity titles
+    TitleChunk(const TitleChunk& other, size_t count, size_t titleBytes, size_t capacity) : claimed(count) {
+        titles.reserve(std::max<size_t>(titleBytes, other.offsets[count]));
+        titles.append(other.titles.data(), other.offsets[count]);
+        offsets.reserve(capacity + 1);
+        offsets.assign(other.offsets.begin(), other.offsets.begin() + count + 1);
+    }
+
+    // maps a byte offset in the buffer back to the title that owns it, among the first count
+    size_t titleAt(size_t offset, size_t count) const {
+        auto it = std::upper_bound(offsets.begin(), offsets.begin() + count + 1, static_cast<uint32_t>(offset));
+        return static_cast<size_t>(it - offsets.begin() - 1);
+    }
+};
+
+// Columnar copy of the title field. Chunks are shared between copies and each copy keeps its
+// own length, so copying a store for a new catalog version and appending to it costs only the
+// new titles; rebuilding a chunk is left to refresh().
+class ColumnStore {
+private:
+    std::vector<std::shared_ptr<TitleChunk>> chunks;
+    size_t count = 0;
+
+    // titles of chunk index this store sees
+    size_t fillOf(size_t index) const {
+        return std::min(COLUMN_CHUNK_SIZE, count - index * COLUMN_CHUNK_SIZE);
+    }
+
+public:
+    // Builds the columns from every book in the library, in library order
+    static ColumnStore build(const Library<Book>& library) {
+        TraceSpan span("index.titles");
+        ColumnStore store;
+        for (size_t i = 0; i < library.getSize(); ++i) {
+            store.append(library.getItem(i));
+        }
+        return store;
+    }
+
+    // adds one book to the end of the columns
+    void append(const Book& book) {
+        const std::string& title = book.getTitle();
+        size_t fill = count % COLUMN_CHUNK_SIZE;
+        if (fill == 0) {
+            chunks.push_back(std::make_shared<TitleChunk>(16 * (title.size() + 1), 16));
+        }
+        TitleChunk& tail = *chunks.back();
+        size_t used = tail.offsets[fill];
+        size_t expected = fill;
+        // in place only while no other copy appended past this one and both buffers have room
+        bool room = used + title.size() + 1 <= tail.titles.capacity() && fill + 1 < tail.offsets.capacity();
+        if (!(room && tail.claimed.compare_exchange_strong(expected, fill + 1))) {
+            // the buffers double as they fill up, so appends stay amortized O(1)
+            size_t capacity = std::min(COLUMN_CHUNK_SIZE, std::max<size_t>(16, 2 * (fill + 1)));
+            auto grown = std::make_shared<TitleChunk>(tail, fill, 2 * (used + title.size() + 1), capacity);
+            grown->claimed = fill + 1;
+            chunks.back() = std::move(grown);
+        }
+        TitleChunk& target = *chunks.back();
+        target.titles += title;
+        target.titles.push_back('\0');
+        target.offsets.push_back(static_cast<uint32_t>(target.titles.size()));
+        ++count;
+    }
+
+    // Brings the columns back in line with library after books were replaced or removed in
+    // place: the listed chunks are rebuilt, books past the end dropped and new books appended.
+    // A removal dirties the chunk of the removed book and the chunk the last book left.
+    void refresh(const Library<Book>& library, const std::vector<size_t>& dirtyChunks) {
+        // dropped titles stay in their chunk, unseen; the next append copies what's left of it
+        count = std::min(count, library.getSize());
+        chunks.resize((count + COLUMN_CHUNK_SIZE - 1) / COLUMN_CHUNK_SIZE);
+        for (size_t index : dirtyChunks) {
+            if (index >= chunks.size()) {
+                continue;
+            }
+            size_t begin = index * COLUMN_CHUNK_SIZE;
+            size_t end = begin + fillOf(index);
+            size_t titleBytes = 0;
+            for (size_t i = begin; i < end; ++i) {
+                titleBytes += library.getItem(i).getTitle().size() + 1;
+            }
+            auto chunk = std::make_shared<TitleChunk>(titleBytes, end - begin);
+            for (size_t i = begin; i < end; ++i) {
+                chunk->titles += library.getItem(i).getTitle();
+                chunk->titles.push_back('\0');
+                chunk->offsets.push_back(static_cast<uint32_t>(chunk->titles.size()));
+            }
+            chunk->claimed = end - begin;
+            chunks[index] = chunk;
+        }
+        for (size_t i = count; i < library.getSize(); ++i) {
+            append(library.getItem(i));
+        }
+    }
+
+    // returns the title of a book without the terminator
+    std::string_view title(BookId id) const {
+        const TitleChunk& c = chunk(id / COLUMN_CHUNK_SIZE);
+        size_t i = id % COLUMN_CHUNK_SIZE;
+        return std::string_view(c.titles.data() + c.offsets[i], c.offsets[i + 1] - c.offsets[i] - 1);
+    }
+
+    const TitleChunk& chunk(size_t index) const {
+        return *chunks[index];
+    }
+
+    size_t size() const {
+        return count;
+    }
+
+    // bytes the title buffers and their offsets take, shared chunks included
+    size_t bytes() const {
+        size_t total = vectorBytes(chunks);
+        for (const auto& c : chunks) {
+            total += sizeof(TitleChunk) + stringHeapBytes(c->titles) + vectorBytes(c->offsets);
+        }
+        return total;
+    }
+};
+
+namespace detail {
+    inline char foldAscii(char c) {
+        return (c >= 'A' && c <= 'Z') ? static_cast<char>(c | 0x20) : c;
+    }
+
+    // compares n bytes, optionally ignoring ASCII case
+    inline bool bytesEqual(const char* a, const char* b, size_t n, bool ignoreCase) {
+        if (!ignoreCase) {
+            return memcmp(a, b, n) == 0;
+        }
+        for (size_t i = 0; i < n; ++i) {
+            if (foldAscii(a[i]) != b[i]) {
+                return false;
+            }
+        }
+        return true;
+    }
+
+    // index of the lowest set bit, mask must not be zero
+    inline unsigned lowestBit(unsigned mask) {
+#ifdef _MSC_VER
+        unsigned long index;
+        _BitScanForward(&index, mask);
+        return static_cast<unsigned>(index);
+#else
+        return static_cast<unsigned>(__builtin_ctz(mask));
+#endif
+    }
+
+    // Scalar fallback, also used for the tail of the buffer the SIMD loop can't cover
+    inline size_t findScalar(const char* hay, size_t from, size_t to, std::string_view needle, bool ignoreCase) {
+        const size_t k = needle.size();
+        for (size_t i = from; i + k <= to; ++i) {
+            char c = ignoreCase ? foldAscii(hay[i]) : hay[i];
+            if (c == needle[0] && bytesEqual(hay + i, needle.data(), k, ignoreCase)) {
+                return i;
+            }
+        }
+        return std::string::npos;
+    }
+}
+
+namespace detail {
+    // Appends the titles in [from, to) of one chunk that contain pattern. pattern is non-empty
+    // and already folded to lower case when ignoreCase is set.
+    inline void searchTitleChunk(const TitleChunk& chunk, BookId base, const std::string& pattern, bool ignoreCase,
+        size_t from, size_t to, std::vector<BookId>& result) {
+        const char* hay = chunk.titles.data();
+        const size_t n = chunk.offsets[to];
+        const size_t k = pattern.size();
+        size_t i = chunk.offsets[from];
+
+        // records a hit at offset pos and skips the rest of that title
+        auto hit = [&](size_t pos) {
+            size_t local = chunk.titleAt(pos, to);
+            result.push_back(static_cast<BookId>(base + local));
+            i = chunk.offsets[local + 1];
+        };
+
+#ifdef BOOKS_HAVE_SSE2
+        // Generic SIMD strstr: compare the first and last needle bytes against 16 candidate
+        // positions at once and only run the full compare where both agree.
+        // OR-ing 0x20 into both sides lowers ASCII letters; the non-letters it aliases are caught by the full compare
+        const char foldBit = ignoreCase ? 0x20 : 0;
+        const __m128i fold = _mm_set1_epi8(foldBit);
+        const __m128i first = _mm_set1_epi8(static_cast<char>(pattern[0] | foldBit));
+        const __m128i last = _mm_set1_epi8(static_cast<char>(pattern[k - 1] | foldBit));
+        while (i + k - 1 + 16 <= n) {
+            __m128i blockFirst = _mm_or_si128(_mm_loadu_si128(reinterpret_cast<const __m128i*>(hay + i)), fold);
+            __m128i blockLast = _mm_or_si128(_mm_loadu_si128(reinterpret_cast<const __m128i*>(hay + i + k - 1)), fold);
+            unsigned mask = static_cast<unsigned>(_mm_movemask_epi8(
+                _mm_and_si128(_mm_cmpeq_epi8(first, blockFirst), _mm_cmpeq_epi8(last, blockLast))));
+            size_t blockStart = i;
+            bool matched = false;
+            while (mask != 0) {
+                size_t pos = blockStart + detail::lowestBit(mask);
+                if (detail::bytesEqual(hay + pos, pattern.data(), k, ignoreCase)) {
+                    hit(pos);
+                    matched = true;
+                    break;
+                }
+                mask &= mask - 1;
+            }
+            if (!matched) {
+                i = blockStart + 16;
+            }
+        }
+#endif
+
+        while (i < n) {
+            size_t pos = detail::findScalar(hay, i, n, pattern, ignoreCase);
+            if (pos == std::string::npos) {
+                break;
+            }
+            hit(pos);
+        }
+    }
+
+    // Appends the books in [from, to) whose title contains pattern, chunk by chunk
+    inline void searchTitleRange(const ColumnStore& store, const std::string& pattern, bool ignoreCase,
+        size_t from, size_t to, std::vector<BookId>& result) {
+        while (from < to) {
+            size_t index = from / COLUMN_CHUNK_SIZE;
+            size_t base = index * COLUMN_CHUNK_SIZE;
+            size_t stop = std::min(to, base + COLUMN_CHUNK_SIZE);
+            searchTitleChunk(store.chunk(index), static_cast<BookId>(base), pattern, ignoreCase, from - base, stop - base, result);
+            from = stop;
+        }
+    }
+}
+
+// Finds every book whose title contains needle. Results are in BookId order and each
+// book appears once. With ignoreCase set, ASCII letters match regardless of case.
+inline std::vector<BookId> searchTitleContains(const ColumnStore& store, std::string_view needle, bool ignoreCase = false,
+    ExecutionPolicy policy = ExecutionPolicy::serial()) {
+    TraceSpan span("search.title");
+    std::vector<BookId> result;
+    if (needle.empty()) {
+        result.reserve(store.size());
+        for (size_t i = 0; i < store.size(); ++i) {
+            result.push_back(static_cast<BookId>(i));
+        }
+        return result;
+    }
+
+    std::string pattern(needle);
+    if (ignoreCase) {
+        std::transform(pattern.begin(), pattern.end(), pattern.begin(), detail::foldAscii);
+    }
+
+    std::vector<std::vector<BookId>> parts(policy.morselCount(store.size()));
+    policy.forEachMorsel(store.size(), [&](size_t morsel, size_t begin, size_t end) {
+        detail::searchTitleRange(store, pattern, ignoreCase, begin, end, parts[morsel]);
+    });
+    for (const auto& part : parts) {
+        result.insert(result.end(), part.begin(), part.end());
+    }
+    return result;
+}
@@ -0,0 +1,262 @@
+#pragma once
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <cstring>
+#include <fstream>
+#include <mutex>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <unordered_map>
+#include <vector>
+#include "Catalog.h"
+#include "CatalogWatcher.h"
+#include "Library.h"
+#include "json.hpp"
+
+// One book object of the catalog file: where its bytes are and what they hash to
+struct RecordSpan {
+    size_t offset = 0;
+    size_t length = 0;
+    uint64_t hash = 0;
+};
+
+// 64-bit hash of a record's bytes, eight bytes per step
+inline uint64_t hashBytes(const char* data, size_t size) {
+    uint64_t h = 0x9E3779B97F4A7C15ull ^ size;
+    size_t i = 0;
+    for (; i + 8 <= size; i += 8) {
+        uint64_t word;
+        memcpy(&word, data + i, 8);
+        h = (h ^ word) * 0xFF51AFD7ED558CCDull;
+        h ^= h >> 32;
+    }
+    uint64_t tail = 0;
+    memcpy(&tail, data + i, size - i);
+    h = (h ^ tail) * 0xC4CEB9FE1A85EC53ull;
+    return h ^ (h >> 29);
+}
+
+// Splits a JSON array of objects into its top-level objects without parsing them.
+// Only string quoting and brace depth are tracked; the objects themselves are checked
+// when they're parsed.
+inline std::vector<RecordSpan> scanRecords(const std::string& text) {
+    std::vector<RecordSpan> records;
+    size_t i = 0;
+    auto skipSpace = [&] {
+        while (i < text.size() && (text[i] == ' ' || text[i] == '\t' || text[i] == '\r' || text[i] == '\n')) {
+            ++i;
+        }
+    };
+    auto malformed = [&](const char* what) {
+        return std::runtime_error(std::string("Malformed catalog: ") + what + " at byte " + std::to_string(i));
+    };
+
+    skipSpace();
+    if (i == text.size() || text[i] != '[') {
+        throw malformed("expected an array");
+    }
+    ++i;
+    skipSpace();
+    if (i < text.size() && text[i] == ']') {
+        return records;
+    }
+    while (true) {
+        skipSpace();
+        if (i == text.size() || text[i] != '{') {
+            throw malformed("expected an object");
+        }
+        size_t start = i;
+        int depth = 0;
+        bool inString = false;
+        for (; i < text.size(); ++i) {
+            char c = text[i];
+            if (inString) {
+                if (c == '\\') {
+                    ++i;
+                }
+                else if (c == '"') {
+                    inString = false;
+                }
+            }
+            else if (c == '"') {
+                inString = true;
+            }
+            else if (c == '{' || c == '[') {
+                ++depth;
+            }
+            else if ((c == '}' || c == ']') && --depth == 0) {
+                break;
+            }
+        }
+        if (i >= text.size()) {
+            throw malformed("unterminated object");
+        }
+        ++i;
+        records.push_back(RecordSpan{ start, i - start, hashBytes(text.data() + start, i - start) });
+        skipSpace();
+        if (i < text.size() && text[i] == ',') {
+            ++i;
+        }
+        else if (i < text.size() && text[i] == ']') {
+            return records;
+        }
+        else {
+            throw malformed("expected , or ]");
+        }
+    }
+}
+
+// Keeps a catalog in step with its JSON file by applying only what changed. Every book is
+// fingerprinted by the hash of its record's bytes: records whose hash is still in the file
+// are left alone, and only the new records are parsed. A new record whose title and author
+// match a vanished one updates that book in place; the others are added, and the remaining
+// vanished books removed. Only storage and index chunks holding changed books are copied.
+// Removing a book moves the last book into its id, so ids stay dense.
+class DiffLoader {
+private:
+    Catalog& catalog;
+    std::string path;
+    std::mutex lock;
+    // record hash of every book of the catalog, by BookId
+    std::vector<uint64_t> fingerprints;
+
+    static std::string readFile(const std::string& filename) {
+        std::ifstream inFile(filename, std::ios::binary);
+        if (!inFile) {
+            throw std::runtime_error("Error opening file: " + filename);
+        }
+        std::ostringstream contents;
+        contents << inFile.rdbuf();
+        return contents.str();
+    }
+
+public:
+    DiffLoader(Catalog& catalog, const std::string& path) : catalog(catalog), path(path) {}
+
+    DiffLoader(const DiffLoader&) = delete;
+    DiffLoader& operator=(const DiffLoader&) = delete;
+
+    const std::string& filePath() const {
+        return path;
+    }
+
+    // Reads the file and publishes its differences as one new version, or none if there are
+    // none. The first call loads everything. Books the catalog got some other way, e.g.
+    // Catalog::addItem, aren't in the file and are treated as changed. Throws, leaving the
+    // catalog alone, if the file is bad.
+    ReloadStats reload() {
+        std::lock_guard<std::mutex> guard(lock);
+        TraceSpan span("load");
+        auto started = std::chrono::steady_clock::now();
+        std::string text;
+        {
+            TraceSpan read("load.read");
+            text = readFile(path);
+        }
+        MemoryAccounts::shared().notePeak("load.text", stringHeapBytes(text));
+        std::vector<RecordSpan> records;
+        {
+            TraceSpan scan("load.scan");
+            records = scanRecords(text);
+        }
+        // records sharing a hash are chained through sameHash, first record first
+        const size_t NONE = SIZE_MAX;
+        std::unordered_map<uint64_t, size_t> recordsByHash;
+        recordsByHash.reserve(records.size());
+        std::vector<size_t> sameHash(records.size(), NONE);
+        for (size_t r = records.size(); r-- > 0;) {
+            auto inserted = recordsByHash.emplace(records[r].hash, r);
+            if (!inserted.second) {
+                sameHash[r] = inserted.first->second;
+                inserted.first->second = r;
+            }
+        }
+
+        ReloadStats stats;
+        stats.incremental = true;
+        std::vector<uint64_t> nextFingerprints;
+        stats.version = catalog.modify([&](CatalogSnapshot& next) {
+            TraceSpan apply("load.apply");
+            Library<Book>& library = next.library;
+            nextFingerprints = fingerprints;
+            nextFingerprints.resize(library.getSize(), 0);
+
+            // match unchanged books to their records; what's left over on either side changed
+            std::vector<BookId> vanished;
+            for (size_t id = 0; id < library.getSize(); ++id) {
+                auto it = recordsByHash.find(nextFingerprints[id]);
+                if (it == recordsByHash.end() || it->second == NONE) {
+                    vanished.push_back(static_cast<BookId>(id));
+                }
+                else {
+                    it->second = sameHash[it->second];
+                }
+            }
+            std::vector<size_t> fresh;
+            for (const auto& entry : recordsByHash) {
+                for (size_t r = entry.second; r != NONE; r = sameHash[r]) {
+                    fresh.push_back(r);
+                }
+            }
+            // new books are appended in file order
+            std::sort(fresh.begin(), fresh.end());
+
+            std::unordered_map<std::string, std::vector<BookId>> vanishedByKey;
+            for (BookId id : vanished) {
+                vanishedByKey[bookKey(library.getItem(id))].push_back(id);
+            }
+            std::vector<size_t> dirtyChunks;
+            std::vector<std::pair<const RecordSpan*, Book>> additions;
+            for (size_t r : fresh) {
+                const RecordSpan& record = records[r];
+                const char* begin = text.data() + record.offset;
+                Book book(nlohmann::json::parse(begin, begin + record.length));
+                auto it = vanishedByKey.find(bookKey(book));
+                if (it != vanishedByKey.end() && !it->second.empty()) {
+                    BookId id = it->second.back();
+                    it->second.pop_back();
+                    library.setItem(id, book);
+                    nextFingerprints[id] = record.hash;
+                    dirtyChunks.push_back(id / LIBRARY_CHUNK_SIZE);
+                    ++stats.updated;
+                }
+                else {
+                    additions.emplace_back(&record, std::move(book));
+                }
+            }
+
+            // highest ids first, so the book moved into a freed id is never one still to remove
+            std::vector<BookId> removals;
+            for (const auto& entry : vanishedByKey) {
+                removals.insert(removals.end(), entry.second.begin(), entry.second.end());
+            }
+            std::sort(removals.rbegin(), removals.rend());
+            for (BookId id : removals) {
+                dirtyChunks.push_back((library.getSize() - 1) / LIBRARY_CHUNK_SIZE);
+                library.swapRemove(id);
+                nextFingerprints[id] = nextFingerprints.back();
+                nextFingerprints.pop_back();
+                dirtyChunks.push_back(id / LIBRARY_CHUNK_SIZE);
+            }
+            stats.removed = removals.size();
+
+            for (const auto& addition : additions) {
+                library.addItem(addition.second);
+                nextFingerprints.push_back(addition.first->hash);
+            }
+            stats.added = additions.size();
+
+            std::sort(dirtyChunks.begin(), dirtyChunks.end());
+            dirtyChunks.erase(std::unique(dirtyChunks.begin(), dirtyChunks.end()), dirtyChunks.end());
+            next.titles.refresh(library, dirtyChunks);
+            stats.books = library.getSize();
+            return stats.added + stats.removed + stats.updated > 0;
+        }, &stats.swapSeconds);
+        fingerprints = std::move(nextFingerprints);
+        countBooksLoaded(stats.added + stats.updated);
+        stats.loadSeconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - started).count() - stats.swapSeconds;
+        return stats;
+    }
+};
@@ -0,0 +1,120 @@
+#pragma once
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <filesystem>
+#include <stdexcept>
+#include <string>
+#include <system_error>
+#include <vector>
+#include "Platform.h"
+
+// CRC-32 (IEEE) of a log record's payload
+inline uint32_t crc32(const char* data, size_t size) {
+    static const auto table = [] {
+        std::vector<uint32_t> entries(256);
+        for (uint32_t i = 0; i < 256; ++i) {
+            uint32_t c = i;
+            for (int k = 0; k < 8; ++k) {
+                c = (c & 1) ? 0xEDB88320u ^ (c >> 1) : c >> 1;
+            }
+            entries[i] = c;
+        }
+        return entries;
+    }();
+    uint32_t c = 0xFFFFFFFFu;
+    for (size_t i = 0; i < size; ++i) {
+        c = table[(c ^ static_cast<uint8_t>(data[i])) & 0xFF] ^ (c >> 8);
+    }
+    return c ^ 0xFFFFFFFFu;
+}
+
+// appends value as a little-endian uint32
+inline void putU32(std::string& out, uint32_t value) {
+    char bytes[4];
+    memcpy(bytes, &value, 4);
+    out.append(bytes, 4);
+}
+
+// appends value prefixed by its uint32 length
+inline void putString(std::string& out, const std::string& value) {
+    putU32(out, static_cast<uint32_t>(value.size()));
+    out += value;
+}
+
+// Reads a length-prefixed string at p, moving p past it; false if it runs past end
+inline bool getString(const char*& p, const char* end, std::string& value) {
+    uint32_t size;
+    if (end - p < 4) {
+        return false;
+    }
+    memcpy(&size, p, 4);
+    p += 4;
+    if (static_cast<size_t>(end - p) < size) {
+        return false;
+    }
+    value.assign(p, size);
+    p += size;
+    return true;
+}
+
+// Frames payload as a record of the on-disk formats: payload length and CRC-32 as
+// little-endian uint32, then the payload
+inline void appendRecord(std::string& out, const std::string& payload) {
+    putU32(out, static_cast<uint32_t>(payload.size()));
+    putU32(out, crc32(payload.data(), payload.size()));
+    out += payload;
+}
+
+// Unframes the record at offset of data; returns its size, or 0 if it's torn or corrupt
+inline size_t readRecord(const std::string& data, size_t offset, std::string& payload) {
+    if (data.size() - offset < 8) {
+        return 0;
+    }
+    uint32_t length, checksum;
+    memcpy(&length, data.data() + offset, 4);
+    memcpy(&checksum, data.data() + offset + 4, 4);
+    if (data.size() - offset - 8 < length || crc32(data.data() + offset + 8, length) != checksum) {
+        return 0;
+    }
+    payload.assign(data.data() + offset + 8, length);
+    return 8 + length;
+}
+
+// Appends data to file, open for appending at path with goodBytes of whole records, and
+// fsyncs it. A failed write may leave part of data behind, so the file is cut back to
+// goodBytes and reopened, and writing data again doesn't tear a record mid-file. Returns
+// false if the write failed; file is null then if it couldn't be cut back and reopened.
+inline bool appendDurably(FILE*& file, const std::string& path, size_t goodBytes, const std::string& data) {
+    if (fwrite(data.data(), 1, data.size(), file) == data.size() && syncFile(file)) {
+        return true;
+    }
+    fclose(file);
+    file = nullptr;
+    std::error_code error;
+    std::filesystem::resize_file(path, goodBytes, error);
+    if (!error) {
+        file = fopen(path.c_str(), "ab");
+    }
+    return false;
+}
+
+// Replaces path with text so that readers and crashes see either the old file or the new one
+inline void writeFileAtomically(const std::string& path, const std::string& text) {
+    std::string temporary = path + ".tmp";
+    FILE* out = fopen(temporary.c_str(), "wb");
+    if (out == nullptr) {
+        throw std::runtime_error("Error opening file: " + temporary);
+    }
+    bool written = fwrite(text.data(), 1, text.size(), out) == text.size() && syncFile(out);
+    fclose(out);
+    if (!written) {
+        std::filesystem::remove(temporary);
+        throw std::runtime_error("Error writing file: " + temporary);
+    }
+    std::filesystem::rename(temporary, path);
+    std::filesystem::path parent = std::filesystem::path(path).parent_path();
+    if (!syncDirectory(parent.empty() ? "." : parent.string())) {
+        throw std::runtime_error("Error syncing directory of " + path);
+    }
+}
@@ -0,0 +1,445 @@
+#pragma once
+#ifndef _WIN32
+#include <arpa/inet.h>
+#include <fcntl.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+#include <sys/un.h>
+#include <unistd.h>
+#include <cerrno>
+#include <cstring>
+#include <deque>
+#include <exception>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+// Bytes waiting to be written to a socket. A piece is either an owned copy or a reference to
+// memory kept alive by its owner pointer, so large bodies go out through writev without copying.
+class OutputQueue {
+private:
+    struct Piece {
+        std::string owned;
+        const char* data = nullptr;
+        size_t size = 0;
+        std::shared_ptr<const void> owner;
+
+        const char* begin() const {
+            return data != nullptr ? data : owned.data();
+        }
+    };
+
+    // small owned pieces are appended to the previous one instead of becoming a new iovec
+    static constexpr size_t COALESCE_LIMIT = 4096;
+    static constexpr int MAX_IOVECS = 64;
+
+    std::deque<Piece> pieces;
+    size_t headOffset = 0;
+    size_t bytes = 0;
+
+public:
+    // queues a copy of text
+    void append(const char* text, size_t size) {
+        if (size == 0) {
+            return;
+        }
+        if (!pieces.empty() && pieces.back().data == nullptr && pieces.back().owned.size() + size <= COALESCE_LIMIT) {
+            pieces.back().owned.append(text, size);
+            pieces.back().size += size;
+        }
+        else {
+            Piece piece;
+            piece.owned.assign(text, size);
+            piece.size = size;
+            pieces.push_back(std::move(piece));
+        }
+        bytes += size;
+    }
+
+    void append(const std::string& text) {
+        append(text.data(), text.size());
+    }
+
+    // queues size bytes at data without copying them; owner keeps them alive until written
+    void appendRef(const char* data, size_t size, std::shared_ptr<const void> owner) {
+        if (size == 0) {
+            return;
+        }
+        Piece piece;
+        piece.data = data;
+        piece.size = size;
+        piece.owner = std::move(owner);
+        pieces.push_back(std::move(piece));
+        bytes += size;
+    }
+
+    bool empty() const {
+        return bytes == 0;
+    }
+
+    size_t size() const {
+        return bytes;
+    }
+
+    // Writes as much as the socket takes. Returns false on a socket error.
+    bool flush(int fd) {
+        while (bytes > 0) {
+            iovec iov[MAX_IOVECS];
+            int count = 0;
+            for (size_t i = 0; i < pieces.size() && count < MAX_IOVECS; ++i) {
+                size_t skip = i == 0 ? headOffset : 0;
+                iov[count].iov_base = const_cast<char*>(pieces[i].begin() + skip);
+                iov[count].iov_len = pieces[i].size - skip;
+                ++count;
+            }
+            msghdr message{};
+            message.msg_iov = iov;
+            message.msg_iovlen = count;
+            ssize_t written = sendmsg(fd, &message, MSG_NOSIGNAL);
+            if (written < 0) {
+                if (errno == EINTR) {
+                    continue;
+                }
+                return errno == EAGAIN || errno == EWOULDBLOCK;
+            }
+            consume(static_cast<size_t>(written));
+        }
+        return true;
+    }
+
+    // drops the first n queued bytes
+    void consume(size_t n) {
+        bytes -= n;
+        while (n > 0) {
+            size_t left = pieces.front().size - headOffset;
+            if (n < left) {
+                headOffset += n;
+                return;
+            }
+            n -= left;
+            pieces.pop_front();
+            headOffset = 0;
+        }
+    }
+};
+
+// One client connection, owned by the event loop that accepted it
+struct Connection {
+    int fd = -1;
+    bool listener = false;
+    bool tcp = false;
+    // bytes received and not yet consumed by the protocol handler
+    std::string in;
+    OutputQueue out;
+    // set by the handler or on EOF; the connection closes once out is drained
+    bool closing = false;
+    uint32_t events = 0;
+};
+
+// Multi-threaded epoll server. Every worker runs its own event loop and accepts from the
+// shared listening sockets (EPOLLEXCLUSIVE), so a connection lives on one thread and its
+// pipelined requests are answered in order without any cross-thread hand-off.
+class EventServer {
+public:
+    // Consumes as many complete requests from conn.in as are available, queues their
+    // responses on conn.out and returns the number of bytes used.
+    using Handler = std::function<size_t(Connection& conn)>;
+
+private:
+    static constexpr size_t READ_CHUNK = 64 * 1024;
+    // stop reading from a connection while this much output is queued for it
+    static constexpr size_t OUTPUT_HIGH_WATER = 4 * 1024 * 1024;
+    // a request larger than this without being complete closes the connection
+    static constexpr size_t MAX_REQUEST_BYTES = 1024 * 1024;
+
+    Handler handler;
+    size_t workerCount;
+    std::vector<Connection> listeners;
+    std::vector<std::string> unixPaths;
+    int stopFd = -1;
+    Connection stopTag;
+    // the first failure of a worker, which stops the others and is rethrown by run()
+    std::mutex errorLock;
+    std::exception_ptr error;
+
+    static std::runtime_error socketError(const std::string& what) {
+        return std::runtime_error(what + ": " + strerror(errno));
+    }
+
+    void addListener(int fd, bool tcp) {
+        if (listen(fd, SOMAXCONN) != 0) {
+            close(fd);
+            throw socketError("listen");
+        }
+        Connection listener;
+        listener.fd = fd;
+        listener.listener = true;
+        listener.tcp = tcp;
+        listeners.push_back(std::move(listener));
+    }
+
+    void updateInterest(int epfd, Connection& conn) {
+        uint32_t wanted = EPOLLRDHUP;
+        if (!conn.closing && conn.out.size() < OUTPUT_HIGH_WATER) {
+            wanted |= EPOLLIN;
+        }
+        if (!conn.out.empty()) {
+            wanted |= EPOLLOUT;
+        }
+        if (wanted != conn.events) {
+            epoll_event ev{};
+            ev.events = wanted;
+            ev.data.ptr = &conn;
+            epoll_ctl(epfd, EPOLL_CTL_MOD, conn.fd, &ev);
+            conn.events = wanted;
+        }
+    }
+
+    // reads what the socket has, runs the handler and returns false once the connection is done
+    bool service(int epfd, Connection& conn, uint32_t events) {
+        if (events & (EPOLLIN | EPOLLRDHUP | EPOLLHUP)) {
+            char buffer[READ_CHUNK];
+            while (!conn.closing) {
+                ssize_t n = recv(conn.fd, buffer, sizeof(buffer), 0);
+                if (n > 0) {
+                    conn.in.append(buffer, static_cast<size_t>(n));
+                    // the rest waits in the socket until the handler has consumed what's here
+                    if (static_cast<size_t>(n) < sizeof(buffer) || conn.in.size() > MAX_REQUEST_BYTES) {
+                        break;
+                    }
+                }
+                else if (n == 0) {
+                    conn.closing = true;
+                }
+                else if (errno == EINTR) {
+                    continue;
+                }
+                else if (errno == EAGAIN || errno == EWOULDBLOCK) {
+                    break;
+                }
+                else {
+                    return false;
+                }
+            }
+            if (!conn.in.empty()) {
+                size_t used = handler(conn);
+                conn.in.erase(0, used);
+                if (conn.in.size() > MAX_REQUEST_BYTES) {
+                    return false;
+                }
+            }
+        }
+        if (events & EPOLLERR) {
+            return false;
+        }
+        if (!conn.out.flush(conn.fd)) {
+            return false;
+        }
+        if (conn.closing && conn.out.empty()) {
+            return false;
+        }
+        updateInterest(epfd, conn);
+        return true;
+    }
+
+    void acceptAll(int epfd, const Connection& listener, std::unordered_map<int, std::unique_ptr<Connection>>& connections) {
+        while (true) {
+            int fd = accept4(listener.fd, nullptr, nullptr, SOCK_NONBLOCK | SOCK_CLOEXEC);
+            if (fd < 0) {
+                return;
+            }
+            if (listener.tcp) {
+                int one = 1;
+                setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+            }
+            auto conn = std::make_unique<Connection>();
+            conn->fd = fd;
+            conn->tcp = listener.tcp;
+            conn->events = EPOLLIN | EPOLLRDHUP;
+            epoll_event ev{};
+            ev.events = conn->events;
+            ev.data.ptr = conn.get();
+            if (epoll_ctl(epfd, EPOLL_CTL_ADD, fd, &ev) != 0) {
+                close(fd);
+                continue;
+            }
+            connections[fd] = std::move(conn);
+        }
+    }
+
+    void workerLoop() {
+        int epfd = epoll_create1(EPOLL_CLOEXEC);
+        if (epfd < 0) {
+            throw socketError("epoll_create1");
+        }
+        for (Connection& listener : listeners) {
+            epoll_event ev{};
+            ev.events = EPOLLIN | EPOLLEXCLUSIVE;
+            ev.data.ptr = &listener;
+            epoll_ctl(epfd, EPOLL_CTL_ADD, listener.fd, &ev);
+        }
+        epoll_event stopEvent{};
+        stopEvent.events = EPOLLIN;
+        stopEvent.data.ptr = &stopTag;
+        epoll_ctl(epfd, EPOLL_CTL_ADD, stopFd, &stopEvent);
+
+        std::unordered_map<int, std::unique_ptr<Connection>> connections;
+        auto closeAll = [&] {
+            for (auto& entry : connections) {
+                close(entry.first);
+            }
+            close(epfd);
+        };
+        epoll_event events[256];
+        bool running = true;
+        try {
+            while (running) {
+                int n = epoll_wait(epfd, events, 256, -1);
+                if (n < 0) {
+                    if (errno == EINTR) {
+                        continue;
+                    }
+                    throw socketError("epoll_wait");
+                }
+                for (int i = 0; i < n; ++i) {
+                    Connection* conn = static_cast<Connection*>(events[i].data.ptr);
+                    if (conn == &stopTag) {
+                        running = false;
+                    }
+                    else if (conn->listener) {
+                        acceptAll(epfd, *conn, connections);
+                    }
+                    else if (!service(epfd, *conn, events[i].events)) {
+                        int fd = conn->fd;
+                        close(fd);
+                        connections.erase(fd);
+                    }
+                }
+            }
+        }
+        catch (...) {
+            closeAll();
+            throw;
+        }
+        closeAll();
+    }
+
+    // runs a worker loop; a failure stops the whole server instead of terminating the process
+    void runWorker() {
+        try {
+            workerLoop();
+        }
+        catch (...) {
+            {
+                std::lock_guard<std::mutex> guard(errorLock);
+                if (!error) {
+                    error = std::current_exception();
+                }
+            }
+            stop();
+        }
+    }
+
+public:
+    EventServer(Handler handler, size_t workers)
+        : handler(std::move(handler)), workerCount(workers == 0 ? std::thread::hardware_concurrency() : workers) {
+        if (workerCount == 0) {
+            workerCount = 1;
+        }
+        stopFd = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+        if (stopFd < 0) {
+            throw socketError("eventfd");
+        }
+    }
+
+    ~EventServer() {
+        for (const Connection& listener : listeners) {
+            close(listener.fd);
+        }
+        for (const std::string& path : unixPaths) {
+            unlink(path.c_str());
+        }
+        close(stopFd);
+    }
+
+    EventServer(const EventServer&) = delete;
+    EventServer& operator=(const EventServer&) = delete;
+
+    // listens on a Unix domain socket, replacing a stale socket file at path
+    void listenUnix(const std::string& path) {
+        sockaddr_un address{};
+        if (path.size() >= sizeof(address.sun_path)) {
+            throw std::runtime_error("Socket path too long: " + path);
+        }
+        int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+        if (fd < 0) {
+            throw socketError("socket");
+        }
+        address.sun_family = AF_UNIX;
+        strncpy(address.sun_path, path.c_str(), sizeof(address.sun_path) - 1);
+        unlink(path.c_str());
+        if (bind(fd, reinterpret_cast<sockaddr*>(&address), sizeof(address)) != 0) {
+            close(fd);
+            throw socketError("bind " + path);
+        }
+        unixPaths.push_back(path);
+        addListener(fd, false);
+    }
+
+    // listens on 127.0.0.1:port
+    void listenTcp(int port) {
+        int fd = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+        if (fd < 0) {
+            throw socketError("socket");
+        }
+        int one = 1;
+        setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+        sockaddr_in address{};
+        address.sin_family = AF_INET;
+        address.sin_port = htons(static_cast<uint16_t>(port));
+        address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+        if (bind(fd, reinterpret_cast<sockaddr*>(&address), sizeof(address)) != 0) {
+            close(fd);
+            throw socketError("bind port " + std::to_string(port));
+        }
+        addListener(fd, true);
+    }
+
+    // Serves until stop() is called; the calling thread is one of the workers. If a worker
+    // fails, e.g. its handler throws, every worker stops and run() rethrows the error.
+    void run() {
+        std::vector<std::thread> threads;
+        for (size_t i = 1; i < workerCount; ++i) {
+            threads.emplace_back([this] { runWorker(); });
+        }
+        runWorker();
+        for (std::thread& t : threads) {
+            t.join();
+        }
+        std::lock_guard<std::mutex> guard(errorLock);
+        if (error) {
+            std::rethrow_exception(error);
+        }
+    }
+
+    // wakes every worker and makes run() return; safe from any thread or a signal handler
+    void stop() {
+        uint64_t one = 1;
+        ssize_t ignored = write(stopFd, &one, sizeof(one));
+        (void)ignored;
+    }
+
+    size_t workers() const {
+        return workerCount;
+    }
+};
+#endif
@@ -0,0 +1,63 @@
+#pragma once
+#include <memory>
+#include <string>
+#include "Catalog.h"
+#include "LruCache.h"
+#include "json.hpp"
+
+// Canonical JSON encoding of one book, stored as ",{...}". The leading comma lets output
+// paths join fragments without writing separators: the first one is used from its second byte.
+// Shared so a response can keep referencing a fragment after the cache evicts it.
+using Fragment = std::shared_ptr<const std::string>;
+
+inline Fragment encodeBook(BookId id, const Book& book) {
+    nlohmann::json bookJson;
+    bookJson["id"] = id;
+    bookJson["title"] = book.getTitle();
+    bookJson["author"] = book.getAuthor().getName();
+    bookJson["language"] = book.getLanguage();
+    bookJson["link"] = book.getLink();
+    return std::make_shared<const std::string>("," + bookJson.dump());
+}
+
+// Per-book JSON fragments for one catalog version, kept under a byte budget by evicting
+// the least recently used books.
+class FragmentCache {
+private:
+    ShardedLruCache<BookId, Fragment> cache;
+
+    // bytes an entry costs besides the text itself: list node, map node and string header
+    static size_t entryBytes(const Fragment& fragment) {
+        return fragment->size() + sizeof(Fragment) + sizeof(std::string) + 6 * sizeof(void*);
+    }
+
+public:
+    // byteBudget of 0 means every book stays cached
+    explicit FragmentCache(size_t byteBudget = 0) : cache(byteBudget) {}
+
+    // Returns the fragment of book id in snapshot, encoding it on a miss
+    Fragment get(const CatalogSnapshot& snapshot, BookId id) {
+        static const Counter hits = MetricsRegistry::shared().counter("books_cache_hits_total{cache=\"fragment\"}", "Lookups a cache answered");
+        static const Counter misses = MetricsRegistry::shared().counter("books_cache_misses_total{cache=\"fragment\"}", "Lookups a cache had to compute");
+        Fragment fragment;
+        if (cache.find(snapshot.version, id, fragment)) {
+            hits.add();
+            return fragment;
+        }
+        misses.add();
+        fragment = encodeBook(id, snapshot.library.getItem(id));
+        cache.insert(snapshot.version, id, fragment, entryBytes(fragment));
+        return fragment;
+    }
+
+    // Encodes every book of snapshot up front, as far as the budget allows
+    void warm(const CatalogSnapshot& snapshot) {
+        for (size_t i = 0; i < snapshot.library.getSize(); ++i) {
+            get(snapshot, static_cast<BookId>(i));
+        }
+    }
+
+    CacheStats stats() const {
+        return cache.stats();
+    }
+};
@@ -0,0 +1,148 @@
+#pragma once
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <vector>
+#include "json.hpp"
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif
+
+// Log-linear latency histogram in the style of HdrHistogram. Values are grouped by power of
+// two and each power is split into 16 linear sub-buckets, so a reported value is within
+// 1/16 of what was recorded. Values are plain integers, normally nanoseconds.
+class LatencyHistogram {
+private:
+    static constexpr int SUB_BITS = 4;
+    static constexpr uint64_t SUB_COUNT = uint64_t(1) << SUB_BITS;
+    static constexpr size_t BUCKET_COUNT = SUB_COUNT + (64 - SUB_BITS) * SUB_COUNT;
+
+    std::vector<uint64_t> buckets;
+    uint64_t total = 0;
+    uint64_t sum = 0;
+    uint64_t minValue = UINT64_MAX;
+    uint64_t maxValue = 0;
+
+    static int highestBit(uint64_t value) {
+#ifdef _MSC_VER
+        unsigned long index;
+        _BitScanReverse64(&index, value);
+        return static_cast<int>(index);
+#else
+        return 63 - __builtin_clzll(value);
+#endif
+    }
+
+public:
+    LatencyHistogram() : buckets(BUCKET_COUNT, 0) {}
+
+    // bucket that value falls into
+    static size_t bucketOf(uint64_t value) {
+        if (value < SUB_COUNT) {
+            return static_cast<size_t>(value);
+        }
+        int msb = highestBit(value);
+        uint64_t sub = (value >> (msb - SUB_BITS)) - SUB_COUNT;
+        return static_cast<size_t>(SUB_COUNT + (msb - SUB_BITS) * SUB_COUNT + sub);
+    }
+
+    // smallest value that falls into bucket index
+    static uint64_t bucketLow(size_t index) {
+        if (index < SUB_COUNT) {
+            return index;
+        }
+        size_t exponent = (index - SUB_COUNT) / SUB_COUNT;
+        uint64_t sub = (index - SUB_COUNT) % SUB_COUNT;
+        return (SUB_COUNT + sub) << exponent;
+    }
+
+    static size_t bucketCount() {
+        return BUCKET_COUNT;
+    }
+
+    // records value count times
+    void record(uint64_t value, uint64_t count = 1) {
+        buckets[bucketOf(value)] += count;
+        total += count;
+        sum += value * count;
+        minValue = std::min(minValue, value);
+        maxValue = std::max(maxValue, value);
+    }
+
+    // adds every sample of other to this histogram
+    void merge(const LatencyHistogram& other) {
+        for (size_t i = 0; i < BUCKET_COUNT; ++i) {
+            buckets[i] += other.buckets[i];
+        }
+        total += other.total;
+        sum += other.sum;
+        minValue = std::min(minValue, other.minValue);
+        maxValue = std::max(maxValue, other.maxValue);
+    }
+
+    void reset() {
+        std::fill(buckets.begin(), buckets.end(), 0);
+        total = 0;
+        sum = 0;
+        minValue = UINT64_MAX;
+        maxValue = 0;
+    }
+
+    // value below which the fraction p (0 to 1) of the samples fall
+    uint64_t percentile(double p) const {
+        if (total == 0) {
+            return 0;
+        }
+        uint64_t rank = static_cast<uint64_t>(std::ceil(p * static_cast<double>(total)));
+        rank = std::min(std::max<uint64_t>(rank, 1), total);
+        uint64_t seen = 0;
+        for (size_t i = 0; i < BUCKET_COUNT; ++i) {
+            seen += buckets[i];
+            if (seen >= rank) {
+                return std::min(std::max(bucketLow(i), minValue), maxValue);
+            }
+        }
+        return maxValue;
+    }
+
+    uint64_t count() const {
+        return total;
+    }
+
+    uint64_t bucket(size_t index) const {
+        return buckets[index];
+    }
+
+    uint64_t min() const {
+        return total == 0 ? 0 : minValue;
+    }
+
+    uint64_t max() const {
+        return maxValue;
+    }
+
+    double mean() const {
+        return total == 0 ? 0.0 : static_cast<double>(sum) / static_cast<double>(total);
+    }
+};
+
+// Summary and non-empty buckets of a latency histogram
+inline nlohmann::json latencyJson(const LatencyHistogram& histogram) {
+    nlohmann::json result;
+    result["count"] = histogram.count();
+    result["min"] = histogram.min();
+    result["mean"] = histogram.mean();
+    result["p50"] = histogram.percentile(0.50);
+    result["p90"] = histogram.percentile(0.90);
+    result["p99"] = histogram.percentile(0.99);
+    result["p999"] = histogram.percentile(0.999);
+    result["max"] = histogram.max();
+    nlohmann::json buckets = nlohmann::json::array();
+    for (size_t i = 0; i < LatencyHistogram::bucketCount(); ++i) {
+        if (histogram.bucket(i) != 0) {
+            buckets.push_back({ LatencyHistogram::bucketLow(i), histogram.bucket(i) });
+        }
+    }
+    result["buckets"] = buckets;
+    return result;
+}
@@ -0,0 +1,221 @@
+#pragma once
+#ifndef _WIN32
+#include <algorithm>
+#include <cctype>
+#include <cstdlib>
+#include <memory>
+#include <string>
+#include <vector>
+#include "Catalog.h"
+#include "EventServer.h"
+#include "FragmentCache.h"
+#include "QueryExecutor.h"
+#include "json.hpp"
+
+// Books per page when the request doesn't say, and the most a page may hold
+const size_t HTTP_DEFAULT_PAGE_SIZE = 20;
+const size_t HTTP_MAX_PAGE_SIZE = 100;
+
+// decodes %XX escapes and '+' in a query string component
+inline std::string urlDecode(const std::string& text) {
+    std::string result;
+    result.reserve(text.size());
+    for (size_t i = 0; i < text.size(); ++i) {
+        if (text[i] == '+') {
+            result.push_back(' ');
+        }
+        else if (text[i] == '%' && i + 2 < text.size() && isxdigit(static_cast<unsigned char>(text[i + 1]))
+            && isxdigit(static_cast<unsigned char>(text[i + 2]))) {
+            result.push_back(static_cast<char>(std::strtol(text.substr(i + 1, 2).c_str(), nullptr, 16)));
+            i += 2;
+        }
+        else {
+            result.push_back(text[i]);
+        }
+    }
+    return result;
+}
+
+// escapes a query string component
+inline std::string urlEncode(const std::string& text) {
+    static const char* hex = "0123456789ABCDEF";
+    std::string result;
+    for (unsigned char c : text) {
+        if (isalnum(c) || c == '-' || c == '_' || c == '.' || c == '~') {
+            result.push_back(static_cast<char>(c));
+        }
+        else {
+            result.push_back('%');
+            result.push_back(hex[c >> 4]);
+            result.push_back(hex[c & 15]);
+        }
+    }
+    return result;
+}
+
+// Read-only HTTP/1.1 API over the catalog:
+//     GET /books?author=...&lang=...&title=...&icase=1&page=N&size=M
+//     GET /health
+//     GET /stats
+//     GET /metrics, in the Prometheus text format
+// Connections are kept alive unless the client asks otherwise, and pipelined requests are
+// answered in order. Book bodies go out by reference to cached fragments via writev.
+class HttpApi {
+private:
+    const Catalog& catalog;
+    FragmentCache& fragments;
+    QueryCache* results;
+
+    void serveStats(Connection& conn, bool keepAlive) {
+        nlohmann::json stats;
+        stats["version"] = catalog.version();
+        stats["fragmentCache"] = cacheStatsJson(fragments.stats());
+        if (results != nullptr) {
+            stats["resultCache"] = cacheStatsJson(results->stats());
+        }
+        respond(conn, 200, "OK", stats.dump(), keepAlive);
+    }
+
+    static void respond(Connection& conn, int status, const char* reason, const std::string& body, bool keepAlive,
+        const char* contentType = "application/json") {
+        std::string head = "HTTP/1.1 " + std::to_string(status) + " " + reason + "\r\nContent-Type: " + contentType
+            + "\r\nContent-Length: " + std::to_string(body.size()) + (keepAlive ? "\r\n\r\n" : "\r\nConnection: close\r\n\r\n");
+        conn.out.append(head);
+        conn.out.append(body);
+    }
+
+    void serveBooks(Connection& conn, const std::string& queryString, bool keepAlive) {
+        Query query;
+        size_t page = 0;
+        size_t pageSize = HTTP_DEFAULT_PAGE_SIZE;
+        size_t pos = 0;
+        while (pos < queryString.size()) {
+            size_t amp = queryString.find('&', pos);
+            std::string pair = queryString.substr(pos, amp == std::string::npos ? std::string::npos : amp - pos);
+            pos = amp == std::string::npos ? queryString.size() : amp + 1;
+            size_t eq = pair.find('=');
+            std::string key = pair.substr(0, eq);
+            std::string value = eq == std::string::npos ? "" : urlDecode(pair.substr(eq + 1));
+            if (key == "author") {
+                query.author = value;
+            }
+            else if (key == "lang" || key == "language") {
+                query.language = value;
+            }
+            else if (key == "title") {
+                query.title = value;
+            }
+            else if (key == "icase") {
+                query.ignoreCase = value == "1" || value == "true";
+            }
+            else if (key == "page") {
+                page = std::strtoul(value.c_str(), nullptr, 10);
+            }
+            else if (key == "size") {
+                pageSize = std::min<size_t>(std::max<size_t>(std::strtoul(value.c_str(), nullptr, 10), 1), HTTP_MAX_PAGE_SIZE);
+            }
+        }
+
+        std::shared_ptr<const CatalogSnapshot> snapshot = catalog.snapshot();
+        QueryCaches caches;
+        caches.results = results;
+        QueryResult found = executeQuery(*snapshot, query, caches);
+        const std::vector<BookId>& matches = *found;
+        size_t begin = page >= matches.size() ? matches.size() : std::min(page * pageSize, matches.size());
+        size_t end = std::min(begin + pageSize, matches.size());
+
+        std::string prefix = "{\"version\":" + std::to_string(snapshot->version) + ",\"total\":" + std::to_string(matches.size())
+            + ",\"page\":" + std::to_string(page) + ",\"pageSize\":" + std::to_string(pageSize) + ",\"books\":[";
+        const char* suffix = "]}";
+        std::vector<Fragment> books;
+        books.reserve(end - begin);
+        size_t length = prefix.size() + 2;
+        for (size_t i = begin; i < end; ++i) {
+            books.push_back(fragments.get(*snapshot, matches[i]));
+            length += books.back()->size() - (i == begin ? 1 : 0);
+        }
+        std::string head = std::string("HTTP/1.1 200 OK\r\nContent-Type: application/json\r\nContent-Length: ")
+            + std::to_string(length) + (keepAlive ? "\r\n\r\n" : "\r\nConnection: close\r\n\r\n");
+        conn.out.append(head);
+        conn.out.append(prefix);
+        for (size_t i = 0; i < books.size(); ++i) {
+            size_t skip = i == 0 ? 1 : 0;
+            conn.out.appendRef(books[i]->data() + skip, books[i]->size() - skip, books[i]);
+        }
+        conn.out.append(suffix, 2);
+    }
+
+public:
+    // results may be null to run every query from scratch
+    HttpApi(const Catalog& catalog, FragmentCache& fragments, QueryCache* results)
+        : catalog(catalog), fragments(fragments), results(results) {}
+
+    // Handles every complete request in conn.in and returns the bytes used
+    size_t handle(Connection& conn) {
+        size_t used = 0;
+        while (!conn.closing) {
+            size_t headerEnd = conn.in.find("\r\n\r\n", used);
+            if (headerEnd == std::string::npos) {
+                break;
+            }
+            std::string head = conn.in.substr(used, headerEnd - used);
+            size_t requestEnd = headerEnd + 4;
+
+            size_t lineEnd = head.find("\r\n");
+            std::string requestLine = head.substr(0, lineEnd);
+            std::string headers = lineEnd == std::string::npos ? "" : head.substr(lineEnd + 2);
+            std::transform(headers.begin(), headers.end(), headers.begin(), [](char c) { return static_cast<char>(tolower(static_cast<unsigned char>(c))); });
+
+            size_t contentLength = 0;
+            size_t lengthAt = headers.find("content-length:");
+            if (lengthAt != std::string::npos) {
+                contentLength = std::strtoul(headers.c_str() + lengthAt + 15, nullptr, 10);
+            }
+            if (conn.in.size() < requestEnd + contentLength) {
+                break;
+            }
+            used = requestEnd + contentLength;
+
+            size_t firstSpace = requestLine.find(' ');
+            size_t secondSpace = requestLine.find(' ', firstSpace + 1);
+            if (firstSpace == std::string::npos || secondSpace == std::string::npos) {
+                respond(conn, 400, "Bad Request", "{\"error\":\"malformed request line\"}", false);
+                conn.closing = true;
+                break;
+            }
+            std::string method = requestLine.substr(0, firstSpace);
+            std::string target = requestLine.substr(firstSpace + 1, secondSpace - firstSpace - 1);
+            std::string version = requestLine.substr(secondSpace + 1);
+            bool keepAlive = version == "HTTP/1.1" ? headers.find("connection: close") == std::string::npos
+                : headers.find("connection: keep-alive") != std::string::npos;
+
+            size_t question = target.find('?');
+            std::string path = target.substr(0, question);
+            std::string queryString = question == std::string::npos ? "" : target.substr(question + 1);
+
+            if (method != "GET") {
+                respond(conn, 405, "Method Not Allowed", "{\"error\":\"only GET is supported\"}", keepAlive);
+            }
+            else if (path == "/books") {
+                serveBooks(conn, queryString, keepAlive);
+            }
+            else if (path == "/stats") {
+                serveStats(conn, keepAlive);
+            }
+            else if (path == "/metrics") {
+                respond(conn, 200, "OK", MetricsRegistry::shared().prometheusText(), keepAlive, "text/plain; version=0.0.4");
+            }
+            else if (path == "/health") {
+                respond(conn, 200, "OK", "ok\n", keepAlive, "text/plain");
+            }
+            else {
+                respond(conn, 404, "Not Found", "{\"error\":\"not found\"}", keepAlive);
+            }
+            if (!keepAlive) {
+                conn.closing = true;
+            }
+        }
+        return used;
+    }
+};
+#endif
@@ -0,0 +1,351 @@
+#pragma once
+#include <algorithm>
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <unordered_map>
+#include <vector>
+#include "json.hpp"
+#include "Memory.h"
+#include "Metrics.h"
+#include "ThreadPool.h"
+#include "Trace.h"
+
+// Position of a book inside a Library. Stable while the library only grows or replaces items;
+// swapRemove hands the removed id to the last item.
+using BookId = uint32_t;
+
+// Person class
+class Person {
+protected:
+    std::string name;
+
+public:
+    // Default constructor
+    Person() : name("") {}
+
+    // Constructor for initialzing objects in person
+    Person(const std::string& name) : name(name) {}
+
+    const std::string& getName() const {
+        return name;
+    }
+
+    void setName(const std::string& name) {
+        this->name = name;
+    }
+};
+
+// Author class
+class Author : public Person {
+public:
+    // Default constructor
+    Author() : Person() {}
+
+    // Constructor for initialzing objects in author
+    Author(const std::string& name) : Person(name) {}
+
+    Author(const nlohmann::json& jsonData) : Person(jsonData["author"].get<std::string>()) {}
+};
+
+// A book link without the whitespace around it, as books.json has a '\n' after every link
+inline std::string normalizeLink(const std::string& link) {
+    const char* space = " \t\r\n";
+    size_t first = link.find_first_not_of(space);
+    if (first == std::string::npos) {
+        return std::string();
+    }
+    return link.substr(first, link.find_last_not_of(space) - first + 1);
+}
+
+// Book class is represting books like the book's link, title, language, and author
+class Book {
+private:
+    std::string title;
+    Author author;
+    std::string link;
+    std::string language;
+public:
+    // Constructor for provided title, author, link, and language.
+    Book(const std::string& title, const std::string& author, const std::string& link, const std::string& language)
+        : title(title), author(author), link(link), language(language) {}
+
+
+    // Overloaded operator to compare books on title
+    bool operator==(const Book& other) const {
+        return title == other.title;
+    }
+
+    // Overloaded operator for language
+    bool operator<(const Book& other) const {
+        return language < other.language;
+    }
+
+    // grabs book's title
+    const std::string& getTitle() const {
+        return title;
+    }
+
+    // grabs book's language
+    const std::string& getLanguage() const {
+        return language;
+    }
+
+    // grabs book's link
+    const std::string& getLink() const {
+        return link;
+    }
+
+    // grabs book's author
+    const Author& getAuthor() const {
+        return author;
+    }
+
+    // heap bytes the book's strings own beyond the book itself
+    size_t heapBytes() const {
+        return stringHeapBytes(title) + stringHeapBytes(author.getName()) + stringHeapBytes(link) + stringHeapBytes(language);
+    }
+
+    // Constructor that takes the JSON data
+    Book(const nlohmann::json& jsonData)
+        : title(jsonData["title"]), author(jsonData), link(normalizeLink(jsonData["link"])), language(jsonData["language"]) {}
+};
+
+// Stable identity of a book across catalog versions: its title and author
+inline std::string bookKey(const Book& book) {
+    return book.getTitle() + '\x1f' + book.getAuthor().getName();
+}
+
+// counts books read from a catalog file, whichever format it was in
+inline void countBooksLoaded(size_t books) {
+    static const Counter loaded = MetricsRegistry::shared().counter("books_loaded_total", "Books read from catalog files");
+    loaded.add(books);
+}
+
+// Items per storage chunk of a Library
+const size_t LIBRARY_CHUNK_SIZE = MORSEL_SIZE;
+
+// Up to LIBRARY_CHUNK_SIZE consecutive items of a Library. The buffer never grows once the
+// chunk is made, so an append in place can't move an item another copy still reads. claimed
+// counts the items any copy has put in, so only one copy can append after a given item.
+template <typename T>
+struct LibraryChunk {
+    std::vector<T> items;
+    std::atomic<size_t> claimed{ 0 };
+
+    explicit LibraryChunk(size_t capacity) {
+        items.reserve(capacity);
+    }
+
+    // the first count items of other, with room for capacity
+    LibraryChunk(const LibraryChunk& other, size_t count, size_t capacity) : claimed(count) {
+        items.reserve(capacity);
+        items.insert(items.end(), other.items.begin(), other.items.begin() + count);
+    }
+};
+
+// Template class representing a library. Items live in fixed-size chunks that copies of
+// the library share, so a copy costs one pointer per chunk. Each copy keeps its own length:
+// growing one appends to the shared last chunk in place, past what the others see, and only
+// writing or removing an item another copy sees duplicates its chunk. Growing a library never
+// moves the items another copy sees.
+template <typename T>
+class Library {
+private:
+    using Chunk = LibraryChunk<T>;
+
+    // Chunks storing items for library
+    std::vector<std::shared_ptr<Chunk>> chunks;
+    size_t count = 0;
+
+    // room for a last chunk of fill items; it doubles as it fills up, so a small library
+    // doesn't reserve a whole chunk and appends stay amortized O(1)
+    static size_t tailCapacity(size_t fill) {
+        return std::min(LIBRARY_CHUNK_SIZE, std::max<size_t>(16, 2 * fill));
+    }
+
+    // items of chunk index this library sees
+    size_t fillOf(size_t index) const {
+        return std::min(LIBRARY_CHUNK_SIZE, count - index * LIBRARY_CHUNK_SIZE);
+    }
+
+    // returns a chunk ready for writing, copying it first if another library shares it
+    std::vector<T>& writableChunk(size_t index) {
+        size_t fill = fillOf(index);
+        if (chunks[index].use_count() > 1) {
+            chunks[index] = std::make_shared<Chunk>(*chunks[index], fill, chunks[index]->items.capacity());
+        }
+        else {
+            // a copy that's gone may have appended past what this library sees
+            std::vector<T>& items = chunks[index]->items;
+            while (items.size() > fill) {
+                items.pop_back();
+            }
+            chunks[index]->claimed = fill;
+        }
+        return chunks[index]->items;
+    }
+
+public:
+    // adds item to library
+    void addItem(const T& item) {
+        size_t fill = count % LIBRARY_CHUNK_SIZE;
+        if (fill == 0) {
+            chunks.push_back(std::make_shared<Chunk>(tailCapacity(0)));
+        }
+        Chunk& tail = *chunks.back();
+        size_t expected = fill;
+        // in place only while no other copy appended past this one and the buffer has room
+        if (fill < tail.items.capacity() && tail.claimed.compare_exchange_strong(expected, fill + 1)) {
+            tail.items.push_back(item);
+        }
+        else {
+            auto grown = std::make_shared<Chunk>(tail, fill, tailCapacity(fill + 1));
+            grown->items.push_back(item);
+            grown->claimed = fill + 1;
+            chunks.back() = std::move(grown);
+        }
+        ++count;
+    }
+
+    // replaces the item at index, copying its chunk first if another library shares it
+    void setItem(size_t index, const T& item) {
+        writableChunk(index / LIBRARY_CHUNK_SIZE)[index % LIBRARY_CHUNK_SIZE] = item;
+    }
+
+    // Removes the item at index by moving the last item into its place, so only the last
+    // item's position changes
+    void swapRemove(size_t index) {
+        if (index != count - 1) {
+            setItem(index, getItem(count - 1));
+        }
+        writableChunk(chunks.size() - 1).pop_back();
+        --count;
+        chunks.back()->claimed = chunks.back()->items.size();
+        if (chunks.back()->items.empty()) {
+            chunks.pop_back();
+        }
+    }
+
+    // returns every item matching pred, in library order
+    template <typename Pred>
+    std::vector<const T*> filterItems(Pred pred, ExecutionPolicy policy = ExecutionPolicy::serial()) const {
+        std::vector<std::vector<const T*>> parts(policy.morselCount(count));
+        policy.forEachMorsel(count, [&](size_t morsel, size_t begin, size_t end) {
+            for (size_t i = begin; i < end; ++i) {
+                const T& item = getItem(i);
+                if (pred(item)) {
+                    parts[morsel].push_back(&item);
+                }
+            }
+        });
+        // morsels are merged back in catalog order
+        std::vector<const T*> result;
+        for (const auto& part : parts) {
+            result.insert(result.end(), part.begin(), part.end());
+        }
+        return result;
+    }
+
+    // returns the ids of every item matching pred, in library order
+    template <typename Pred>
+    std::vector<BookId> filterIds(Pred pred, ExecutionPolicy policy = ExecutionPolicy::serial()) const {
+        std::vector<std::vector<BookId>> parts(policy.morselCount(count));
+        policy.forEachMorsel(count, [&](size_t morsel, size_t begin, size_t end) {
+            for (size_t i = begin; i < end; ++i) {
+                if (pred(getItem(i))) {
+                    parts[morsel].push_back(static_cast<BookId>(i));
+                }
+            }
+        });
+        std::vector<BookId> result;
+        for (const auto& part : parts) {
+            result.insert(result.end(), part.begin(), part.end());
+        }
+        return result;
+    }
+
+    // counts the items per key, e.g. books per language
+    template <typename KeyFn>
+    std::unordered_map<std::string, size_t> countBy(KeyFn key, ExecutionPolicy policy = ExecutionPolicy::serial()) const {
+        std::vector<std::unordered_map<std::string, size_t>> parts(policy.morselCount(count));
+        policy.forEachMorsel(count, [&](size_t morsel, size_t begin, size_t end) {
+            for (size_t i = begin; i < end; ++i) {
+                parts[morsel][key(getItem(i))]++;
+            }
+        });
+        std::unordered_map<std::string, size_t> counts;
+        for (const auto& part : parts) {
+            for (const auto& entry : part) {
+                counts[entry.first] += entry.second;
+            }
+        }
+        return counts;
+    }
+
+    // returns the ids of all items ordered by less; ties keep library order
+    template <typename Less>
+    std::vector<BookId> sortedIds(Less less, ExecutionPolicy policy = ExecutionPolicy::serial()) const {
+        std::vector<BookId> ids(count);
+        for (size_t i = 0; i < ids.size(); ++i) {
+            ids[i] = static_cast<BookId>(i);
+        }
+        auto byItem = [&](BookId a, BookId b) { return less(getItem(a), getItem(b)); };
+        // each morsel is sorted on its own, then neighbouring runs are merged pairwise
+        policy.forEachMorsel(ids.size(), [&](size_t, size_t begin, size_t end) {
+            std::stable_sort(ids.begin() + begin, ids.begin() + end, byItem);
+        });
+        for (size_t width = MORSEL_SIZE; policy.morselCount(ids.size()) > 1 && width < ids.size(); width *= 2) {
+            size_t merges = (ids.size() + 2 * width - 1) / (2 * width);
+            auto mergeRuns = [&](size_t, size_t begin, size_t end) {
+                for (size_t m = begin; m < end; ++m) {
+                    size_t lo = m * 2 * width;
+                    size_t mid = std::min(lo + width, ids.size());
+                    size_t hi = std::min(lo + 2 * width, ids.size());
+                    std::inplace_merge(ids.begin() + lo, ids.begin() + mid, ids.begin() + hi, byItem);
+                }
+            };
+            if (policy.pool != nullptr) {
+                policy.pool->forEachMorsel(merges, 1, mergeRuns);
+            }
+            else {
+                mergeRuns(0, 0, merges);
+            }
+        }
+        return ids;
+    }
+
+    // seraches for books written by author selected
+    std::vector<const Book*> searchBooksByAuthor(const std::string& authorName, ExecutionPolicy policy = ExecutionPolicy::serial()) const {
+        TraceSpan span("search.author");
+        return filterItems([&](const Book& book) { return book.getAuthor().getName() == authorName; }, policy);
+    }
+
+    // seraches for books written by language selected
+    std::vector<const Book*> searchBooksByLanguage(const std::string& language, ExecutionPolicy policy = ExecutionPolicy::serial()) const {
+        TraceSpan span("search.language");
+        return filterItems([&](const Book& book) { return book.getLanguage() == language; }, policy);
+    }
+
+    // returns item from the library
+    const T& getItem(size_t index) const {
+        return chunks[index / LIBRARY_CHUNK_SIZE]->items[index % LIBRARY_CHUNK_SIZE];
+    }
+
+    // returns number of item to the library
+    size_t getSize() const {
+        return count;
+    }
+
+    // bytes of the chunks with the items in them, not what the items own themselves; chunks
+    // shared with other copies are counted in full
+    size_t storageBytes() const {
+        size_t total = vectorBytes(chunks);
+        for (const auto& chunk : chunks) {
+            // make_shared puts the chunk and its reference counts in one block
+            total += sizeof(Chunk) + 2 * sizeof(long) + vectorBytes(chunk->items);
+        }
+        return total;
+    }
+};
@@ -0,0 +1,155 @@
+#pragma once
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <string>
+#include <thread>
+#include "Library.h"
+#include "Platform.h"
+
+// Launches one link, returning once the launch is done; false if it failed
+using LinkLauncher = std::function<bool(const std::string& link)>;
+
+// only web links are handed to an opener, so a link can't start a program or pass it options
+inline bool isOpenableLink(const std::string& link) {
+    return link.compare(0, 7, "http://") == 0 || link.compare(0, 8, "https://") == 0;
+}
+
+struct LinkOpenerOptions {
+    // launches are at least this far apart
+    int minIntervalMilliseconds = 250;
+    // links waiting beyond this many are turned away
+    size_t maxPending = 4;
+};
+
+struct LinkOpenerStats {
+    uint64_t launched = 0;
+    uint64_t failed = 0;
+    // asked for while the same link was still waiting
+    uint64_t coalesced = 0;
+    // turned away because too many were waiting
+    uint64_t dropped = 0;
+};
+
+// Opens links on a background thread so the caller never waits for an opener, however slow.
+// A link asked for again while it's still waiting is opened once, launches are spaced at
+// least minIntervalMilliseconds apart, and a burst beyond maxPending waiting links is
+// turned away rather than opening a wall of tabs. The launcher can be replaced, e.g. by one
+// that records the links, to exercise it without starting a browser.
+class LinkOpener {
+public:
+    enum Result { QUEUED, COALESCED, DROPPED, INVALID };
+
+private:
+    LinkLauncher launcher;
+    LinkOpenerOptions options;
+    std::mutex lock;
+    std::condition_variable wake;
+    std::deque<std::string> pending;
+    // how many waiting or launching; waitIdle() returns at zero
+    size_t busy = 0;
+    std::condition_variable idle;
+    LinkOpenerStats counters;
+    std::string lastError;
+    bool stopping = false;
+    std::thread dispatcher;
+
+    void dispatchLoop() {
+        std::unique_lock<std::mutex> guard(lock);
+        auto nextLaunch = std::chrono::steady_clock::now();
+        while (true) {
+            wake.wait(guard, [this] { return stopping || !pending.empty(); });
+            if (stopping) {
+                return;
+            }
+            if (wake.wait_until(guard, nextLaunch, [this] { return stopping; })) {
+                return;
+            }
+            std::string link = std::move(pending.front());
+            pending.pop_front();
+            guard.unlock();
+            bool launched = false;
+            try {
+                launched = launcher(link);
+            }
+            catch (const std::exception&) {
+            }
+            guard.lock();
+            nextLaunch = std::chrono::steady_clock::now() + std::chrono::milliseconds(options.minIntervalMilliseconds);
+            if (launched) {
+                counters.launched++;
+            }
+            else {
+                counters.failed++;
+                lastError = "Couldn't open " + link;
+            }
+            if (--busy == 0) {
+                idle.notify_all();
+            }
+        }
+    }
+
+public:
+    explicit LinkOpener(LinkLauncher launcher = launchWithPlatformOpener, LinkOpenerOptions options = LinkOpenerOptions())
+        : launcher(std::move(launcher)), options(options) {
+        dispatcher = std::thread([this] { dispatchLoop(); });
+    }
+
+    // links still waiting are dropped; one being launched is waited for
+    ~LinkOpener() {
+        {
+            std::lock_guard<std::mutex> guard(lock);
+            stopping = true;
+        }
+        wake.notify_all();
+        dispatcher.join();
+    }
+
+    LinkOpener(const LinkOpener&) = delete;
+    LinkOpener& operator=(const LinkOpener&) = delete;
+
+    // queues link to be opened and returns at once
+    Result open(const std::string& link) {
+        std::string normalized = normalizeLink(link);
+        if (!isOpenableLink(normalized)) {
+            return INVALID;
+        }
+        std::lock_guard<std::mutex> guard(lock);
+        for (const std::string& waiting : pending) {
+            if (waiting == normalized) {
+                counters.coalesced++;
+                return COALESCED;
+            }
+        }
+        if (pending.size() >= options.maxPending) {
+            counters.dropped++;
+            return DROPPED;
+        }
+        pending.push_back(std::move(normalized));
+        busy++;
+        wake.notify_all();
+        return QUEUED;
+    }
+
+    // waits until every queued link has been launched
+    void waitIdle() {
+        std::unique_lock<std::mutex> guard(lock);
+        idle.wait(guard, [this] { return busy == 0; });
+    }
+
+    LinkOpenerStats stats() {
+        std::lock_guard<std::mutex> guard(lock);
+        return counters;
+    }
+
+    // the last launch failure since the previous call, or empty
+    std::string takeError() {
+        std::lock_guard<std::mutex> guard(lock);
+        std::string error;
+        error.swap(lastError);
+        return error;
+    }
+};
@@ -0,0 +1,177 @@
+#pragma once
+#ifndef _WIN32
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <chrono>
+#include <cstdlib>
+#include <cstring>
+#include <functional>
+#include <mutex>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <vector>
+#include "Histogram.h"
+
+// Settings for a load test against a running server
+struct LoadOptions {
+    // Unix socket to connect to; used when tcpPort is 0
+    std::string socketPath = "/tmp/booksmanagement.sock";
+    int tcpPort = 0;
+    size_t connections = 4;
+    // requests in flight per connection
+    size_t pipeline = 16;
+    size_t requests = 100000;
+    // complete, already framed requests, sent round robin
+    std::vector<std::string> payloads;
+    // returns the length of the first complete response in data, or 0 if more bytes are needed
+    std::function<size_t(const char* data, size_t size)> responseLength;
+};
+
+// What a load test measured; latency is per request, from sending it to its response
+struct LoadReport {
+    size_t requests = 0;
+    double seconds = 0;
+    LatencyHistogram latency;
+};
+
+// Response framing of the line-delimited query protocol
+inline size_t lineResponseLength(const char* data, size_t size) {
+    const void* newline = memchr(data, '\n', size);
+    return newline == nullptr ? 0 : static_cast<size_t>(static_cast<const char*>(newline) - data) + 1;
+}
+
+// Response framing of HTTP/1.1 with a Content-Length body
+inline size_t httpResponseLength(const char* data, size_t size) {
+    std::string head(data, std::min<size_t>(size, 4096));
+    size_t headerEnd = head.find("\r\n\r\n");
+    if (headerEnd == std::string::npos) {
+        return 0;
+    }
+    size_t length = 0;
+    size_t lengthAt = head.find("Content-Length:");
+    if (lengthAt != std::string::npos && lengthAt < headerEnd) {
+        length = std::strtoul(head.c_str() + lengthAt + 15, nullptr, 10);
+    }
+    size_t total = headerEnd + 4 + length;
+    return total <= size ? total : 0;
+}
+
+inline int connectTo(const LoadOptions& options) {
+    int fd;
+    if (options.tcpPort != 0) {
+        fd = socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0);
+        sockaddr_in address{};
+        address.sin_family = AF_INET;
+        address.sin_port = htons(static_cast<uint16_t>(options.tcpPort));
+        address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+        if (fd < 0 || connect(fd, reinterpret_cast<sockaddr*>(&address), sizeof(address)) != 0) {
+            throw std::runtime_error(std::string("connect: ") + strerror(errno));
+        }
+        int one = 1;
+        setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+    }
+    else {
+        fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+        sockaddr_un address{};
+        address.sun_family = AF_UNIX;
+        strncpy(address.sun_path, options.socketPath.c_str(), sizeof(address.sun_path) - 1);
+        if (fd < 0 || connect(fd, reinterpret_cast<sockaddr*>(&address), sizeof(address)) != 0) {
+            throw std::runtime_error(std::string("connect ") + options.socketPath + ": " + strerror(errno));
+        }
+    }
+    return fd;
+}
+
+// Drives the server from options.connections threads, each keeping options.pipeline
+// requests in flight, until options.requests responses have come back.
+inline LoadReport runLoad(const LoadOptions& options) {
+    if (options.payloads.empty() || !options.responseLength) {
+        throw std::runtime_error("Load test needs request payloads and a response parser");
+    }
+    std::atomic<size_t> issued{ 0 };
+    std::mutex reportLock;
+    LoadReport report;
+    std::vector<std::string> failures;
+
+    auto client = [&](size_t connection) {
+        LatencyHistogram latency;
+        size_t done = 0;
+        try {
+            int fd = connectTo(options);
+            std::string batch;
+            std::string in;
+            char buffer[64 * 1024];
+            size_t next = connection;
+            while (true) {
+                size_t want = options.pipeline;
+                size_t start = issued.fetch_add(want);
+                if (start >= options.requests) {
+                    break;
+                }
+                want = std::min(want, options.requests - start);
+                batch.clear();
+                for (size_t i = 0; i < want; ++i) {
+                    batch += options.payloads[next++ % options.payloads.size()];
+                }
+                auto sent = std::chrono::steady_clock::now();
+                for (size_t off = 0; off < batch.size();) {
+                    ssize_t n = send(fd, batch.data() + off, batch.size() - off, MSG_NOSIGNAL);
+                    if (n <= 0) {
+                        throw std::runtime_error(std::string("send: ") + strerror(errno));
+                    }
+                    off += static_cast<size_t>(n);
+                }
+                size_t received = 0;
+                while (received < want) {
+                    size_t length;
+                    while (received < want && (length = options.responseLength(in.data(), in.size())) > 0) {
+                        in.erase(0, length);
+                        ++received;
+                        auto elapsed = std::chrono::steady_clock::now() - sent;
+                        latency.record(static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::nanoseconds>(elapsed).count()));
+                    }
+                    if (received == want) {
+                        break;
+                    }
+                    ssize_t n = recv(fd, buffer, sizeof(buffer), 0);
+                    if (n <= 0) {
+                        throw std::runtime_error("Server closed the connection");
+                    }
+                    in.append(buffer, static_cast<size_t>(n));
+                }
+                done += received;
+            }
+            close(fd);
+        }
+        catch (const std::exception& e) {
+            std::lock_guard<std::mutex> guard(reportLock);
+            failures.push_back(e.what());
+        }
+        std::lock_guard<std::mutex> guard(reportLock);
+        report.latency.merge(latency);
+        report.requests += done;
+    };
+
+    auto started = std::chrono::steady_clock::now();
+    std::vector<std::thread> threads;
+    for (size_t c = 0; c < options.connections; ++c) {
+        threads.emplace_back(client, c);
+    }
+    for (std::thread& t : threads) {
+        t.join();
+    }
+    report.seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - started).count();
+    if (!failures.empty()) {
+        throw std::runtime_error("Load test failed: " + failures.front());
+    }
+    return report;
+}
+#endif
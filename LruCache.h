@@ -0,0 +1,145 @@
+#pragma once
+#include <algorithm>
+#include <atomic>
+#include <cstdint>
+#include <functional>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <unordered_map>
+#include <vector>
+
+// Counters shared by the caches built on ShardedLruCache
+struct CacheStats {
+    uint64_t hits = 0;
+    uint64_t misses = 0;
+    uint64_t evictions = 0;
+    size_t bytes = 0;
+    size_t entries = 0;
+
+    double hitRatio() const {
+        return hits + misses == 0 ? 0.0 : static_cast<double>(hits) / static_cast<double>(hits + misses);
+    }
+};
+
+// Concurrent LRU cache for values derived from one catalog version. Keys are spread over
+// shards, each with its own lock and LRU list, and each shard evicts its coldest entries
+// to stay under its share of the byte budget. Entries carry the catalog version they were
+// computed from: a lookup or insert with a newer version empties the shard, so nothing
+// computed from an older catalog is ever returned or kept once the shard sees the new one.
+template <typename Key, typename Value, typename Hash = std::hash<Key>>
+class ShardedLruCache {
+private:
+    static constexpr size_t SHARD_COUNT = 64;
+
+    struct Entry {
+        Key key;
+        Value value;
+        size_t bytes;
+    };
+
+    struct Shard {
+        std::mutex lock;
+        uint64_t version = 0;
+        // most recently used first
+        std::list<Entry> lru;
+        std::unordered_map<Key, typename std::list<Entry>::iterator, Hash> index;
+        size_t bytes = 0;
+    };
+
+    std::vector<std::unique_ptr<Shard>> shards;
+    size_t shardBudget;
+    Hash hasher;
+    std::atomic<uint64_t> hits{ 0 };
+    std::atomic<uint64_t> misses{ 0 };
+    std::atomic<uint64_t> evictions{ 0 };
+
+    Shard& shardOf(const Key& key) {
+        // mix the hash so keys that differ only in their low bits still spread out
+        uint64_t h = static_cast<uint64_t>(hasher(key)) * 0x9E3779B97F4A7C15ull;
+        return *shards[(h >> 32) % SHARD_COUNT];
+    }
+
+    static void resetShard(Shard& shard, uint64_t version) {
+        shard.lru.clear();
+        shard.index.clear();
+        shard.bytes = 0;
+        shard.version = version;
+    }
+
+public:
+    // byteBudget of 0 means nothing is ever evicted
+    explicit ShardedLruCache(size_t byteBudget = 0)
+        : shardBudget(byteBudget == 0 ? SIZE_MAX : std::max<size_t>(byteBudget / SHARD_COUNT, 1)) {
+        for (size_t i = 0; i < SHARD_COUNT; ++i) {
+            shards.push_back(std::make_unique<Shard>());
+        }
+    }
+
+    // Looks key up for the given catalog version and marks it recently used. A newer version
+    // than the shard's empties it first; an older one just misses.
+    bool find(uint64_t version, const Key& key, Value& value) {
+        Shard& shard = shardOf(key);
+        std::lock_guard<std::mutex> guard(shard.lock);
+        if (shard.version < version) {
+            resetShard(shard, version);
+        }
+        else if (shard.version == version) {
+            auto it = shard.index.find(key);
+            if (it != shard.index.end()) {
+                shard.lru.splice(shard.lru.begin(), shard.lru, it->second);
+                hits.fetch_add(1, std::memory_order_relaxed);
+                value = it->second->value;
+                return true;
+            }
+        }
+        misses.fetch_add(1, std::memory_order_relaxed);
+        return false;
+    }
+
+    // Stores a value computed from the given catalog version. bytes is what the entry costs.
+    void insert(uint64_t version, const Key& key, const Value& value, size_t bytes) {
+        Shard& shard = shardOf(key);
+        std::lock_guard<std::mutex> guard(shard.lock);
+        if (shard.version != version) {
+            if (shard.version > version) {
+                // a newer version already owns the shard; don't cache stale results into it
+                return;
+            }
+            resetShard(shard, version);
+        }
+        if (shard.index.count(key) != 0) {
+            return;
+        }
+        shard.lru.push_front(Entry{ key, value, bytes });
+        shard.index[key] = shard.lru.begin();
+        shard.bytes += bytes;
+        while (shard.bytes > shardBudget && shard.lru.size() > 1) {
+            Entry& cold = shard.lru.back();
+            shard.bytes -= cold.bytes;
+            shard.index.erase(cold.key);
+            shard.lru.pop_back();
+            evictions.fetch_add(1, std::memory_order_relaxed);
+        }
+    }
+
+    void clear() {
+        for (auto& shard : shards) {
+            std::lock_guard<std::mutex> guard(shard->lock);
+            resetShard(*shard, shard->version);
+        }
+    }
+
+    CacheStats stats() const {
+        CacheStats result;
+        result.hits = hits.load();
+        result.misses = misses.load();
+        result.evictions = evictions.load();
+        for (const auto& shard : shards) {
+            std::lock_guard<std::mutex> guard(shard->lock);
+            result.bytes += shard->bytes;
+            result.entries += shard->lru.size();
+        }
+        return result;
+    }
+};
@@ -0,0 +1,771 @@
+#pragma once
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <cstdio>
+#include <filesystem>
+#include <fstream>
+#include <functional>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <system_error>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+#include "Catalog.h"
+#include "CatalogLog.h"
+#include "DurableFile.h"
+#include "Library.h"
+#include "json.hpp"
+
+struct LsmOptions {
+    // flush the memtable to a new run once its entries take this many bytes
+    size_t memtableBytes = 4 * 1024 * 1024;
+    // compact once there are this many runs
+    size_t compactAt = 4;
+    // how fast compaction may write, 0 for no limit
+    size_t compactionBytesPerSecond = 16 * 1024 * 1024;
+    // fsync the log after every write; writers queued behind one share the next
+    bool syncWrites = true;
+    // publish edits as one catalog version at most this long after they're logged, 0 after every write
+    size_t publishMilliseconds = 10;
+};
+
+struct LsmStats {
+    size_t runs = 0;
+    size_t memtableEntries = 0;
+    size_t memtableBytes = 0;
+    // log writes, each followed by an fsync if syncWrites
+    uint64_t commits = 0;
+    uint64_t publishes = 0;
+    uint64_t flushes = 0;
+    uint64_t compactions = 0;
+    uint64_t compactedBytes = 0;
+    double compactionSeconds = 0;
+    std::string flushError;
+    std::string compactionError;
+};
+
+// One key of the store: the latest version of a book, or a tombstone saying it was removed
+struct LsmEntry {
+    bool removed = false;
+    Book book{ "", "", "", "" };
+};
+
+inline std::string encodeEntry(const LsmEntry& entry) {
+    std::string payload(1, entry.removed ? 1 : 0);
+    putString(payload, entry.book.getTitle());
+    putString(payload, entry.book.getAuthor().getName());
+    putString(payload, entry.book.getLanguage());
+    putString(payload, entry.book.getLink());
+    std::string record;
+    appendRecord(record, payload);
+    return record;
+}
+
+inline bool decodeEntry(const std::string& payload, LsmEntry& entry) {
+    std::string title, author, language, link;
+    const char* p = payload.data() + 1;
+    const char* end = payload.data() + payload.size();
+    if (payload.empty() || !getString(p, end, title) || !getString(p, end, author) || !getString(p, end, language)
+        || !getString(p, end, link)) {
+        return false;
+    }
+    entry.removed = payload[0] != 0;
+    entry.book = Book(title, author, link, language);
+    return true;
+}
+
+// Reads the entries of a run file in key order
+class RunReader {
+private:
+    std::ifstream in;
+    std::string path;
+    std::string buffer;
+    std::string payload;
+
+public:
+    explicit RunReader(const std::string& path) : in(path, std::ios::binary), path(path) {
+        if (!in) {
+            throw std::runtime_error("Error opening file: " + path);
+        }
+    }
+
+    // reads the next entry; false at the end of the run
+    bool next(LsmEntry& entry) {
+        char header[8];
+        if (!in.read(header, 8)) {
+            return false;
+        }
+        uint32_t length;
+        memcpy(&length, header, 4);
+        buffer.assign(header, 8);
+        buffer.resize(8 + static_cast<size_t>(length));
+        if (!in.read(&buffer[8], length) || readRecord(buffer, 0, payload) == 0 || !decodeEntry(payload, entry)) {
+            throw std::runtime_error("Corrupt run file: " + path);
+        }
+        return true;
+    }
+};
+
+// Merges runs, newest first, into one key-ordered stream where the newest entry of each key
+// wins. Tombstones are passed on unless dropRemoved, which is only safe when the oldest run
+// takes part.
+inline void mergeRuns(const std::vector<std::string>& paths, bool dropRemoved, const std::function<void(const LsmEntry&)>& emit) {
+    std::vector<std::unique_ptr<RunReader>> readers;
+    std::vector<LsmEntry> heads(paths.size());
+    std::vector<std::string> keys(paths.size());
+    std::vector<bool> live(paths.size());
+    for (size_t r = 0; r < paths.size(); ++r) {
+        readers.push_back(std::make_unique<RunReader>(paths[r]));
+        live[r] = readers[r]->next(heads[r]);
+        keys[r] = live[r] ? bookKey(heads[r].book) : std::string();
+    }
+    while (true) {
+        size_t newest = paths.size();
+        for (size_t r = 0; r < paths.size(); ++r) {
+            // strictly smaller keeps the newest run when keys tie
+            if (live[r] && (newest == paths.size() || keys[r] < keys[newest])) {
+                newest = r;
+            }
+        }
+        if (newest == paths.size()) {
+            return;
+        }
+        if (!(dropRemoved && heads[newest].removed)) {
+            emit(heads[newest]);
+        }
+        std::string key = keys[newest];
+        for (size_t r = 0; r < paths.size(); ++r) {
+            if (live[r] && keys[r] == key) {
+                live[r] = readers[r]->next(heads[r]);
+                keys[r] = live[r] ? bookKey(heads[r].book) : std::string();
+            }
+        }
+    }
+}
+
+// Log-structured store for catalogs under continuous edits. Edits are appended to a log and
+// kept in a sorted in-memory memtable; a full memtable is written out as an immutable
+// sorted run and the log starts over. A background thread merges the runs into one,
+// dropping overwritten books and tombstones, throttled to compactionBytesPerSecond so it
+// doesn't compete with queries for the disk. Books are keyed by title and author.
+//
+// Queries need the whole catalog in a Library, so the catalog is the merged view: opening
+// merges the runs and replays the log into it. Edits are applied at once to a staged copy,
+// which checks and numbers the edits after them, and only reach the catalog once logged:
+// writers queued behind a log write share the next one, and the staged copy is published
+// as one version every publishMilliseconds, so a stream of puts copies a chunk once per
+// publish rather than once per put. Runs are read only when opening and compacting.
+// Opening assigns ids in key order, so unlike CatalogLog ids hold only until the store is
+// reopened. A failed log write leaves the staged copy ahead of the log, so the store takes
+// no more edits and publishes nothing; reopening it brings back every acknowledged edit.
+//
+// The directory holds MANIFEST, which names the runs newest first and the current log, plus
+// the run-N and log-N files it names.
+class LsmStore : public CatalogWriter {
+private:
+    struct Pending {
+        uint64_t sequence;
+        std::vector<LsmEntry> entries;
+        std::string records;
+    };
+
+    Catalog& catalog;
+    std::string directory;
+    LsmOptions options;
+
+    std::mutex lock;
+    std::map<std::string, LsmEntry> memtable;
+    size_t memtableSize = 0;
+    // run file numbers, newest first
+    std::vector<uint64_t> runs;
+    uint64_t logNumber = 0;
+    uint64_t nextNumber = 1;
+    FILE* log = nullptr;
+    std::condition_variable committed;
+    std::vector<Pending> queued;
+    uint64_t nextSequence = 0;
+    uint64_t durableSequence = 0;
+    bool flushing = false;
+    std::string failure;
+    // the catalog with every edit applied, and the id of each of its books by key
+    Library<Book> staged;
+    std::unordered_map<std::string, BookId> ids;
+    // chunks of staged changed since the last publish, and whether it differs from the catalog
+    std::vector<size_t> stagedChunks;
+    bool unpublished = false;
+    std::chrono::steady_clock::time_point publishDue;
+    LsmStats counters;
+
+    std::condition_variable compactWake;
+    std::condition_variable publishWake;
+    std::atomic<bool> stopping{ false };
+    std::thread compactor;
+    std::thread publisher;
+
+    std::string pathOf(const std::string& kind, uint64_t number) const {
+        return directory + "/" + kind + "-" + std::to_string(number);
+    }
+
+    // atomically records the runs and log to use; called with lock held
+    void writeManifest(uint64_t currentLog, const std::vector<uint64_t>& currentRuns) {
+        std::string text = "log " + std::to_string(currentLog) + "\nnext " + std::to_string(nextNumber) + "\n";
+        for (uint64_t run : currentRuns) {
+            text += "run " + std::to_string(run) + "\n";
+        }
+        writeFileAtomically(directory + "/MANIFEST", text);
+    }
+
+    // Writes entries, added in key order, to a run file that appears only once it's complete
+    class RunWriter {
+    private:
+        std::string path;
+        std::string temporary;
+        FILE* out;
+        std::string buffer;
+        bool written = true;
+
+    public:
+        explicit RunWriter(const std::string& path) : path(path), temporary(path + ".tmp") {
+            out = fopen(temporary.c_str(), "wb");
+            if (out == nullptr) {
+                throw std::runtime_error("Error opening file: " + temporary);
+            }
+        }
+
+        ~RunWriter() {
+            if (out != nullptr) {
+                fclose(out);
+                std::filesystem::remove(temporary);
+            }
+        }
+
+        // returns the bytes the entry took
+        size_t add(const LsmEntry& entry) {
+            size_t before = buffer.size();
+            buffer += encodeEntry(entry);
+            size_t bytes = buffer.size() - before;
+            if (buffer.size() >= 1024 * 1024) {
+                written = written && fwrite(buffer.data(), 1, buffer.size(), out) == buffer.size();
+                buffer.clear();
+            }
+            return bytes;
+        }
+
+        void finish() {
+            written = written && fwrite(buffer.data(), 1, buffer.size(), out) == buffer.size() && syncFile(out);
+            fclose(out);
+            out = nullptr;
+            if (!written) {
+                std::filesystem::remove(temporary);
+                throw std::runtime_error("Error writing file: " + temporary);
+            }
+            std::filesystem::rename(temporary, path);
+        }
+    };
+
+    template <typename Entries>
+    void writeRun(uint64_t number, const Entries& entries) {
+        RunWriter writer(pathOf("run", number));
+        for (const auto& entry : entries) {
+            writer.add(entry);
+        }
+        writer.finish();
+    }
+
+    // a fresh directory starts with the seed catalog as its only run
+    void create(const std::string& seedPath) {
+        std::filesystem::create_directories(directory);
+        std::ifstream inFile(seedPath);
+        if (!inFile) {
+            throw std::runtime_error("Error opening file: " + seedPath);
+        }
+        nlohmann::json jsonData;
+        inFile >> jsonData;
+        std::map<std::string, LsmEntry> sorted;
+        for (const auto& bookData : jsonData) {
+            LsmEntry entry;
+            entry.book = Book(bookData);
+            sorted[bookKey(entry.book)] = entry;
+        }
+        std::vector<LsmEntry> entries;
+        for (const auto& item : sorted) {
+            entries.push_back(item.second);
+        }
+        writeRun(1, entries);
+        runs = { 1 };
+        logNumber = 2;
+        nextNumber = 3;
+        writeManifest(logNumber, runs);
+    }
+
+    // applies entry to library and the id index, as a put or a removal by key
+    void applyEntry(Library<Book>& library, const LsmEntry& entry, std::vector<size_t>& dirtyChunks) {
+        std::string key = bookKey(entry.book);
+        auto it = ids.find(key);
+        if (entry.removed) {
+            if (it == ids.end()) {
+                return;
+            }
+            BookId id = it->second;
+            ids.erase(it);
+            if (id != library.getSize() - 1) {
+                ids[bookKey(library.getItem(library.getSize() - 1))] = id;
+            }
+            dirtyChunks.push_back((library.getSize() - 1) / LIBRARY_CHUNK_SIZE);
+            library.swapRemove(id);
+            dirtyChunks.push_back(id / LIBRARY_CHUNK_SIZE);
+        }
+        else if (it != ids.end()) {
+            library.setItem(it->second, entry.book);
+            dirtyChunks.push_back(it->second / LIBRARY_CHUNK_SIZE);
+        }
+        else {
+            ids[key] = static_cast<BookId>(library.getSize());
+            library.addItem(entry.book);
+        }
+    }
+
+    void open(const std::string& seedPath) {
+        if (!std::filesystem::exists(directory + "/MANIFEST")) {
+            create(seedPath);
+        }
+        else {
+            std::ifstream manifest(directory + "/MANIFEST");
+            std::string kind;
+            uint64_t number;
+            while (manifest >> kind >> number) {
+                if (kind == "log") {
+                    logNumber = number;
+                }
+                else if (kind == "next") {
+                    nextNumber = number;
+                }
+                else if (kind == "run") {
+                    runs.push_back(number);
+                }
+            }
+        }
+
+        Library<Book> library;
+        std::vector<std::string> paths;
+        for (uint64_t run : runs) {
+            paths.push_back(pathOf("run", run));
+        }
+        mergeRuns(paths, true, [&](const LsmEntry& entry) {
+            ids[bookKey(entry.book)] = static_cast<BookId>(library.getSize());
+            library.addItem(entry.book);
+        });
+
+        std::string logPath = pathOf("log", logNumber);
+        std::ifstream inFile(logPath, std::ios::binary);
+        std::ostringstream contents;
+        contents << inFile.rdbuf();
+        std::string text = contents.str();
+        size_t offset = 0;
+        size_t used;
+        std::string payload;
+        std::vector<size_t> dirtyChunks;
+        while ((used = readRecord(text, offset, payload)) > 0) {
+            LsmEntry entry;
+            if (!decodeEntry(payload, entry)) {
+                break;
+            }
+            applyEntry(library, entry, dirtyChunks);
+            remember(entry);
+            offset += used;
+        }
+        if (offset < text.size()) {
+            // a crash cut the last write short; it was never acknowledged
+            std::filesystem::resize_file(logPath, offset);
+        }
+        catalog.replace(library);
+        staged = library;
+        log = fopen(logPath.c_str(), "ab");
+        if (log == nullptr) {
+            throw std::runtime_error("Error opening file: " + logPath);
+        }
+    }
+
+    void remember(const LsmEntry& entry) {
+        size_t bytes = entry.book.getTitle().size() + entry.book.getAuthor().getName().size() + entry.book.getLanguage().size()
+            + entry.book.getLink().size() + sizeof(LsmEntry) + 64;
+        memtable[bookKey(entry.book)] = entry;
+        memtableSize += bytes;
+    }
+
+    // publishes library, whose listed chunks changed since the last publish; called with lock held
+    void publish(const Library<Book>& library, std::vector<size_t> dirtyChunks) {
+        std::sort(dirtyChunks.begin(), dirtyChunks.end());
+        dirtyChunks.erase(std::unique(dirtyChunks.begin(), dirtyChunks.end()), dirtyChunks.end());
+        catalog.modify([&](CatalogSnapshot& next) {
+            next.library = library;
+            next.titles.refresh(next.library, dirtyChunks);
+            return true;
+        });
+        counters.publishes++;
+    }
+
+    // publishes staged if every edit in it is logged; called with lock held
+    void publishStaged() {
+        if (!unpublished || !failure.empty() || flushing || !queued.empty()) {
+            return;
+        }
+        unpublished = false;
+        publish(staged, std::move(stagedChunks));
+        stagedChunks.clear();
+    }
+
+    // Applies entries to staged and queues them for the log; called with lock held. Returns
+    // the sequence to wait for.
+    uint64_t stage(std::vector<LsmEntry> entries) {
+        for (const LsmEntry& entry : entries) {
+            applyEntry(staged, entry, stagedChunks);
+        }
+        if (!unpublished) {
+            unpublished = true;
+            publishDue = std::chrono::steady_clock::now() + std::chrono::milliseconds(options.publishMilliseconds);
+            publishWake.notify_one();
+        }
+        std::string records;
+        for (const LsmEntry& entry : entries) {
+            records += encodeEntry(entry);
+        }
+        queued.push_back(Pending{ ++nextSequence, std::move(entries), std::move(records) });
+        return nextSequence;
+    }
+
+    // Waits until the edits up to sequence mine are logged, leading the write if none is in
+    // flight. Called with guard holding lock.
+    void commit(std::unique_lock<std::mutex>& guard, uint64_t mine) {
+        while (durableSequence < mine) {
+            if (!failure.empty()) {
+                throw std::runtime_error("Store failed: " + failure);
+            }
+            if (flushing) {
+                committed.wait(guard);
+                continue;
+            }
+            // lead the next write with everything queued; staged then holds exactly what it logs
+            flushing = true;
+            std::vector<Pending> group = std::move(queued);
+            queued.clear();
+            std::unique_ptr<Library<Book>> cut;
+            std::vector<size_t> cutChunks;
+            if (unpublished && std::chrono::steady_clock::now() >= publishDue) {
+                // a steady stream of writers never leaves the queue empty, so take the publish along
+                cut = std::make_unique<Library<Book>>(staged);
+                cutChunks = std::move(stagedChunks);
+                stagedChunks.clear();
+                unpublished = false;
+            }
+            guard.unlock();
+            std::string batch;
+            for (const Pending& pending : group) {
+                batch += pending.records;
+            }
+            bool written = fwrite(batch.data(), 1, batch.size(), log) == batch.size() && fflush(log) == 0;
+            if (written && options.syncWrites) {
+                written = syncFile(log);
+            }
+            guard.lock();
+            if (!written) {
+                // the log may hold part of the batch and staged all of it, so neither can be used
+                flushing = false;
+                failure = "write or sync of " + pathOf("log", logNumber) + " failed";
+                committed.notify_all();
+                continue;
+            }
+            for (const Pending& pending : group) {
+                for (const LsmEntry& entry : pending.entries) {
+                    remember(entry);
+                }
+            }
+            durableSequence = group.back().sequence;
+            counters.commits++;
+            if (cut) {
+                publish(*cut, std::move(cutChunks));
+            }
+            else if (unpublished && std::chrono::steady_clock::now() >= publishDue && queued.empty()) {
+                unpublished = false;
+                publish(staged, std::move(stagedChunks));
+                stagedChunks.clear();
+            }
+            if (memtableSize >= options.memtableBytes) {
+                // the writes are logged either way; the next write tries again
+                try {
+                    flush();
+                    counters.flushError.clear();
+                }
+                catch (const std::exception& e) {
+                    counters.flushError = e.what();
+                }
+            }
+            flushing = false;
+            committed.notify_all();
+        }
+    }
+
+    // Writes the memtable out as the newest run and starts a new log. Called with lock held
+    // and no log write in flight; on failure the old log and runs stay in use.
+    void flush() {
+        if (memtable.empty()) {
+            return;
+        }
+        std::vector<LsmEntry> entries;
+        entries.reserve(memtable.size());
+        for (const auto& item : memtable) {
+            entries.push_back(item.second);
+        }
+        uint64_t run = nextNumber++;
+        uint64_t newLog = nextNumber++;
+        writeRun(run, entries);
+        std::error_code ignored;
+        FILE* next = fopen(pathOf("log", newLog).c_str(), "ab");
+        if (next == nullptr) {
+            std::filesystem::remove(pathOf("run", run), ignored);
+            throw std::runtime_error("Error opening file: " + pathOf("log", newLog));
+        }
+        std::vector<uint64_t> withRun = runs;
+        withRun.insert(withRun.begin(), run);
+        try {
+            writeManifest(newLog, withRun);
+        }
+        catch (...) {
+            fclose(next);
+            std::filesystem::remove(pathOf("log", newLog), ignored);
+            std::filesystem::remove(pathOf("run", run), ignored);
+            throw;
+        }
+        runs = withRun;
+        fclose(log);
+        log = next;
+        std::filesystem::remove(pathOf("log", logNumber), ignored);
+        logNumber = newLog;
+        memtable.clear();
+        memtableSize = 0;
+        counters.flushes++;
+        if (options.compactAt != 0 && runs.size() >= options.compactAt) {
+            compactWake.notify_one();
+        }
+    }
+
+    // publishes edits that no write took along once they're due
+    void publishLoop() {
+        std::unique_lock<std::mutex> guard(lock);
+        while (true) {
+            publishWake.wait(guard, [this] { return stopping || (unpublished && failure.empty()); });
+            if (stopping) {
+                return;
+            }
+            publishWake.wait_until(guard, publishDue, [this] { return stopping.load(); });
+            if (stopping) {
+                return;
+            }
+            if (flushing || !queued.empty()) {
+                // the write in flight publishes if it's still due when done
+                committed.wait(guard);
+                continue;
+            }
+            publishStaged();
+        }
+    }
+
+    // merges every run present when it starts into one, writing at most compactionBytesPerSecond
+    void compact(std::unique_lock<std::mutex>& guard) {
+        std::vector<uint64_t> inputs = runs;
+        uint64_t output = nextNumber++;
+        guard.unlock();
+        auto started = std::chrono::steady_clock::now();
+        std::vector<std::string> paths;
+        for (uint64_t run : inputs) {
+            paths.push_back(pathOf("run", run));
+        }
+        RunWriter writer(pathOf("run", output));
+        size_t bytes = 0;
+        size_t paced = 0;
+        mergeRuns(paths, true, [&](const LsmEntry& entry) {
+            bytes += writer.add(entry);
+            if (stopping) {
+                throw std::runtime_error("Compaction stopped");
+            }
+            // pace in 64KB steps; waking up for every entry costs queries more than it saves
+            if (options.compactionBytesPerSecond != 0 && bytes - paced >= 64 * 1024) {
+                paced = bytes;
+                auto due = started + std::chrono::duration<double>(static_cast<double>(bytes) / options.compactionBytesPerSecond);
+                if (due > std::chrono::steady_clock::now()) {
+                    std::this_thread::sleep_until(due);
+                }
+            }
+        });
+        writer.finish();
+        guard.lock();
+        // runs flushed while compacting are newer than every input and stay in front
+        std::vector<uint64_t> merged(runs.begin(), runs.end() - inputs.size());
+        merged.push_back(output);
+        try {
+            writeManifest(logNumber, merged);
+        }
+        catch (...) {
+            std::error_code ignored;
+            std::filesystem::remove(pathOf("run", output), ignored);
+            throw;
+        }
+        runs = merged;
+        for (uint64_t run : inputs) {
+            std::filesystem::remove(pathOf("run", run));
+        }
+        counters.compactions++;
+        counters.compactedBytes += bytes;
+        counters.compactionSeconds += std::chrono::duration<double>(std::chrono::steady_clock::now() - started).count();
+    }
+
+    void compactLoop() {
+        std::unique_lock<std::mutex> guard(lock);
+        while (true) {
+            compactWake.wait(guard, [this] { return stopping || runs.size() >= options.compactAt; });
+            if (stopping) {
+                return;
+            }
+            try {
+                compact(guard);
+            }
+            catch (const std::exception& e) {
+                if (!guard.owns_lock()) {
+                    guard.lock();
+                }
+                counters.compactionError = e.what();
+                // wait for the next flush rather than retrying a failing merge in a loop
+                compactWake.wait(guard);
+            }
+        }
+    }
+
+public:
+    // Opens the store in directory, creating it from the seed catalog file if it's new
+    LsmStore(Catalog& catalog, const std::string& seedPath, const std::string& directory, LsmOptions options = LsmOptions())
+        : catalog(catalog), directory(directory), options(options) {
+        open(seedPath);
+        if (options.compactAt != 0) {
+            compactor = std::thread([this] { compactLoop(); });
+        }
+        if (options.publishMilliseconds != 0) {
+            publisher = std::thread([this] { publishLoop(); });
+        }
+    }
+
+    ~LsmStore() {
+        {
+            std::lock_guard<std::mutex> guard(lock);
+            stopping = true;
+        }
+        compactWake.notify_one();
+        publishWake.notify_one();
+        committed.notify_all();
+        if (compactor.joinable()) {
+            compactor.join();
+        }
+        if (publisher.joinable()) {
+            publisher.join();
+        }
+        // what's logged reaches the catalog, which may outlive the store
+        publishStaged();
+        if (log != nullptr) {
+            fclose(log);
+        }
+    }
+
+    LsmStore(const LsmStore&) = delete;
+    LsmStore& operator=(const LsmStore&) = delete;
+
+    // Adds book, or replaces the book with the same title and author. Returns its id.
+    BookId addBook(const Book& book) override {
+        std::unique_lock<std::mutex> guard(lock);
+        if (!failure.empty()) {
+            throw std::runtime_error("Store failed: " + failure);
+        }
+        LsmEntry entry;
+        entry.book = book;
+        uint64_t mine = stage({ entry });
+        // later edits may move the book while this one waits for the log
+        BookId id = ids.at(bookKey(book));
+        commit(guard, mine);
+        return id;
+    }
+
+    // Replaces book id. A new title or author moves the book to its new key.
+    void updateBook(BookId id, const Book& book) override {
+        std::unique_lock<std::mutex> guard(lock);
+        if (!failure.empty()) {
+            throw std::runtime_error("Store failed: " + failure);
+        }
+        if (id >= staged.getSize()) {
+            throw std::runtime_error("No book with id " + std::to_string(id));
+        }
+        Book old = staged.getItem(id);
+        std::string key = bookKey(book);
+        if (key == bookKey(old)) {
+            LsmEntry entry;
+            entry.book = book;
+            commit(guard, stage({ entry }));
+            return;
+        }
+        if (ids.count(key) != 0) {
+            throw std::runtime_error("Another book already has this title and author");
+        }
+        // the book keeps its id: the index moves to the new key before the tombstone applies
+        ids[key] = id;
+        ids.erase(bookKey(old));
+        LsmEntry removal;
+        removal.removed = true;
+        removal.book = old;
+        LsmEntry entry;
+        entry.book = book;
+        commit(guard, stage({ removal, entry }));
+    }
+
+    // removes book id; the last book takes over its id
+    void removeBook(BookId id) override {
+        std::unique_lock<std::mutex> guard(lock);
+        if (!failure.empty()) {
+            throw std::runtime_error("Store failed: " + failure);
+        }
+        if (id >= staged.getSize()) {
+            throw std::runtime_error("No book with id " + std::to_string(id));
+        }
+        LsmEntry removal;
+        removal.removed = true;
+        removal.book = staged.getItem(id);
+        commit(guard, stage({ removal }));
+    }
+
+    // publishes every edit logged so far without waiting for publishMilliseconds
+    void publishNow() {
+        std::unique_lock<std::mutex> guard(lock);
+        committed.wait(guard, [this] { return !failure.empty() || (!flushing && queued.empty()); });
+        publishStaged();
+    }
+
+    // writes the memtable out as a run now, e.g. before a planned shutdown
+    void flushNow() {
+        std::unique_lock<std::mutex> guard(lock);
+        committed.wait(guard, [this] { return !flushing; });
+        flush();
+    }
+
+    LsmStats stats() {
+        std::lock_guard<std::mutex> guard(lock);
+        LsmStats result = counters;
+        result.runs = runs.size();
+        result.memtableEntries = memtable.size();
+        result.memtableBytes = memtableSize;
+        return result;
+    }
+};
@@ -0,0 +1,220 @@
+#pragma once
+#include <algorithm>
+#include <cstdint>
+#include <cstdio>
+#include <functional>
+#include <map>
+#include <mutex>
+#include <ostream>
+#include <string>
+#include <utility>
+#include <vector>
+#include "json.hpp"
+#include "Metrics.h"
+#include "Platform.h"
+
+// Size estimators. They count what the data structures hold, element by element, with the
+// node layout of the common standard libraries; malloc's own headers and free space aren't
+// counted, so resident memory always runs somewhat above their sum.
+
+// heap bytes a string owns beyond its own object, 0 while it's short enough to live inside it
+inline size_t stringHeapBytes(const std::string& text) {
+    static const size_t inlineCapacity = std::string().capacity();
+    return text.capacity() > inlineCapacity ? text.capacity() + 1 : 0;
+}
+
+// heap bytes of a vector's buffer, not what its elements own
+template <typename T>
+size_t vectorBytes(const std::vector<T>& items) {
+    return items.capacity() * sizeof(T);
+}
+
+// heap bytes of a std::map or std::set's nodes, not what their entries own
+template <typename Tree>
+size_t treeBytes(const Tree& tree) {
+    // parent, left, right and color in front of every entry
+    return tree.size() * (sizeof(typename Tree::value_type) + 4 * sizeof(void*));
+}
+
+// heap bytes of an unordered container's buckets and nodes, not what their entries own
+template <typename Hash>
+size_t hashBytes(const Hash& hash) {
+    // next pointer and cached hash code in front of every entry
+    return hash.bucket_count() * sizeof(void*) + hash.size() * (sizeof(typename Hash::value_type) + 2 * sizeof(void*));
+}
+
+// heap bytes a parsed JSON value owns beyond the value itself
+inline size_t jsonHeapBytes(const nlohmann::json& value) {
+    switch (value.type()) {
+    case nlohmann::json::value_t::string:
+        return sizeof(std::string) + stringHeapBytes(value.get_ref<const std::string&>());
+    case nlohmann::json::value_t::array: {
+        const auto& items = value.get_ref<const nlohmann::json::array_t&>();
+        size_t total = sizeof(items) + vectorBytes(items);
+        for (const auto& item : items) {
+            total += jsonHeapBytes(item);
+        }
+        return total;
+    }
+    case nlohmann::json::value_t::object: {
+        const auto& members = value.get_ref<const nlohmann::json::object_t&>();
+        size_t total = sizeof(members) + treeBytes(members);
+        for (const auto& member : members) {
+            total += stringHeapBytes(member.first) + jsonHeapBytes(member.second);
+        }
+        return total;
+    }
+    default:
+        return 0;
+    }
+}
+
+// bytes a parsed JSON document takes, e.g. a whole catalog between parsing and building books
+inline size_t jsonBytes(const nlohmann::json& document) {
+    return sizeof(document) + jsonHeapBytes(document);
+}
+
+// What each part of the program holds in memory, by component name, e.g. "catalog.strings".
+// Parts register an estimator for as long as they live; several registered under one name add
+// up. Memory that only lives for a moment, like the JSON document of a load, is kept as the
+// largest size seen instead. Every component is exported as books_memory_bytes and every peak
+// as books_memory_peak_bytes, labelled with the component.
+class MemoryAccounts {
+private:
+    struct Estimator {
+        uint64_t id;
+        std::string component;
+        std::function<size_t()> bytes;
+    };
+
+    // also held while estimators run, so one can't be unregistered while it runs
+    mutable std::mutex lock;
+    std::vector<Estimator> estimators;
+    std::map<std::string, size_t> peaks;
+    uint64_t nextId = 1;
+
+    MemoryAccounts() = default;
+
+    void unregister(uint64_t id) {
+        std::lock_guard<std::mutex> guard(lock);
+        estimators.erase(std::remove_if(estimators.begin(), estimators.end(), [id](const Estimator& e) { return e.id == id; }),
+            estimators.end());
+    }
+
+public:
+    // Keeps an estimator registered until it's destroyed
+    class Registration {
+    private:
+        uint64_t id = 0;
+
+    public:
+        Registration() = default;
+        explicit Registration(uint64_t id) : id(id) {}
+
+        Registration(Registration&& other) noexcept : id(other.id) {
+            other.id = 0;
+        }
+
+        Registration& operator=(Registration&& other) noexcept {
+            std::swap(id, other.id);
+            return *this;
+        }
+
+        ~Registration() {
+            if (id != 0) {
+                MemoryAccounts::shared().unregister(id);
+            }
+        }
+    };
+
+    // never destroyed, as the metrics registry reads it for as long as the process runs
+    static MemoryAccounts& shared() {
+        static MemoryAccounts* accounts = new MemoryAccounts();
+        return *accounts;
+    }
+
+    // Counts bytes() under component until the registration is destroyed. bytes runs under
+    // this registry's lock, so it must not register anything itself.
+    Registration track(const std::string& component, std::function<size_t()> bytes) {
+        MetricsRegistry::shared().gaugeFunction("books_memory_bytes{component=\"" + component + "\"}",
+            "Estimated bytes held by each component", [component] { return static_cast<double>(MemoryAccounts::shared().bytesOf(component)); });
+        std::lock_guard<std::mutex> guard(lock);
+        estimators.push_back({ nextId, component, std::move(bytes) });
+        return Registration(nextId++);
+    }
+
+    // keeps the largest bytes seen for component, for memory that is freed right after use
+    void notePeak(const std::string& component, size_t bytes) {
+        {
+            std::lock_guard<std::mutex> guard(lock);
+            auto it = peaks.find(component);
+            if (it != peaks.end()) {
+                it->second = std::max(it->second, bytes);
+                return;
+            }
+            peaks[component] = bytes;
+        }
+        MetricsRegistry::shared().gaugeFunction("books_memory_peak_bytes{component=\"" + component + "\"}",
+            "Largest estimated bytes of short-lived data, e.g. a load's JSON document", [component] {
+                return static_cast<double>(MemoryAccounts::shared().peakOf(component));
+            });
+    }
+
+    size_t bytesOf(const std::string& component) const {
+        std::lock_guard<std::mutex> guard(lock);
+        size_t total = 0;
+        for (const Estimator& estimator : estimators) {
+            if (estimator.component == component) {
+                total += estimator.bytes();
+            }
+        }
+        return total;
+    }
+
+    size_t peakOf(const std::string& component) const {
+        std::lock_guard<std::mutex> guard(lock);
+        auto it = peaks.find(component);
+        return it == peaks.end() ? 0 : it->second;
+    }
+
+    // every registered component and its bytes, by name
+    std::map<std::string, size_t> measure() const {
+        std::lock_guard<std::mutex> guard(lock);
+        std::map<std::string, size_t> bytes;
+        for (const Estimator& estimator : estimators) {
+            bytes[estimator.component] += estimator.bytes();
+        }
+        return bytes;
+    }
+
+    // One line per component with its bytes, bytes per book of a catalog of books, and share
+    // of the total, then the total against resident memory and the peaks
+    void writeReport(std::ostream& out, size_t books) const {
+        std::map<std::string, size_t> bytes = measure();
+        size_t total = 0;
+        for (const auto& entry : bytes) {
+            total += entry.second;
+        }
+        double perBook = books == 0 ? 0.0 : 1.0 / books;
+        char line[160];
+        snprintf(line, sizeof(line), "%-24s %14s %12s %7s\n", "memory", "bytes", "bytes/book", "share");
+        out << line;
+        for (const auto& entry : bytes) {
+            snprintf(line, sizeof(line), "%-24s %14zu %12.1f %6.1f%%\n", entry.first.c_str(), entry.second, entry.second * perBook,
+                total == 0 ? 0.0 : 100.0 * entry.second / total);
+            out << line;
+        }
+        size_t resident = residentMemoryBytes();
+        snprintf(line, sizeof(line), "%-24s %14zu %12.1f\n", "accounted", total, total * perBook);
+        out << line;
+        if (resident != 0) {
+            snprintf(line, sizeof(line), "%-24s %14zu %12.1f\n", "resident", resident, resident * perBook);
+            out << line;
+        }
+        std::lock_guard<std::mutex> guard(lock);
+        for (const auto& entry : peaks) {
+            snprintf(line, sizeof(line), "%-24s %14zu %12.1f  peak\n", entry.first.c_str(), entry.second, entry.second * perBook);
+            out << line;
+        }
+    }
+};
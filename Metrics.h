@@ -0,0 +1,394 @@
+#pragma once
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <cstdio>
+#include <functional>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <vector>
+#include "DurableFile.h"
+#include "Histogram.h"
+#include "Platform.h"
+
+namespace detail {
+    // Metric slots of one thread, written only by that thread and summed by readers. Chunks
+    // are allocated the first time the thread touches one of their slots.
+    class MetricCells {
+    public:
+        static constexpr size_t CHUNK_SLOTS = 1024;
+        static constexpr size_t CHUNKS = 64;
+
+    private:
+        std::atomic<std::atomic<uint64_t>*> chunks[CHUNKS];
+
+        std::atomic<uint64_t>* allocate(size_t index) {
+            std::atomic<uint64_t>* chunk = new std::atomic<uint64_t>[CHUNK_SLOTS]();
+            chunks[index].store(chunk, std::memory_order_release);
+            return chunk;
+        }
+
+    public:
+        MetricCells() {
+            for (auto& chunk : chunks) {
+                chunk.store(nullptr, std::memory_order_relaxed);
+            }
+        }
+
+        ~MetricCells() {
+            for (auto& chunk : chunks) {
+                delete[] chunk.load(std::memory_order_relaxed);
+            }
+        }
+
+        MetricCells(const MetricCells&) = delete;
+        MetricCells& operator=(const MetricCells&) = delete;
+
+        // adds amount to slot; only the owning thread may call it, so no read-modify-write
+        void add(size_t slot, uint64_t amount) {
+            std::atomic<uint64_t>* chunk = chunks[slot / CHUNK_SLOTS].load(std::memory_order_acquire);
+            if (chunk == nullptr) {
+                chunk = allocate(slot / CHUNK_SLOTS);
+            }
+            std::atomic<uint64_t>& cell = chunk[slot % CHUNK_SLOTS];
+            cell.store(cell.load(std::memory_order_relaxed) + amount, std::memory_order_relaxed);
+        }
+
+        uint64_t read(size_t slot) const {
+            std::atomic<uint64_t>* chunk = chunks[slot / CHUNK_SLOTS].load(std::memory_order_acquire);
+            return chunk == nullptr ? 0 : chunk[slot % CHUNK_SLOTS].load(std::memory_order_relaxed);
+        }
+    };
+}
+
+// Counts something that only goes up, e.g. queries run
+class Counter {
+private:
+    size_t slot;
+
+public:
+    explicit Counter(size_t slot) : slot(slot) {}
+
+    void add(uint64_t amount = 1) const;
+};
+
+// A value that goes up and down, e.g. the books in the catalog, set wherever it changes
+class Gauge {
+private:
+    std::atomic<int64_t>* value;
+
+public:
+    explicit Gauge(std::atomic<int64_t>* value) : value(value) {}
+
+    void set(int64_t to) const {
+        value->store(to, std::memory_order_relaxed);
+    }
+
+    void add(int64_t amount) const {
+        value->fetch_add(amount, std::memory_order_relaxed);
+    }
+};
+
+// Distribution of some value, normally a latency in nanoseconds, in the buckets of
+// LatencyHistogram; exported as a summary with its 0.5, 0.9 and 0.99 quantiles
+class Histogram {
+private:
+    // the buckets, then the sum of the values
+    size_t firstSlot;
+
+public:
+    explicit Histogram(size_t firstSlot) : firstSlot(firstSlot) {}
+
+    void record(uint64_t value) const;
+};
+
+// Metrics of the whole process, exported in the Prometheus text format. Counters and
+// histograms live in slots that each thread has its own copy of, so recording one is a plain
+// load and store of the thread's slot, a few ns, with no lock or shared cache line; reading
+// sums the slot over every thread. A thread's slots outlive it and go to the next new thread,
+// so nothing counted is lost and the number of copies stays at the most threads at once.
+//
+// Names may carry Prometheus labels, e.g. books_cache_hits_total{cache="query"}. Registering
+// a name again returns the same metric, so call sites can keep theirs in a static local.
+class MetricsRegistry {
+private:
+    enum Kind { COUNTER, GAUGE, SUMMARY };
+
+    struct Series {
+        size_t slot = 0;
+        std::unique_ptr<std::atomic<int64_t>> gauge;
+        std::function<double()> read;
+        // exported values are multiplied by it, e.g. 1e-9 for nanoseconds as seconds
+        double scale = 1.0;
+    };
+
+    struct Family {
+        Kind kind;
+        std::string help;
+        // by labels, without braces
+        std::map<std::string, Series> series;
+    };
+
+    mutable std::mutex lock;
+    std::map<std::string, Family> families;
+    size_t nextSlot = 0;
+    std::vector<std::unique_ptr<detail::MetricCells>> cells;
+    // cells of threads that have exited, waiting for a new thread
+    std::vector<detail::MetricCells*> idle;
+
+    MetricsRegistry() {
+        gaugeFunction("process_resident_memory_bytes", "Resident memory of the process", [] {
+            return static_cast<double>(residentMemoryBytes());
+        });
+    }
+
+    // series for name, creating it and slots of it with kind if it's new
+    Series& seriesOf(const std::string& name, Kind kind, const std::string& help, size_t slots, bool& created) {
+        size_t brace = name.find('{');
+        std::string family = name.substr(0, brace);
+        std::string labels = brace == std::string::npos ? "" : name.substr(brace + 1, name.size() - brace - 2);
+        auto found = families.find(family);
+        if (found == families.end()) {
+            found = families.emplace(family, Family{ kind, help, {} }).first;
+        }
+        else if (found->second.kind != kind) {
+            throw std::runtime_error("Metric registered with two types: " + family);
+        }
+        auto it = found->second.series.find(labels);
+        created = it == found->second.series.end();
+        if (created) {
+            if (nextSlot + slots > detail::MetricCells::CHUNKS * detail::MetricCells::CHUNK_SLOTS) {
+                throw std::runtime_error("Too many metrics: " + name);
+            }
+            it = found->second.series.emplace(labels, Series()).first;
+            it->second.slot = nextSlot;
+            nextSlot += slots;
+        }
+        return it->second;
+    }
+
+    uint64_t sum(size_t slot) const {
+        uint64_t total = 0;
+        for (const auto& owned : cells) {
+            total += owned->read(slot);
+        }
+        return total;
+    }
+
+    detail::MetricCells* acquire() {
+        std::lock_guard<std::mutex> guard(lock);
+        if (!idle.empty()) {
+            detail::MetricCells* reused = idle.back();
+            idle.pop_back();
+            return reused;
+        }
+        cells.push_back(std::make_unique<detail::MetricCells>());
+        return cells.back().get();
+    }
+
+    void release(detail::MetricCells* exited) {
+        std::lock_guard<std::mutex> guard(lock);
+        idle.push_back(exited);
+    }
+
+    static void appendValue(std::string& out, const std::string& name, const std::string& labels, double value) {
+        char number[32];
+        snprintf(number, sizeof(number), "%.10g", value);
+        out += name;
+        if (!labels.empty()) {
+            out += '{';
+            out += labels;
+            out += '}';
+        }
+        out += ' ';
+        out += number;
+        out += '\n';
+    }
+
+public:
+    // never destroyed, so threads exiting during shutdown can still hand back their cells
+    static MetricsRegistry& shared() {
+        static MetricsRegistry* registry = new MetricsRegistry();
+        return *registry;
+    }
+
+    // slots of the calling thread
+    detail::MetricCells& local() {
+        struct Lease {
+            detail::MetricCells* cells = nullptr;
+            ~Lease() {
+                if (cells != nullptr) {
+                    MetricsRegistry::shared().release(cells);
+                }
+            }
+        };
+        thread_local Lease lease;
+        if (lease.cells == nullptr) {
+            lease.cells = acquire();
+        }
+        return *lease.cells;
+    }
+
+    Counter counter(const std::string& name, const std::string& help) {
+        std::lock_guard<std::mutex> guard(lock);
+        bool created;
+        return Counter(seriesOf(name, COUNTER, help, 1, created).slot);
+    }
+
+    Gauge gauge(const std::string& name, const std::string& help) {
+        std::lock_guard<std::mutex> guard(lock);
+        bool created;
+        Series& series = seriesOf(name, GAUGE, help, 0, created);
+        if (created) {
+            series.gauge = std::make_unique<std::atomic<int64_t>>(0);
+        }
+        return Gauge(series.gauge.get());
+    }
+
+    // a gauge read by calling read whenever metrics are exported; read must stay callable for
+    // the life of the process
+    void gaugeFunction(const std::string& name, const std::string& help, std::function<double()> read) {
+        std::lock_guard<std::mutex> guard(lock);
+        bool created;
+        Series& series = seriesOf(name, GAUGE, help, 0, created);
+        if (created) {
+            series.read = std::move(read);
+        }
+    }
+
+    // scale converts recorded values to exported ones, e.g. 1e-9 for ns recorded as seconds
+    Histogram histogram(const std::string& name, const std::string& help, double scale = 1e-9) {
+        std::lock_guard<std::mutex> guard(lock);
+        bool created;
+        Series& series = seriesOf(name, SUMMARY, help, LatencyHistogram::bucketCount() + 1, created);
+        if (created) {
+            series.scale = scale;
+        }
+        return Histogram(series.slot);
+    }
+
+    // Every metric in the Prometheus text exposition format, version 0.0.4. Gauge functions
+    // run after the lock is released, so they may take locks of their own.
+    std::string prometheusText() const {
+        // text so far, then a gauge function whose value comes next
+        struct Piece {
+            std::string text;
+            std::string name;
+            std::string labels;
+            std::function<double()> read;
+        };
+        std::vector<Piece> pieces(1);
+        {
+            std::lock_guard<std::mutex> guard(lock);
+            for (const auto& entry : families) {
+                const std::string& name = entry.first;
+                const Family& family = entry.second;
+                std::string& out = pieces.back().text;
+                out += "# HELP " + name + " " + family.help + "\n";
+                out += std::string("# TYPE ") + name + (family.kind == COUNTER ? " counter\n" : family.kind == GAUGE ? " gauge\n" : " summary\n");
+                for (const auto& item : family.series) {
+                    const std::string& labels = item.first;
+                    const Series& series = item.second;
+                    std::string& text = pieces.back().text;
+                    if (family.kind == COUNTER) {
+                        appendValue(text, name, labels, static_cast<double>(sum(series.slot)));
+                    }
+                    else if (family.kind == GAUGE && series.read) {
+                        pieces.back().name = name;
+                        pieces.back().labels = labels;
+                        pieces.back().read = series.read;
+                        pieces.emplace_back();
+                    }
+                    else if (family.kind == GAUGE) {
+                        appendValue(text, name, labels, static_cast<double>(series.gauge->load(std::memory_order_relaxed)));
+                    }
+                    else {
+                        LatencyHistogram merged;
+                        for (size_t i = 0; i < LatencyHistogram::bucketCount(); ++i) {
+                            uint64_t count = sum(series.slot + i);
+                            if (count != 0) {
+                                merged.record(LatencyHistogram::bucketLow(i), count);
+                            }
+                        }
+                        std::string separator = labels.empty() ? "" : ",";
+                        for (const char* quantile : { "0.5", "0.9", "0.99" }) {
+                            appendValue(text, name, labels + separator + "quantile=\"" + quantile + "\"",
+                                static_cast<double>(merged.percentile(std::stod(quantile))) * series.scale);
+                        }
+                        appendValue(text, name + "_sum", labels, static_cast<double>(sum(series.slot + LatencyHistogram::bucketCount())) * series.scale);
+                        appendValue(text, name + "_count", labels, static_cast<double>(merged.count()));
+                    }
+                }
+            }
+        }
+        std::string out;
+        for (const Piece& piece : pieces) {
+            out += piece.text;
+            if (piece.read) {
+                appendValue(out, piece.name, piece.labels, piece.read());
+            }
+        }
+        return out;
+    }
+};
+
+inline void Counter::add(uint64_t amount) const {
+    MetricsRegistry::shared().local().add(slot, amount);
+}
+
+inline void Histogram::record(uint64_t value) const {
+    detail::MetricCells& cells = MetricsRegistry::shared().local();
+    cells.add(firstSlot + LatencyHistogram::bucketOf(value), 1);
+    cells.add(firstSlot + LatencyHistogram::bucketCount(), value);
+}
+
+// Writes the metrics to a file every interval, replacing it atomically, as the node exporter's
+// textfile collector expects, and once more when destroyed
+class MetricsDumper {
+private:
+    std::string path;
+    std::chrono::milliseconds interval;
+    std::mutex lock;
+    std::condition_variable wake;
+    bool stopping = false;
+    std::thread writer;
+
+    void dump() {
+        try {
+            writeFileAtomically(path, MetricsRegistry::shared().prometheusText());
+        }
+        catch (const std::exception&) {
+            // the next dump tries again
+        }
+    }
+
+public:
+    MetricsDumper(const std::string& path, std::chrono::milliseconds interval) : path(path), interval(interval) {
+        writer = std::thread([this] {
+            std::unique_lock<std::mutex> guard(lock);
+            while (!wake.wait_for(guard, this->interval, [this] { return stopping; })) {
+                guard.unlock();
+                dump();
+                guard.lock();
+            }
+        });
+    }
+
+    ~MetricsDumper() {
+        {
+            std::lock_guard<std::mutex> guard(lock);
+            stopping = true;
+        }
+        wake.notify_all();
+        writer.join();
+        dump();
+    }
+
+    MetricsDumper(const MetricsDumper&) = delete;
+    MetricsDumper& operator=(const MetricsDumper&) = delete;
+};
@@ -0,0 +1,96 @@
+#pragma once
+#include <cstdint>
+#include <cstdio>
+#include <map>
+#include <ostream>
+#include <string>
+#include "json.hpp"
+#include "Platform.h"
+
+// Hardware counters of the calling thread, opened the first time the thread asks for them
+inline HardwareCounters& threadCounters() {
+    thread_local HardwareCounters counters;
+    return counters;
+}
+
+// Hardware events summed over a number of operations, to be reported per operation
+struct CounterTotals {
+    uint64_t ops = 0;
+    uint64_t cycles = 0;
+    uint64_t instructions = 0;
+    uint64_t llcMisses = 0;
+    uint64_t branchMisses = 0;
+
+    // adds ops operations that ran between the samples begin and end
+    void add(const CounterSample& begin, const CounterSample& end, uint64_t ops = 1) {
+        this->ops += ops;
+        cycles += end.cycles - begin.cycles;
+        instructions += end.instructions - begin.instructions;
+        llcMisses += end.llcMisses - begin.llcMisses;
+        branchMisses += end.branchMisses - begin.branchMisses;
+    }
+
+    void merge(const CounterTotals& other) {
+        ops += other.ops;
+        cycles += other.cycles;
+        instructions += other.instructions;
+        llcMisses += other.llcMisses;
+        branchMisses += other.branchMisses;
+    }
+
+    double perOp(uint64_t events) const {
+        return ops == 0 ? 0.0 : static_cast<double>(events) / ops;
+    }
+
+    // instructions per cycle
+    double ipc() const {
+        return cycles == 0 ? 0.0 : static_cast<double>(instructions) / cycles;
+    }
+};
+
+// Counts the hardware events of the calling thread from construction until stop(), if enabled
+// and its counters are available. Disabled, it touches no counters at all.
+class CounterScope {
+private:
+    CounterSample begin;
+    bool counting;
+
+public:
+    explicit CounterScope(bool enabled = true) : counting(enabled && threadCounters().read(begin)) {}
+
+    // adds what was counted, as ops operations, to totals
+    void stop(CounterTotals& totals, uint64_t ops = 1) {
+        CounterSample end;
+        if (counting && threadCounters().read(end)) {
+            totals.add(begin, end, ops);
+        }
+        counting = false;
+    }
+};
+
+// Per operation figures of totals as JSON
+inline nlohmann::json counterJson(const CounterTotals& totals) {
+    nlohmann::json result;
+    result["ops"] = totals.ops;
+    result["cyclesPerOp"] = totals.perOp(totals.cycles);
+    result["instructionsPerOp"] = totals.perOp(totals.instructions);
+    result["ipc"] = totals.ipc();
+    result["llcMissesPerOp"] = totals.perOp(totals.llcMisses);
+    result["branchMissesPerOp"] = totals.perOp(totals.branchMisses);
+    return result;
+}
+
+// one line per operation kind: count, cycles, instructions, IPC, LLC and branch misses per op
+inline void writeCounterTable(std::ostream& out, const std::map<std::string, CounterTotals>& byKind) {
+    char line[192];
+    snprintf(line, sizeof(line), "%-28s %10s %12s %12s %6s %10s %10s\n", "kind", "ops", "cycles/op", "instr/op", "IPC",
+        "LLC miss", "br miss");
+    out << line;
+    for (const auto& entry : byKind) {
+        const CounterTotals& totals = entry.second;
+        snprintf(line, sizeof(line), "%-28s %10llu %12.0f %12.0f %6.2f %10.2f %10.2f\n", entry.first.c_str(),
+            static_cast<unsigned long long>(totals.ops), totals.perOp(totals.cycles), totals.perOp(totals.instructions),
+            totals.ipc(), totals.perOp(totals.llcMisses), totals.perOp(totals.branchMisses));
+        out << line;
+    }
+}
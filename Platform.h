@@ -0,0 +1,344 @@
+#pragma once
+#include <cstdint>
+#include <cstdio>
+#include <ctime>
+#include <string>
+#ifdef _WIN32
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#include <Windows.h>
+#include <conio.h>
+#include <io.h>
+#include <shellapi.h>
+#include <psapi.h>
+#else
+#include <cerrno>
+#include <fcntl.h>
+#include <poll.h>
+#include <spawn.h>
+#include <sys/wait.h>
+#include <termios.h>
+#include <unistd.h>
+#ifdef __APPLE__
+#include <mach/mach.h>
+#endif
+#ifdef __linux__
+#include <cstring>
+#include <linux/perf_event.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#endif
+extern char** environ;
+#endif
+
+// Everything that differs between Windows and POSIX systems. The rest of the code calls
+// these and includes no system headers of its own for them, so porting means this file.
+
+// Forces everything written to file down to the disk; false if the disk didn't take it,
+// in which case the data must not be treated as durable
+inline bool syncFile(FILE* file) {
+    if (fflush(file) != 0) {
+        return false;
+    }
+#ifdef _WIN32
+    return _commit(_fileno(file)) == 0;
+#else
+    return fsync(fileno(file)) == 0;
+#endif
+}
+
+// Makes a rename inside directory durable, false if it couldn't; Windows has no equivalent
+// and needs none
+inline bool syncDirectory(const std::string& directory) {
+#ifndef _WIN32
+    int fd = open(directory.c_str(), O_RDONLY);
+    if (fd < 0) {
+        return false;
+    }
+    bool synced = fsync(fd) == 0;
+    close(fd);
+    return synced;
+#else
+    (void)directory;
+    return true;
+#endif
+}
+
+// time as UTC calendar fields
+inline std::tm utcTime(std::time_t time) {
+    std::tm utc;
+#ifdef _WIN32
+    gmtime_s(&utc, &time);
+#else
+    gmtime_r(&time, &utc);
+#endif
+    return utc;
+}
+
+// Bytes of the process's memory that are in RAM, or 0 if the system won't say
+inline size_t residentMemoryBytes() {
+#ifdef _WIN32
+    PROCESS_MEMORY_COUNTERS counters;
+    if (GetProcessMemoryInfo(GetCurrentProcess(), &counters, sizeof(counters))) {
+        return counters.WorkingSetSize;
+    }
+    return 0;
+#elif defined(__APPLE__)
+    mach_task_basic_info_data_t info;
+    mach_msg_type_number_t count = MACH_TASK_BASIC_INFO_COUNT;
+    if (task_info(mach_task_self(), MACH_TASK_BASIC_INFO, reinterpret_cast<task_info_t>(&info), &count) == KERN_SUCCESS) {
+        return info.resident_size;
+    }
+    return 0;
+#else
+    FILE* statm = fopen("/proc/self/statm", "r");
+    if (statm == nullptr) {
+        return 0;
+    }
+    unsigned long long pages = 0;
+    unsigned long long resident = 0;
+    int read = fscanf(statm, "%llu %llu", &pages, &resident);
+    fclose(statm);
+    return read == 2 ? static_cast<size_t>(resident * sysconf(_SC_PAGESIZE)) : 0;
+#endif
+}
+
+// Hands link to the platform's opener: ShellExecute on Windows, open on macOS and xdg-open
+// elsewhere. The opener's output goes to /dev/null so it can't scribble over the screen.
+inline bool launchWithPlatformOpener(const std::string& link) {
+#ifdef _WIN32
+    return reinterpret_cast<INT_PTR>(ShellExecuteA(NULL, "open", link.c_str(), NULL, NULL, SW_SHOWNORMAL)) > 32;
+#else
+#ifdef __APPLE__
+    const char* opener = "open";
+#else
+    const char* opener = "xdg-open";
+#endif
+    posix_spawn_file_actions_t actions;
+    posix_spawn_file_actions_init(&actions);
+    posix_spawn_file_actions_addopen(&actions, STDIN_FILENO, "/dev/null", O_RDONLY, 0);
+    posix_spawn_file_actions_addopen(&actions, STDOUT_FILENO, "/dev/null", O_WRONLY, 0);
+    posix_spawn_file_actions_addopen(&actions, STDERR_FILENO, "/dev/null", O_WRONLY, 0);
+    // no shell: the link is one argument whatever it holds
+    char* argv[] = { const_cast<char*>(opener), const_cast<char*>(link.c_str()), nullptr };
+    pid_t child;
+    int failed = posix_spawnp(&child, opener, &actions, nullptr, argv, environ);
+    posix_spawn_file_actions_destroy(&actions);
+    if (failed != 0) {
+        return false;
+    }
+    int status;
+    while (waitpid(child, &status, 0) < 0) {
+        if (errno != EINTR) {
+            return false;
+        }
+    }
+    return WIFEXITED(status) && WEXITSTATUS(status) == 0;
+#endif
+}
+
+// Lets the console interpret ANSI escape sequences; Windows 10 consoles need asking
+inline void enableConsoleEscapes() {
+#ifdef _WIN32
+    HANDLE out = GetStdHandle(STD_OUTPUT_HANDLE);
+    DWORD mode;
+    if (GetConsoleMode(out, &mode)) {
+        SetConsoleMode(out, mode | ENABLE_VIRTUAL_TERMINAL_PROCESSING);
+    }
+#endif
+}
+
+// Writes text to standard output in as few calls as it takes, bypassing any buffering
+inline void writeConsole(const std::string& text) {
+#ifdef _WIN32
+    DWORD written;
+    WriteFile(GetStdHandle(STD_OUTPUT_HANDLE), text.data(), static_cast<DWORD>(text.size()), &written, NULL);
+#else
+    size_t done = 0;
+    while (done < text.size()) {
+        ssize_t written = ::write(STDOUT_FILENO, text.data() + done, text.size() - done);
+        if (written < 0 && errno == EINTR) {
+            continue;
+        }
+        if (written <= 0) {
+            return;
+        }
+        done += static_cast<size_t>(written);
+    }
+#endif
+}
+
+// Keys RawKeyboard reads besides plain characters
+enum Key {
+    KEY_NONE = -1,
+    KEY_ENTER = 256,
+    KEY_ESCAPE,
+    KEY_BACKSPACE,
+    KEY_UP,
+    KEY_DOWN
+};
+
+// Reads single keys as they're pressed, without echo or waiting for Enter, for as long as
+// it exists. Ctrl+C still interrupts.
+class RawKeyboard {
+private:
+#ifndef _WIN32
+    termios saved;
+    bool changed = false;
+
+    // next byte of stdin if one comes within milliseconds, else KEY_NONE
+    static int readByte(int milliseconds) {
+        pollfd input{ STDIN_FILENO, POLLIN, 0 };
+        unsigned char c;
+        if (poll(&input, 1, milliseconds) <= 0 || ::read(STDIN_FILENO, &c, 1) != 1) {
+            return KEY_NONE;
+        }
+        return c;
+    }
+#endif
+
+public:
+    RawKeyboard() {
+#ifndef _WIN32
+        if (tcgetattr(STDIN_FILENO, &saved) == 0) {
+            termios raw = saved;
+            raw.c_lflag &= ~(ICANON | ECHO);
+            raw.c_cc[VMIN] = 1;
+            raw.c_cc[VTIME] = 0;
+            changed = tcsetattr(STDIN_FILENO, TCSAFLUSH, &raw) == 0;
+        }
+#endif
+    }
+
+    ~RawKeyboard() {
+#ifndef _WIN32
+        if (changed) {
+            tcsetattr(STDIN_FILENO, TCSAFLUSH, &saved);
+        }
+#endif
+    }
+
+    RawKeyboard(const RawKeyboard&) = delete;
+    RawKeyboard& operator=(const RawKeyboard&) = delete;
+
+    // waits for the next key; KEY_NONE once input has ended
+    int readKey() {
+#ifdef _WIN32
+        int c = _getch();
+        if (c == 0 || c == 0xE0) {
+            int code = _getch();
+            return code == 72 ? KEY_UP : code == 80 ? KEY_DOWN : readKey();
+        }
+        return c == '\r' ? KEY_ENTER : c == 27 ? KEY_ESCAPE : c == 8 ? KEY_BACKSPACE : c;
+#else
+        int c = readByte(-1);
+        if (c == 27) {
+            // arrows arrive as ESC [ A; a lone ESC is the Escape key
+            if (readByte(30) != '[') {
+                return KEY_ESCAPE;
+            }
+            int code = readByte(30);
+            return code == 'A' ? KEY_UP : code == 'B' ? KEY_DOWN : readKey();
+        }
+        return c == '\n' || c == '\r' ? KEY_ENTER : c == 127 || c == 8 ? KEY_BACKSPACE : c;
+#endif
+    }
+};
+
+// Hardware events counted since some fixed point; only differences between two samples mean
+// anything
+struct CounterSample {
+    uint64_t cycles = 0;
+    uint64_t instructions = 0;
+    // misses of the last-level cache
+    uint64_t llcMisses = 0;
+    uint64_t branchMisses = 0;
+};
+
+// Hardware performance counters of the thread that creates it, in user space only: a
+// perf_event_open group on Linux, so the four events are always read together. Where the
+// system, a VM or perf_event_paranoid keeps them from us, available() is false and error()
+// says why. If the kernel has to share the counters with other users it scales the counts up
+// from the time they actually ran.
+class HardwareCounters {
+private:
+    static constexpr int EVENTS = 4;
+    int fds[EVENTS] = { -1, -1, -1, -1 };
+    std::string failure;
+
+    void close() {
+#ifdef __linux__
+        for (int i = EVENTS; i-- > 0;) {
+            if (fds[i] >= 0) {
+                ::close(fds[i]);
+                fds[i] = -1;
+            }
+        }
+#endif
+    }
+
+public:
+    HardwareCounters() {
+#ifdef __linux__
+        const uint64_t configs[EVENTS] = { PERF_COUNT_HW_CPU_CYCLES, PERF_COUNT_HW_INSTRUCTIONS,
+            PERF_COUNT_HW_CACHE_MISSES, PERF_COUNT_HW_BRANCH_MISSES };
+        for (int i = 0; i < EVENTS; ++i) {
+            perf_event_attr attr;
+            memset(&attr, 0, sizeof(attr));
+            attr.size = sizeof(attr);
+            attr.type = PERF_TYPE_HARDWARE;
+            attr.config = configs[i];
+            attr.exclude_kernel = 1;
+            attr.exclude_hv = 1;
+            attr.read_format = PERF_FORMAT_GROUP | PERF_FORMAT_TOTAL_TIME_ENABLED | PERF_FORMAT_TOTAL_TIME_RUNNING;
+            fds[i] = static_cast<int>(syscall(SYS_perf_event_open, &attr, 0, -1, i == 0 ? -1 : fds[0], 0));
+            if (fds[i] < 0) {
+                failure = std::string("perf_event_open: ") + strerror(errno);
+                close();
+                return;
+            }
+        }
+#else
+        failure = "hardware counters are only read on Linux";
+#endif
+    }
+
+    ~HardwareCounters() {
+        close();
+    }
+
+    HardwareCounters(const HardwareCounters&) = delete;
+    HardwareCounters& operator=(const HardwareCounters&) = delete;
+
+    bool available() const {
+        return fds[0] >= 0;
+    }
+
+    const std::string& error() const {
+        return failure;
+    }
+
+    // Reads all four counters at once; false if they aren't available
+    bool read(CounterSample& sample) const {
+#ifdef __linux__
+        if (!available()) {
+            return false;
+        }
+        // events, time enabled, time running, then one value per event
+        uint64_t values[3 + EVENTS];
+        if (::read(fds[0], values, sizeof(values)) != static_cast<ssize_t>(sizeof(values)) || values[0] != EVENTS) {
+            return false;
+        }
+        double scale = values[2] == 0 || values[2] >= values[1] ? 1.0 : static_cast<double>(values[1]) / values[2];
+        sample.cycles = static_cast<uint64_t>(values[3] * scale);
+        sample.instructions = static_cast<uint64_t>(values[4] * scale);
+        sample.llcMisses = static_cast<uint64_t>(values[5] * scale);
+        sample.branchMisses = static_cast<uint64_t>(values[6] * scale);
+        return true;
+#else
+        (void)sample;
+        return false;
+#endif
+    }
+};
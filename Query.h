@@ -0,0 +1,142 @@
+#pragma once
+#include <cctype>
+#include <stdexcept>
+#include <string>
+#include <vector>
+#include "Catalog.h"
+#include "json.hpp"
+
+// A catalog query. Every field that is set must match; an empty query matches every book.
+struct Query {
+    std::string id;
+    std::string author;
+    std::string language;
+    // substring of the title
+    std::string title;
+    bool ignoreCase = false;
+};
+
+// Parses the small query language used by batch files and the servers, e.g.
+//     author:"Leo Tolstoy" AND language:Russian title:war
+// Terms are field:value pairs joined by whitespace or AND. Values with spaces are quoted.
+// Fields are author, language (or lang), title and icase (true/false).
+inline void parseQueryDsl(const std::string& text, Query& query) {
+    size_t i = 0;
+    auto skipSpaces = [&] {
+        while (i < text.size() && isspace(static_cast<unsigned char>(text[i]))) {
+            ++i;
+        }
+    };
+    while (true) {
+        skipSpaces();
+        if (i >= text.size()) {
+            break;
+        }
+        if (text.compare(i, 3, "AND") == 0 && (i + 3 == text.size() || isspace(static_cast<unsigned char>(text[i + 3])))) {
+            i += 3;
+            continue;
+        }
+        size_t colon = i;
+        while (colon < text.size() && text[colon] != ':' && !isspace(static_cast<unsigned char>(text[colon]))) {
+            ++colon;
+        }
+        if (colon >= text.size() || text[colon] != ':') {
+            throw std::runtime_error("Expected field:value in query: " + text);
+        }
+        std::string field = text.substr(i, colon - i);
+        i = colon + 1;
+        std::string value;
+        if (i < text.size() && text[i] == '"') {
+            size_t close = text.find('"', i + 1);
+            if (close == std::string::npos) {
+                throw std::runtime_error("Unterminated quote in query: " + text);
+            }
+            value = text.substr(i + 1, close - i - 1);
+            i = close + 1;
+        }
+        else {
+            size_t end = i;
+            while (end < text.size() && !isspace(static_cast<unsigned char>(text[end]))) {
+                ++end;
+            }
+            value = text.substr(i, end - i);
+            i = end;
+        }
+
+        if (field == "author") {
+            query.author = value;
+        }
+        else if (field == "language" || field == "lang") {
+            query.language = value;
+        }
+        else if (field == "title") {
+            query.title = value;
+        }
+        else if (field == "icase") {
+            query.ignoreCase = value == "true" || value == "1";
+        }
+        else {
+            throw std::runtime_error("Unknown query field: " + field);
+        }
+    }
+}
+
+// Reads a query from its JSON form: {"id": "...", "author": "...", "language": "...",
+// "title": "...", "ignoreCase": true, "dsl": "..."}. Fields from "dsl" override the others.
+inline Query parseQuery(const nlohmann::json& jsonData) {
+    Query query;
+    if (jsonData.contains("id")) {
+        query.id = jsonData["id"].is_string() ? jsonData["id"].get<std::string>() : jsonData["id"].dump();
+    }
+    query.author = jsonData.value("author", "");
+    query.language = jsonData.value("language", "");
+    query.title = jsonData.value("title", "");
+    query.ignoreCase = jsonData.value("ignoreCase", false);
+    if (jsonData.contains("dsl")) {
+        parseQueryDsl(jsonData["dsl"].get<std::string>(), query);
+    }
+    return query;
+}
+
+// Which fields a query filters on, e.g. "language+title(icase)", or "all" for none; queries
+// of one shape run the same code
+inline std::string queryShape(const Query& query) {
+    std::string shape;
+    auto addField = [&shape](const char* field) {
+        if (!shape.empty()) {
+            shape += '+';
+        }
+        shape += field;
+    };
+    if (!query.author.empty()) {
+        addField("author");
+    }
+    if (!query.language.empty()) {
+        addField("language");
+    }
+    if (!query.title.empty()) {
+        addField(query.ignoreCase ? "title(icase)" : "title");
+    }
+    return shape.empty() ? "all" : shape;
+}
+
+// Runs a query against one catalog version and returns the matching books in catalog order
+inline std::vector<BookId> runQuery(const CatalogSnapshot& snapshot, const Query& query,
+    ExecutionPolicy policy = ExecutionPolicy::serial()) {
+    TraceSpan span("search.query");
+    auto matchesFields = [&](const Book& book) {
+        return (query.author.empty() || book.getAuthor().getName() == query.author)
+            && (query.language.empty() || book.getLanguage() == query.language);
+    };
+
+    if (!query.title.empty()) {
+        std::vector<BookId> result = searchTitleContains(snapshot.titles, query.title, query.ignoreCase, policy);
+        if (!query.author.empty() || !query.language.empty()) {
+            result.erase(std::remove_if(result.begin(), result.end(), [&](BookId id) {
+                return !matchesFields(snapshot.library.getItem(id));
+            }), result.end());
+        }
+        return result;
+    }
+    return snapshot.library.filterIds(matchesFields, policy);
+}
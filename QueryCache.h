@@ -0,0 +1,66 @@
+#pragma once
+#include <memory>
+#include <string>
+#include <vector>
+#include "Catalog.h"
+#include "LruCache.h"
+#include "Query.h"
+
+// Shared, immutable list of the books a query matched
+using QueryResult = std::shared_ptr<const std::vector<BookId>>;
+
+// Cache key of a query: its fields without the id. Titles of case-insensitive queries are
+// folded so "War" and "war" share an entry.
+inline std::string normalizeQuery(const Query& query) {
+    std::string title = query.title;
+    if (query.ignoreCase) {
+        std::transform(title.begin(), title.end(), title.begin(), detail::foldAscii);
+    }
+    std::string key;
+    key.reserve(query.author.size() + query.language.size() + title.size() + 4);
+    key += query.author;
+    key += '\x1f';
+    key += query.language;
+    key += '\x1f';
+    key += title;
+    key += '\x1f';
+    key += query.ignoreCase ? '1' : '0';
+    return key;
+}
+
+// Results of recent queries as compact BookId lists, within a byte budget. Entries belong to
+// the catalog version they were computed from, so publishing or reloading the catalog
+// invalidates them without any explicit call.
+class QueryCache {
+private:
+    ShardedLruCache<std::string, QueryResult> cache;
+
+    static size_t entryBytes(const std::string& key, const QueryResult& result) {
+        return key.size() + result->capacity() * sizeof(BookId) + sizeof(std::vector<BookId>)
+            + 2 * sizeof(std::string) + 8 * sizeof(void*);
+    }
+
+public:
+    // byteBudget of 0 means nothing is ever evicted
+    explicit QueryCache(size_t byteBudget) : cache(byteBudget) {}
+
+    // Returns the books matching query in snapshot, running it on a miss
+    QueryResult run(const CatalogSnapshot& snapshot, const Query& query, ExecutionPolicy policy = ExecutionPolicy::serial()) {
+        static const Counter hits = MetricsRegistry::shared().counter("books_cache_hits_total{cache=\"query\"}", "Lookups a cache answered");
+        static const Counter misses = MetricsRegistry::shared().counter("books_cache_misses_total{cache=\"query\"}", "Lookups a cache had to compute");
+        std::string key = normalizeQuery(query);
+        QueryResult result;
+        if (cache.find(snapshot.version, key, result)) {
+            hits.add();
+            return result;
+        }
+        misses.add();
+        result = std::make_shared<const std::vector<BookId>>(runQuery(snapshot, query, policy));
+        cache.insert(snapshot.version, key, result, entryBytes(key, result));
+        return result;
+    }
+
+    CacheStats stats() const {
+        return cache.stats();
+    }
+};
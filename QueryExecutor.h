@@ -0,0 +1,74 @@
+#pragma once
+#include <chrono>
+#include <memory>
+#include <string>
+#include <vector>
+#include "Catalog.h"
+#include "FragmentCache.h"
+#include "Query.h"
+#include "QueryCache.h"
+#include "json.hpp"
+
+// Caches a query may go through; either may be left out
+struct QueryCaches {
+    QueryCache* results = nullptr;
+    FragmentCache* fragments = nullptr;
+};
+
+// Counters of a cache as JSON
+inline nlohmann::json cacheStatsJson(const CacheStats& stats) {
+    nlohmann::json result;
+    result["hits"] = stats.hits;
+    result["misses"] = stats.misses;
+    result["hitRatio"] = stats.hitRatio();
+    result["evictions"] = stats.evictions;
+    result["bytes"] = stats.bytes;
+    result["entries"] = stats.entries;
+    return result;
+}
+
+// Runs a query against snapshot, through the result cache when there is one
+inline QueryResult executeQuery(const CatalogSnapshot& snapshot, const Query& query, const QueryCaches& caches) {
+    static const Counter queries = MetricsRegistry::shared().counter("books_queries_total", "Queries executed");
+    static const Histogram latency = MetricsRegistry::shared().histogram("books_query_duration_seconds", "Time to execute a query, cache lookups included");
+    auto started = std::chrono::steady_clock::now();
+    QueryResult result = caches.results != nullptr ? caches.results->run(snapshot, query)
+        : std::make_shared<const std::vector<BookId>>(runQuery(snapshot, query));
+    queries.add();
+    latency.record(static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - started).count()));
+    return result;
+}
+
+// Executes one JSON query line and returns its JSON result line, as used by batch files
+// and the query server. With a fragment cache the result embeds the books themselves
+// instead of their ids.
+inline std::string runQueryLine(const CatalogSnapshot& snapshot, const std::string& line, bool& failed,
+    const QueryCaches& caches = QueryCaches()) {
+    nlohmann::json result;
+    try {
+        Query query = parseQuery(nlohmann::json::parse(line));
+        QueryResult books = executeQuery(snapshot, query, caches);
+        failed = false;
+        if (caches.fragments != nullptr) {
+            std::string text = "{\"count\":" + std::to_string(books->size()) + ",\"id\":" + nlohmann::json(query.id).dump()
+                + ",\"version\":" + std::to_string(snapshot.version) + ",\"books\":[";
+            for (size_t i = 0; i < books->size(); ++i) {
+                Fragment fragment = caches.fragments->get(snapshot, (*books)[i]);
+                text.append(*fragment, i == 0 ? 1 : 0, std::string::npos);
+            }
+            text += "]}";
+            return text;
+        }
+        result["id"] = query.id;
+        result["version"] = snapshot.version;
+        result["count"] = books->size();
+        result["books"] = *books;
+    }
+    catch (const std::exception& e) {
+        static const Counter errors = MetricsRegistry::shared().counter("books_query_errors_total", "Query lines that failed to parse or run");
+        errors.add();
+        result["error"] = e.what();
+        failed = true;
+    }
+    return result.dump();
+}
@@ -0,0 +1,68 @@
+#pragma once
+#ifndef _WIN32
+#include <string>
+#include "Catalog.h"
+#include "CatalogLog.h"
+#include "EventServer.h"
+#include "QueryExecutor.h"
+#include "SelectionLists.h"
+
+// Where and how the query server listens
+struct ServerOptions {
+    std::string socketPath = "/tmp/booksmanagement.sock";
+    // also listen on 127.0.0.1:tcpPort when non-zero
+    int tcpPort = 0;
+    // event loop threads, 0 uses one per core
+    size_t workers = 0;
+    // byte budget of the query result cache, 0 turns it off
+    size_t resultCacheBytes = 64 * 1024 * 1024;
+};
+
+// Line-delimited JSON protocol: every request line is a query in the batch file format and
+// gets one result line back, in order. Clients may pipeline as many requests as they like.
+// With a writer, lines with an "op" field are edits; each holds its worker until it's durable.
+// With selection lists, the ops of SelectionLists.h go to them instead. {"op": "metrics"}
+// answers {"metrics": "..."} with the metrics in the Prometheus text format.
+inline EventServer::Handler queryLineHandler(const Catalog& catalog, QueryCaches caches = QueryCaches(), CatalogWriter* writer = nullptr,
+    SelectionLists* lists = nullptr) {
+    auto titleOrder = std::make_shared<TitleOrder>();
+    // counted for as long as the handler lives
+    auto titleOrderMemory = std::make_shared<MemoryAccounts::Registration>(
+        MemoryAccounts::shared().track("index.title_ranks", [titleOrder] { return titleOrder->bytes(); }));
+    return [&catalog, caches, writer, lists, titleOrder, titleOrderMemory](Connection& conn) {
+        size_t used = 0;
+        size_t newline;
+        while ((newline = conn.in.find('\n', used)) != std::string::npos) {
+            std::string line = conn.in.substr(used, newline - used);
+            used = newline + 1;
+            if (line.find_first_not_of(" \t\r") == std::string::npos) {
+                continue;
+            }
+            bool failed = false;
+            std::string result;
+            if (line.find("\"op\"") != std::string::npos) {
+                nlohmann::json request = nlohmann::json::parse(line, nullptr, false);
+                if (request.is_object() && request.contains("op")) {
+                    if (request["op"] == "metrics") {
+                        nlohmann::json metrics;
+                        metrics["metrics"] = MetricsRegistry::shared().prometheusText();
+                        result = metrics.dump();
+                    }
+                    else if (lists != nullptr && request["op"].is_string() && isSelectionOp(request["op"].get<std::string>())) {
+                        result = runSelectionLine(*lists, *titleOrder, *catalog.snapshot(), request, failed);
+                    }
+                    else if (writer != nullptr) {
+                        result = runMutationLine(*writer, catalog, request, failed);
+                    }
+                }
+            }
+            if (result.empty()) {
+                result = runQueryLine(*catalog.snapshot(), line, failed, caches);
+            }
+            result.push_back('\n');
+            conn.out.append(result);
+        }
+        return used;
+    };
+}
+#endif
@@ -0,0 +1,266 @@
+#pragma once
+#include <algorithm>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+#include "Catalog.h"
+#include "ColumnStore.h"
+#include "Library.h"
+
+// Book field searched as you type
+enum class SearchField { AUTHOR, LANGUAGE };
+
+inline const std::string& searchValue(const Book& book, SearchField field) {
+    return field == SearchField::AUTHOR ? book.getAuthor().getName() : book.getLanguage();
+}
+
+inline std::string foldText(std::string text) {
+    std::transform(text.begin(), text.end(), text.begin(), detail::foldAscii);
+    return text;
+}
+
+// The distinct values of one field, with the books holding each. Values are sorted ignoring
+// case, so the values starting with some text are one range found by binary search. Every
+// value is also listed under each of its 3-byte n-grams, so the values containing some text
+// are among those listed under its rarest n-gram.
+class KeyIndex {
+private:
+    // values sorted by their folded form, and the folded forms in the same order
+    std::vector<std::string> values;
+    std::vector<std::string> folded;
+    // books of value i are bookIds[bookStarts[i], bookStarts[i + 1])
+    std::vector<size_t> bookStarts;
+    std::vector<BookId> bookIds;
+    // n-gram -> values holding it, ascending
+    std::unordered_map<uint32_t, std::vector<uint32_t>> grams;
+
+    static uint32_t gramAt(const std::string& text, size_t i) {
+        return (uint32_t(uint8_t(text[i])) << 16) | (uint32_t(uint8_t(text[i + 1])) << 8) | uint8_t(text[i + 2]);
+    }
+
+public:
+    // n-grams are this long; shorter searches only match prefixes
+    static constexpr size_t GRAM = 3;
+
+    static KeyIndex build(const Library<Book>& library, SearchField field) {
+        TraceSpan span("index.keys");
+        std::unordered_map<std::string, std::vector<BookId>> byValue;
+        for (size_t i = 0; i < library.getSize(); ++i) {
+            byValue[searchValue(library.getItem(i), field)].push_back(static_cast<BookId>(i));
+        }
+        std::vector<std::pair<std::string, std::string>> order;
+        order.reserve(byValue.size());
+        for (const auto& entry : byValue) {
+            order.emplace_back(foldText(entry.first), entry.first);
+        }
+        std::sort(order.begin(), order.end());
+
+        KeyIndex index;
+        index.bookStarts.push_back(0);
+        for (uint32_t v = 0; v < order.size(); ++v) {
+            std::vector<BookId>& ids = byValue[order[v].second];
+            index.bookIds.insert(index.bookIds.end(), ids.begin(), ids.end());
+            index.bookStarts.push_back(index.bookIds.size());
+            const std::string& text = order[v].first;
+            for (size_t i = 0; i + GRAM <= text.size(); ++i) {
+                std::vector<uint32_t>& list = index.grams[gramAt(text, i)];
+                // a value repeating an n-gram is listed once
+                if (list.empty() || list.back() != v) {
+                    list.push_back(v);
+                }
+            }
+            index.folded.push_back(std::move(order[v].first));
+            index.values.push_back(std::move(order[v].second));
+        }
+        static const Gauge authorValues = MetricsRegistry::shared().gauge("books_index_values{index=\"author\"}", "Distinct values in the last key index built");
+        static const Gauge languageValues = MetricsRegistry::shared().gauge("books_index_values{index=\"language\"}", "Distinct values in the last key index built");
+        static const Gauge authorGrams = MetricsRegistry::shared().gauge("books_index_grams{index=\"author\"}", "Distinct n-grams in the last key index built");
+        static const Gauge languageGrams = MetricsRegistry::shared().gauge("books_index_grams{index=\"language\"}", "Distinct n-grams in the last key index built");
+        (field == SearchField::AUTHOR ? authorValues : languageValues).set(static_cast<int64_t>(index.values.size()));
+        (field == SearchField::AUTHOR ? authorGrams : languageGrams).set(static_cast<int64_t>(index.grams.size()));
+        return index;
+    }
+
+    size_t size() const {
+        return values.size();
+    }
+
+    // bytes the index holds: its value dictionary, book lists and n-gram lists
+    size_t bytes() const {
+        size_t total = sizeof(KeyIndex) + vectorBytes(values) + vectorBytes(folded) + vectorBytes(bookStarts) + vectorBytes(bookIds)
+            + hashBytes(grams);
+        for (size_t v = 0; v < values.size(); ++v) {
+            total += stringHeapBytes(values[v]) + stringHeapBytes(folded[v]);
+        }
+        for (const auto& entry : grams) {
+            total += vectorBytes(entry.second);
+        }
+        return total;
+    }
+
+    const std::string& value(uint32_t v) const {
+        return values[v];
+    }
+
+    size_t bookCount(uint32_t v) const {
+        return bookStarts[v + 1] - bookStarts[v];
+    }
+
+    // Values in [begin, end) starting with text, itself folded, as a range of value numbers
+    std::pair<uint32_t, uint32_t> prefixRange(const std::string& text, uint32_t begin, uint32_t end) const {
+        auto first = std::lower_bound(folded.begin() + begin, folded.begin() + end, text);
+        auto last = std::upper_bound(first, folded.begin() + end, text,
+            [](const std::string& prefix, const std::string& item) { return item.compare(0, prefix.size(), prefix) > 0; });
+        return { static_cast<uint32_t>(first - folded.begin()), static_cast<uint32_t>(last - folded.begin()) };
+    }
+
+    bool valueContains(uint32_t v, const std::string& text) const {
+        return folded[v].find(text) != std::string::npos;
+    }
+
+    // Values containing text, folded and at least GRAM long, in value order: those listed
+    // under its rarest n-gram that really contain it
+    std::vector<uint32_t> containing(const std::string& text) const {
+        const std::vector<uint32_t>* rarest = nullptr;
+        for (size_t i = 0; i + GRAM <= text.size(); ++i) {
+            auto it = grams.find(gramAt(text, i));
+            if (it == grams.end()) {
+                return {};
+            }
+            if (rarest == nullptr || it->second.size() < rarest->size()) {
+                rarest = &it->second;
+            }
+        }
+        std::vector<uint32_t> result;
+        for (uint32_t v : *rarest) {
+            if (valueContains(v, text)) {
+                result.push_back(v);
+            }
+        }
+        return result;
+    }
+};
+
+// Key indexes of one catalog version, each built the first time a search asks for it
+class SearchIndexes {
+private:
+    std::mutex lock;
+    uint64_t version = 0;
+    std::shared_ptr<const KeyIndex> authors;
+    std::shared_ptr<const KeyIndex> languages;
+
+public:
+    std::shared_ptr<const KeyIndex> get(const CatalogSnapshot& snapshot, SearchField field) {
+        std::lock_guard<std::mutex> guard(lock);
+        if (version != snapshot.version) {
+            authors.reset();
+            languages.reset();
+            version = snapshot.version;
+        }
+        auto& index = field == SearchField::AUTHOR ? authors : languages;
+        if (index == nullptr) {
+            index = std::make_shared<const KeyIndex>(KeyIndex::build(snapshot.library, field));
+        }
+        return index;
+    }
+
+    // bytes of the index of field, 0 until a search builds it
+    size_t bytes(SearchField field) {
+        std::lock_guard<std::mutex> guard(lock);
+        const auto& index = field == SearchField::AUTHOR ? authors : languages;
+        return index == nullptr ? 0 : index->bytes();
+    }
+};
+
+// A search typed one key at a time. Each step keeps its matches, and a key typed refines the
+// previous step's matches instead of searching the whole index again: the values starting
+// with the text are a subrange of the previous range, and the values containing it are a
+// subset of the previous ones. Deleting a key goes back to the step before.
+class IncrementalSearch {
+private:
+    struct Step {
+        // folded text typed so far
+        std::string text;
+        // values starting with text
+        uint32_t prefixBegin;
+        uint32_t prefixEnd;
+        // values containing text, once it's GRAM long
+        std::vector<uint32_t> containing;
+        // containing values outside the prefix range
+        size_t others = 0;
+    };
+
+    std::shared_ptr<const KeyIndex> index;
+    std::vector<Step> steps;
+    std::string typed;
+
+public:
+    explicit IncrementalSearch(std::shared_ptr<const KeyIndex> index) : index(std::move(index)) {
+        Step all;
+        all.prefixBegin = 0;
+        all.prefixEnd = static_cast<uint32_t>(this->index->size());
+        steps.push_back(std::move(all));
+    }
+
+    const std::string& text() const {
+        return typed;
+    }
+
+    void push(char c) {
+        TraceSpan span("search.keystroke");
+        const Step& last = steps.back();
+        Step next;
+        next.text = last.text + detail::foldAscii(c);
+        auto range = index->prefixRange(next.text, last.prefixBegin, last.prefixEnd);
+        next.prefixBegin = range.first;
+        next.prefixEnd = range.second;
+        if (next.text.size() == KeyIndex::GRAM) {
+            next.containing = index->containing(next.text);
+        }
+        else if (next.text.size() > KeyIndex::GRAM) {
+            for (uint32_t v : last.containing) {
+                if (index->valueContains(v, next.text)) {
+                    next.containing.push_back(v);
+                }
+            }
+        }
+        for (uint32_t v : next.containing) {
+            next.others += v < next.prefixBegin || v >= next.prefixEnd;
+        }
+        steps.push_back(std::move(next));
+        typed.push_back(c);
+    }
+
+    // deletes the last key typed, if any
+    void pop() {
+        if (steps.size() > 1) {
+            steps.pop_back();
+            typed.pop_back();
+        }
+    }
+
+    size_t matchCount() const {
+        const Step& last = steps.back();
+        return (last.prefixEnd - last.prefixBegin) + last.others;
+    }
+
+    // the first count matches: values starting with the text, then values containing it
+    std::vector<uint32_t> top(size_t count) const {
+        const Step& last = steps.back();
+        std::vector<uint32_t> result;
+        for (uint32_t v = last.prefixBegin; v < last.prefixEnd && result.size() < count; ++v) {
+            result.push_back(v);
+        }
+        for (size_t i = 0; i < last.containing.size() && result.size() < count; ++i) {
+            uint32_t v = last.containing[i];
+            if (v < last.prefixBegin || v >= last.prefixEnd) {
+                result.push_back(v);
+            }
+        }
+        return result;
+    }
+};
@@ -0,0 +1,687 @@
+#pragma once
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <functional>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+#include "BookIdSet.h"
+#include "Catalog.h"
+#include "DurableFile.h"
+#include "Library.h"
+#include "ThreadPool.h"
+#include "json.hpp"
+
+// Title order of one catalog version, computed once per version and shared by every list
+// shown in that order
+class TitleOrder {
+private:
+    std::mutex lock;
+    uint64_t version = 0;
+    // rank[id] is the position of book id in title order
+    std::shared_ptr<const std::vector<uint32_t>> rank;
+
+public:
+    std::shared_ptr<const std::vector<uint32_t>> ranks(const CatalogSnapshot& snapshot) {
+        std::lock_guard<std::mutex> guard(lock);
+        if (rank == nullptr || version != snapshot.version) {
+            std::vector<BookId> sorted = snapshot.library.sortedIds(
+                [](const Book& a, const Book& b) { return a.getTitle() < b.getTitle(); }, ExecutionPolicy::parallel());
+            auto next = std::make_shared<std::vector<uint32_t>>(sorted.size());
+            for (size_t position = 0; position < sorted.size(); ++position) {
+                (*next)[sorted[position]] = static_cast<uint32_t>(position);
+            }
+            rank = next;
+            version = snapshot.version;
+        }
+        return rank;
+    }
+
+    // bytes of the ranks computed so far
+    size_t bytes() {
+        std::lock_guard<std::mutex> guard(lock);
+        return rank == nullptr ? 0 : vectorBytes(*rank);
+    }
+
+    // the ids of set that exist in snapshot, in title order
+    std::vector<BookId> arrange(const CatalogSnapshot& snapshot, const BookIdSet& set) {
+        std::shared_ptr<const std::vector<uint32_t>> order = ranks(snapshot);
+        std::vector<BookId> ids;
+        ids.reserve(set.size());
+        set.forEach([&](BookId id) {
+            if (id < order->size()) {
+                ids.push_back(id);
+            }
+        });
+        std::sort(ids.begin(), ids.end(), [&order](BookId a, BookId b) { return (*order)[a] < (*order)[b]; });
+        return ids;
+    }
+};
+
+// Named lists of saved books for any number of users. Each list is a BookIdSet, so saving
+// a book twice keeps one copy and membership checks take constant time. Users are spread
+// over shards with a lock each, so users don't wait on one another.
+//
+// Book ids move when books are removed or a store is reopened, so lists don't hold them.
+// Every book saved gets an entry number for its bookKey, its title and author, that is
+// never reused; lists hold entry numbers and are mapped back to the books of the catalog
+// version they're read against. A book that leaves the catalog drops out of what lists
+// show, and comes back if a book with the same title and author is added again.
+//
+// Every change that took effect is appended to a journal, written and fsynced as a group by
+// a background thread at most FLUSH_MILLISECONDS later. When the journal has grown to
+// twice its size after the last compaction, it's rewritten atomically as every entry's key
+// followed by one image per list.
+class SelectionLists {
+private:
+    static constexpr size_t SHARD_COUNT = 64;
+    static constexpr int FLUSH_MILLISECONDS = 50;
+    // compaction never runs on journals smaller than this
+    static constexpr size_t MIN_COMPACT_BYTES = 16 * 1024 * 1024;
+
+    enum Op : uint8_t { ADD = 1, REMOVE = 2, DROP = 3, IMAGE = 4, KEY = 5 };
+
+    struct Shard {
+        std::mutex lock;
+        std::unordered_map<std::string, std::map<std::string, BookIdSet>> users;
+    };
+
+    std::vector<std::unique_ptr<Shard>> shards;
+    std::string path;
+
+    // entry numbers by book key, and the keys by entry number; taken after a shard lock and
+    // before journalLock
+    std::mutex entryLock;
+    std::unordered_map<std::string, uint32_t> entries;
+    std::vector<const std::string*> keys;
+
+    // by entry number, the id its book had when last found, and the catalog version it was
+    // last looked for in and missing from
+    std::mutex idsLock;
+    std::vector<BookId> lastIds;
+    std::vector<uint64_t> missingIn;
+
+    std::mutex journalLock;
+    std::condition_variable wake;
+    std::string buffer;
+    FILE* journal = nullptr;
+    // set once the journal can't be written any more; changes are refused from then on
+    std::string failure;
+    size_t journalBytes = 0;
+    size_t compactedBytes = 0;
+    size_t skippedRecords = 0;
+    bool stopping = false;
+    std::thread flusher;
+
+    Shard& shardOf(const std::string& user) {
+        return *shards[std::hash<std::string>()(user) % SHARD_COUNT];
+    }
+
+    static std::string encode(Op op, const std::string& user, const std::string& list, const std::string& body) {
+        std::string payload(1, static_cast<char>(op));
+        putString(payload, user);
+        putString(payload, list);
+        payload += body;
+        std::string record;
+        appendRecord(record, payload);
+        return record;
+    }
+
+    static std::string encodeKey(uint32_t entry, const std::string& key) {
+        std::string payload(1, static_cast<char>(KEY));
+        putU32(payload, entry);
+        putString(payload, key);
+        std::string record;
+        appendRecord(record, payload);
+        return record;
+    }
+
+    static std::string idsBody(const std::vector<uint32_t>& ids) {
+        std::string body;
+        putU32(body, static_cast<uint32_t>(ids.size()));
+        body.append(reinterpret_cast<const char*>(ids.data()), ids.size() * sizeof(uint32_t));
+        return body;
+    }
+
+    // the entry number of key, numbering and journaling it if it's new; called with the
+    // list's shard lock held so the key is journaled before the list change that uses it
+    uint32_t entryOf(const std::string& key) {
+        std::lock_guard<std::mutex> guard(entryLock);
+        auto found = entries.find(key);
+        if (found != entries.end()) {
+            return found->second;
+        }
+        uint32_t entry = static_cast<uint32_t>(keys.size());
+        keys.push_back(&entries.emplace(key, entry).first->first);
+        journalAppend(encodeKey(entry, key));
+        return entry;
+    }
+
+    // the entry number of key, or false if no list ever held it
+    bool findEntry(const std::string& key, uint32_t& entry) {
+        std::lock_guard<std::mutex> guard(entryLock);
+        auto found = entries.find(key);
+        if (found == entries.end()) {
+            return false;
+        }
+        entry = found->second;
+        return true;
+    }
+
+    // whether book's bookKey is key, without building it
+    static bool hasKey(const Book& book, const std::string& key) {
+        const std::string& title = book.getTitle();
+        const std::string& author = book.getAuthor().getName();
+        return key.size() == title.size() + 1 + author.size() && key.compare(0, title.size(), title) == 0
+            && key[title.size()] == '\x1f' && key.compare(title.size() + 1, author.size(), author) == 0;
+    }
+
+    // Adds to books the id in snapshot of every saved entry, given with its key, that has
+    // one. An entry is looked for at the id it was last found at; the entries whose book
+    // moved or left are looked for in one pass over the catalog, at most once per version.
+    void resolve(const CatalogSnapshot& snapshot, const std::vector<std::pair<uint32_t, const std::string*>>& saved, BookIdSet& books) {
+        struct Moved {
+            // the part of the key before the separator
+            std::string_view title;
+            uint32_t entry;
+            const std::string* key;
+        };
+        const Library<Book>& library = snapshot.library;
+        std::lock_guard<std::mutex> guard(idsLock);
+        std::vector<Moved> moved;
+        for (const auto& item : saved) {
+            uint32_t entry = item.first;
+            if (entry >= lastIds.size()) {
+                lastIds.resize(entry + 1, 0);
+                missingIn.resize(entry + 1, 0);
+            }
+            BookId id = lastIds[entry];
+            if (id < library.getSize() && hasKey(library.getItem(id), *item.second)) {
+                books.insert(id);
+            }
+            else if (missingIn[entry] != snapshot.version) {
+                missingIn[entry] = snapshot.version;
+                moved.push_back(Moved{ std::string_view(*item.second).substr(0, item.second->find('\x1f')), entry, item.second });
+            }
+        }
+        if (moved.empty()) {
+            return;
+        }
+        std::sort(moved.begin(), moved.end(), [](const Moved& a, const Moved& b) { return a.title < b.title; });
+        for (size_t id = 0; id < library.getSize(); ++id) {
+            const Book& book = library.getItem(id);
+            std::string_view title = book.getTitle();
+            auto match = std::lower_bound(moved.begin(), moved.end(), title, [](const Moved& m, std::string_view t) { return m.title < t; });
+            for (; match != moved.end() && match->title == title; ++match) {
+                // the first of several books with one title and author stands for all of them
+                if (missingIn[match->entry] == snapshot.version && hasKey(book, *match->key)) {
+                    lastIds[match->entry] = static_cast<BookId>(id);
+                    missingIn[match->entry] = 0;
+                    books.insert(static_cast<BookId>(id));
+                }
+            }
+        }
+    }
+
+    // throws if the journal has failed; called before a change so nothing is changed that
+    // can't be journaled
+    void checkWritable() {
+        std::lock_guard<std::mutex> guard(journalLock);
+        if (!failure.empty()) {
+            throw std::runtime_error("Selection journal failed: " + failure);
+        }
+    }
+
+    // queues a record; called with the list's shard lock held so records of a list keep their order
+    void journalAppend(const std::string& record) {
+        std::lock_guard<std::mutex> guard(journalLock);
+        buffer += record;
+    }
+
+    // writes and fsyncs the buffer; called with journalLock held
+    void flushLocked() {
+        if (buffer.empty()) {
+            return;
+        }
+        if (journal == nullptr) {
+            throw std::runtime_error("Selection journal failed: " + failure);
+        }
+        if (!appendDurably(journal, path, journalBytes, buffer)) {
+            if (journal == nullptr) {
+                failure = "Error writing file: " + path;
+                throw std::runtime_error("Selection journal failed: " + failure);
+            }
+            // back at the last whole record, so the buffer can be written again in full
+            throw std::runtime_error("Error writing file: " + path);
+        }
+        journalBytes += buffer.size();
+        buffer.clear();
+    }
+
+    // reads count entry numbers after p, each of which must be known
+    bool readEntries(const char*& p, const char* end, std::vector<uint32_t>& ids) {
+        uint32_t count;
+        if (end - p < 4) {
+            return false;
+        }
+        memcpy(&count, p, 4);
+        p += 4;
+        if (static_cast<size_t>(end - p) < count * sizeof(uint32_t)) {
+            return false;
+        }
+        ids.resize(count);
+        memcpy(ids.data(), p, count * sizeof(uint32_t));
+        p += count * sizeof(uint32_t);
+        return std::all_of(ids.begin(), ids.end(), [this](uint32_t id) { return id < keys.size(); });
+    }
+
+    // applies a journal record whose checksum held; false if it can't be applied, e.g. it's
+    // of an unknown kind or names entries no KEY record numbered
+    bool replay(const std::string& payload) {
+        if (payload.empty()) {
+            return false;
+        }
+        Op op = static_cast<Op>(payload[0]);
+        const char* p = payload.data() + 1;
+        const char* end = payload.data() + payload.size();
+        if (op == KEY) {
+            uint32_t entry;
+            std::string key;
+            if (end - p < 4) {
+                return false;
+            }
+            memcpy(&entry, p, 4);
+            p += 4;
+            // numbers are handed out in order, so a key always gets the next one
+            if (!getString(p, end, key) || entry != keys.size() || entries.count(key) != 0) {
+                return false;
+            }
+            keys.push_back(&entries.emplace(key, entry).first->first);
+            return true;
+        }
+        std::string user, list;
+        if (!getString(p, end, user) || !getString(p, end, list)) {
+            return false;
+        }
+        auto& lists = shardOf(user).users[user];
+        if (op == DROP) {
+            lists.erase(list);
+            return true;
+        }
+        if (op == IMAGE) {
+            BookIdSet image;
+            if (!image.deserialize(p, end) || (!image.empty() && image.last() >= keys.size())) {
+                return false;
+            }
+            lists[list] = std::move(image);
+            return true;
+        }
+        std::vector<uint32_t> ids;
+        if ((op != ADD && op != REMOVE) || !readEntries(p, end, ids)) {
+            return false;
+        }
+        BookIdSet& set = lists[list];
+        for (uint32_t id : ids) {
+            if (op == ADD) {
+                set.insert(id);
+            }
+            else {
+                set.erase(id);
+            }
+        }
+        if (set.empty()) {
+            lists.erase(list);
+        }
+        return true;
+    }
+
+    void flushLoop() {
+        std::unique_lock<std::mutex> guard(journalLock);
+        while (!stopping) {
+            wake.wait_for(guard, std::chrono::milliseconds(FLUSH_MILLISECONDS));
+            try {
+                flushLocked();
+            }
+            catch (const std::exception&) {
+                // kept in the buffer; the next flush retries it
+            }
+            if (failure.empty() && journalBytes > std::max(MIN_COMPACT_BYTES, 2 * compactedBytes)) {
+                guard.unlock();
+                try {
+                    compact();
+                }
+                catch (const std::exception&) {
+                    // the journal is left as it was and still complete; try again once it doubles
+                    std::lock_guard<std::mutex> retryGuard(journalLock);
+                    compactedBytes = journalBytes;
+                }
+                guard.lock();
+            }
+        }
+    }
+
+public:
+    // Opens the journal at path, creating it if needed, and loads every list it holds. A
+    // record cut short by a crash ends the journal there; a whole record that can't be
+    // applied is skipped and counted in skipped().
+    explicit SelectionLists(const std::string& path) : path(path) {
+        for (size_t i = 0; i < SHARD_COUNT; ++i) {
+            shards.push_back(std::make_unique<Shard>());
+        }
+        std::ifstream inFile(path, std::ios::binary);
+        std::ostringstream contents;
+        contents << inFile.rdbuf();
+        std::string text = contents.str();
+        inFile.close();
+        size_t offset = 0;
+        size_t used;
+        std::string payload;
+        while ((used = readRecord(text, offset, payload)) > 0) {
+            if (!replay(payload)) {
+                ++skippedRecords;
+            }
+            offset += used;
+        }
+        if (offset < text.size()) {
+            // a crash cut the last write short
+            std::filesystem::resize_file(path, offset);
+        }
+        journalBytes = compactedBytes = offset;
+        journal = fopen(path.c_str(), "ab");
+        if (journal == nullptr) {
+            throw std::runtime_error("Error opening file: " + path);
+        }
+        flusher = std::thread([this] { flushLoop(); });
+    }
+
+    ~SelectionLists() {
+        {
+            std::lock_guard<std::mutex> guard(journalLock);
+            stopping = true;
+        }
+        wake.notify_one();
+        flusher.join();
+        try {
+            std::lock_guard<std::mutex> guard(journalLock);
+            flushLocked();
+        }
+        catch (const std::exception&) {
+        }
+        if (journal != nullptr) {
+            fclose(journal);
+        }
+    }
+
+    SelectionLists(const SelectionLists&) = delete;
+    SelectionLists& operator=(const SelectionLists&) = delete;
+
+    // Adds books ids of snapshot to the user's list, creating it if needed; returns how many
+    // weren't in it yet. The ids must exist in snapshot.
+    size_t add(const std::string& user, const std::string& list, const CatalogSnapshot& snapshot, const std::vector<BookId>& ids) {
+        checkWritable();
+        Shard& shard = shardOf(user);
+        std::lock_guard<std::mutex> guard(shard.lock);
+        BookIdSet& set = shard.users[user][list];
+        std::vector<uint32_t> added;
+        for (BookId id : ids) {
+            uint32_t entry = entryOf(bookKey(snapshot.library.getItem(id)));
+            if (set.insert(entry)) {
+                added.push_back(entry);
+            }
+        }
+        if (!added.empty()) {
+            journalAppend(encode(ADD, user, list, idsBody(added)));
+        }
+        else if (set.empty()) {
+            shard.users[user].erase(list);
+        }
+        return added.size();
+    }
+
+    // removes books ids of snapshot from the user's list; returns how many were in it
+    size_t remove(const std::string& user, const std::string& list, const CatalogSnapshot& snapshot, const std::vector<BookId>& ids) {
+        checkWritable();
+        Shard& shard = shardOf(user);
+        std::lock_guard<std::mutex> guard(shard.lock);
+        auto userIt = shard.users.find(user);
+        if (userIt == shard.users.end() || userIt->second.count(list) == 0) {
+            return 0;
+        }
+        BookIdSet& set = userIt->second[list];
+        std::vector<uint32_t> removed;
+        for (BookId id : ids) {
+            uint32_t entry;
+            if (findEntry(bookKey(snapshot.library.getItem(id)), entry) && set.erase(entry)) {
+                removed.push_back(entry);
+            }
+        }
+        if (set.empty()) {
+            userIt->second.erase(list);
+        }
+        if (!removed.empty()) {
+            journalAppend(encode(REMOVE, user, list, idsBody(removed)));
+        }
+        return removed.size();
+    }
+
+    // deletes the user's list; false if there was none
+    bool drop(const std::string& user, const std::string& list) {
+        checkWritable();
+        Shard& shard = shardOf(user);
+        std::lock_guard<std::mutex> guard(shard.lock);
+        auto userIt = shard.users.find(user);
+        if (userIt == shard.users.end() || userIt->second.erase(list) == 0) {
+            return false;
+        }
+        journalAppend(encode(DROP, user, list, std::string()));
+        return true;
+    }
+
+    // whether book id of snapshot is in the user's list
+    bool contains(const std::string& user, const std::string& list, const CatalogSnapshot& snapshot, BookId id) {
+        uint32_t entry;
+        if (!findEntry(bookKey(snapshot.library.getItem(id)), entry)) {
+            return false;
+        }
+        Shard& shard = shardOf(user);
+        std::lock_guard<std::mutex> guard(shard.lock);
+        auto userIt = shard.users.find(user);
+        if (userIt == shard.users.end()) {
+            return false;
+        }
+        auto listIt = userIt->second.find(list);
+        return listIt != userIt->second.end() && listIt->second.contains(entry);
+    }
+
+    // the ids in snapshot of the books in the user's list, empty if there is none; books
+    // snapshot doesn't hold are left out
+    BookIdSet get(const std::string& user, const std::string& list, const CatalogSnapshot& snapshot) {
+        BookIdSet saved;
+        {
+            Shard& shard = shardOf(user);
+            std::lock_guard<std::mutex> guard(shard.lock);
+            auto userIt = shard.users.find(user);
+            if (userIt == shard.users.end()) {
+                return BookIdSet();
+            }
+            auto listIt = userIt->second.find(list);
+            if (listIt == userIt->second.end()) {
+                return BookIdSet();
+            }
+            saved = listIt->second;
+        }
+        // keys never move once numbered, so they can be read after entryLock is let go
+        std::vector<std::pair<uint32_t, const std::string*>> savedKeys;
+        savedKeys.reserve(saved.size());
+        {
+            std::lock_guard<std::mutex> guard(entryLock);
+            saved.forEach([&](BookId entry) { savedKeys.emplace_back(entry, keys[entry]); });
+        }
+        BookIdSet books;
+        resolve(snapshot, savedKeys, books);
+        return books;
+    }
+
+    // names of the user's lists in order
+    std::vector<std::string> names(const std::string& user) {
+        Shard& shard = shardOf(user);
+        std::lock_guard<std::mutex> guard(shard.lock);
+        std::vector<std::string> result;
+        auto userIt = shard.users.find(user);
+        if (userIt != shard.users.end()) {
+            for (const auto& list : userIt->second) {
+                result.push_back(list.first);
+            }
+        }
+        return result;
+    }
+
+    // journal records the last open skipped because they couldn't be applied
+    size_t skipped() const {
+        return skippedRecords;
+    }
+
+    // bytes of every list, the entry keys, the id lookup and the journal buffer; takes each
+    // lock in turn
+    size_t bytes() {
+        size_t total = vectorBytes(shards);
+        for (const auto& shard : shards) {
+            std::lock_guard<std::mutex> guard(shard->lock);
+            total += sizeof(Shard) + hashBytes(shard->users);
+            for (const auto& user : shard->users) {
+                total += stringHeapBytes(user.first) + treeBytes(user.second);
+                for (const auto& list : user.second) {
+                    total += stringHeapBytes(list.first) + list.second.bytes();
+                }
+            }
+        }
+        {
+            std::lock_guard<std::mutex> guard(entryLock);
+            total += hashBytes(entries) + vectorBytes(keys);
+            for (const auto& entry : entries) {
+                total += stringHeapBytes(entry.first);
+            }
+        }
+        {
+            std::lock_guard<std::mutex> guard(idsLock);
+            total += vectorBytes(lastIds) + vectorBytes(missingIn);
+        }
+        std::lock_guard<std::mutex> guard(journalLock);
+        return total + stringHeapBytes(buffer);
+    }
+
+    // forces every change made so far to disk
+    void sync() {
+        std::lock_guard<std::mutex> guard(journalLock);
+        flushLocked();
+    }
+
+    // Rewrites the journal as every entry's key and one image per list. Holds every shard
+    // while it runs. If the journal can't be reopened afterwards, the lists refuse changes.
+    void compact() {
+        std::vector<std::unique_lock<std::mutex>> held;
+        for (auto& shard : shards) {
+            held.emplace_back(shard->lock);
+        }
+        std::lock_guard<std::mutex> entryGuard(entryLock);
+        std::lock_guard<std::mutex> guard(journalLock);
+        flushLocked();
+        std::string text;
+        for (uint32_t entry = 0; entry < keys.size(); ++entry) {
+            text += encodeKey(entry, *keys[entry]);
+        }
+        for (auto& shard : shards) {
+            for (const auto& user : shard->users) {
+                for (const auto& list : user.second) {
+                    std::string body;
+                    list.second.serialize(body);
+                    text += encode(IMAGE, user.first, list.first, body);
+                }
+            }
+        }
+        // closed first: Windows can't rename over a file that's open
+        fclose(journal);
+        bool replaced = true;
+        std::string error;
+        try {
+            writeFileAtomically(path, text);
+        }
+        catch (const std::exception& e) {
+            replaced = false;
+            error = e.what();
+        }
+        journal = fopen(path.c_str(), "ab");
+        if (journal == nullptr) {
+            failure = "Error opening file: " + path;
+            throw std::runtime_error(failure);
+        }
+        if (!replaced) {
+            throw std::runtime_error(error);
+        }
+        journalBytes = compactedBytes = text.size();
+    }
+};
+
+// true for the line protocol ops that SelectionLists serves
+inline bool isSelectionOp(const std::string& op) {
+    return op == "select" || op == "unselect" || op == "drop" || op == "lists" || op == "show";
+}
+
+// Serves one selection line of the query protocol, e.g.
+// {"op":"select","user":"ann","list":"to-read","books":[1,2]} or {"op":"show","user":"ann","list":"to-read"}
+inline std::string runSelectionLine(SelectionLists& lists, TitleOrder& titleOrder, const CatalogSnapshot& snapshot,
+    const nlohmann::json& request, bool& failed) {
+    nlohmann::json result;
+    if (request.contains("id")) {
+        result["id"] = request["id"];
+    }
+    try {
+        std::string op = request["op"].get<std::string>();
+        std::string user = request["user"].get<std::string>();
+        if (op == "lists") {
+            result["lists"] = lists.names(user);
+        }
+        else {
+            std::string list = request["list"].get<std::string>();
+            if (op == "select" || op == "unselect") {
+                std::vector<BookId> ids = request["books"].get<std::vector<BookId>>();
+                for (BookId id : ids) {
+                    if (id >= snapshot.library.getSize()) {
+                        throw std::runtime_error("No book with id " + std::to_string(id));
+                    }
+                }
+                result[op == "select" ? "added" : "removed"] =
+                    op == "select" ? lists.add(user, list, snapshot, ids) : lists.remove(user, list, snapshot, ids);
+            }
+            else if (op == "drop") {
+                result["dropped"] = lists.drop(user, list);
+            }
+            else {
+                BookIdSet set = lists.get(user, list, snapshot);
+                bool byTitle = request.value("order", std::string("title")) == "title";
+                result["books"] = byTitle ? titleOrder.arrange(snapshot, set) : set.toVector();
+                result["count"] = set.size();
+            }
+        }
+        failed = false;
+    }
+    catch (const std::exception& e) {
+        result["error"] = e.what();
+        failed = true;
+    }
+    return result.dump();
+}
@@ -0,0 +1,236 @@
+#pragma once
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <map>
+#include <mutex>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <utility>
+#include <vector>
+#include "DurableFile.h"
+#include "Library.h"
+
+// The user's saved books, kept in a journal so a crash loses at most the last flush interval.
+// Every save is appended to an in-memory buffer that a background thread writes and fsyncs
+// as one group; sync() forces it out right away. The books are held sorted by title, so
+// the sorted list is written on demand without sorting. Once the journal holds mostly
+// superseded records it's compacted by rewriting it atomically.
+//
+// Journal records use the CRC-checked framing of DurableFile.h. Payload: the number of
+// copies saved as uint32, then title and author each prefixed by their uint32 length.
+class SelectionStore {
+private:
+    // how long a save may wait in the buffer before it's forced to disk
+    static constexpr int FLUSH_MILLISECONDS = 50;
+    // buffered bytes that trigger a flush without waiting
+    static constexpr size_t FLUSH_BYTES = 64 * 1024;
+
+    std::string path;
+    mutable std::mutex lock;
+    std::condition_variable wake;
+    // copies saved of every (title, author), sorted by title
+    std::map<std::pair<std::string, std::string>, uint32_t> books;
+    size_t total = 0;
+    std::string buffer;
+    size_t journalRecords = 0;
+    // bytes of whole records in the journal
+    size_t journalBytes = 0;
+    FILE* journal = nullptr;
+    // set once the journal can't be written any more; saves are refused from then on
+    std::string failure;
+    bool stopping = false;
+    std::thread flusher;
+
+    static std::string encode(const std::string& title, const std::string& author, uint32_t copies) {
+        std::string payload;
+        putU32(payload, copies);
+        putString(payload, title);
+        putString(payload, author);
+        std::string record;
+        appendRecord(record, payload);
+        return record;
+    }
+
+    // writes and fsyncs the buffer; called with lock held
+    void flushLocked() {
+        if (buffer.empty()) {
+            return;
+        }
+        if (journal == nullptr) {
+            throw std::runtime_error("Selection journal failed: " + failure);
+        }
+        TraceSpan span("save.flush");
+        if (!appendDurably(journal, path, journalBytes, buffer)) {
+            if (journal == nullptr) {
+                failure = "Error writing file: " + path;
+                throw std::runtime_error("Selection journal failed: " + failure);
+            }
+            // back at the last whole record, so the buffer can be written again in full
+            throw std::runtime_error("Error writing file: " + path);
+        }
+        journalBytes += buffer.size();
+        buffer.clear();
+    }
+
+    void flushLoop() {
+        std::unique_lock<std::mutex> guard(lock);
+        while (!stopping) {
+            wake.wait_for(guard, std::chrono::milliseconds(FLUSH_MILLISECONDS));
+            try {
+                flushLocked();
+            }
+            catch (const std::exception&) {
+                // kept in the buffer; the next flush or sync() retries it
+            }
+        }
+    }
+
+public:
+    // Opens the journal at path, creating it if needed, and loads what it holds. A torn
+    // record at its end, left by a crash during a write, is dropped.
+    explicit SelectionStore(const std::string& path) : path(path) {
+        std::ifstream inFile(path, std::ios::binary);
+        std::ostringstream contents;
+        contents << inFile.rdbuf();
+        std::string text = contents.str();
+        size_t offset = 0;
+        size_t used;
+        std::string payload;
+        while ((used = readRecord(text, offset, payload)) > 0) {
+            uint32_t copies;
+            std::string title, author;
+            const char* p = payload.data() + 4;
+            const char* end = payload.data() + payload.size();
+            if (payload.size() < 4 || !getString(p, end, title) || !getString(p, end, author)) {
+                break;
+            }
+            memcpy(&copies, payload.data(), 4);
+            books[{ title, author }] += copies;
+            total += copies;
+            ++journalRecords;
+            offset += used;
+        }
+        inFile.close();
+        if (offset < text.size()) {
+            std::filesystem::resize_file(path, offset);
+        }
+        journalBytes = offset;
+        journal = fopen(path.c_str(), "ab");
+        if (journal == nullptr) {
+            throw std::runtime_error("Error opening file: " + path);
+        }
+        flusher = std::thread([this] { flushLoop(); });
+    }
+
+    ~SelectionStore() {
+        {
+            std::lock_guard<std::mutex> guard(lock);
+            stopping = true;
+        }
+        wake.notify_one();
+        flusher.join();
+        try {
+            flushLocked();
+        }
+        catch (const std::exception&) {
+        }
+        if (journal != nullptr) {
+            fclose(journal);
+        }
+    }
+
+    SelectionStore(const SelectionStore&) = delete;
+    SelectionStore& operator=(const SelectionStore&) = delete;
+
+    // saves a copy of book; it's on disk within FLUSH_MILLISECONDS. Throws once the journal has failed.
+    void add(const Book& book) {
+        std::lock_guard<std::mutex> guard(lock);
+        if (!failure.empty()) {
+            throw std::runtime_error("Selection journal failed: " + failure);
+        }
+        books[{ book.getTitle(), book.getAuthor().getName() }]++;
+        ++total;
+        buffer += encode(book.getTitle(), book.getAuthor().getName(), 1);
+        ++journalRecords;
+        if (buffer.size() >= FLUSH_BYTES) {
+            wake.notify_one();
+        }
+    }
+
+    // number of saved copies, counting repeats
+    size_t size() const {
+        std::lock_guard<std::mutex> guard(lock);
+        return total;
+    }
+
+    // bytes of the saved books and of the journal buffer
+    size_t bytes() const {
+        std::lock_guard<std::mutex> guard(lock);
+        size_t result = treeBytes(books) + stringHeapBytes(buffer);
+        for (const auto& book : books) {
+            result += stringHeapBytes(book.first.first) + stringHeapBytes(book.first.second);
+        }
+        return result;
+    }
+
+    // forces every save made so far to disk
+    void sync() {
+        std::lock_guard<std::mutex> guard(lock);
+        flushLocked();
+    }
+
+    // Rewrites the journal as one record per distinct book when more than half of it is
+    // superseded; force compacts regardless. If the journal can't be reopened afterwards,
+    // saves are refused.
+    void compact(bool force = false) {
+        std::lock_guard<std::mutex> guard(lock);
+        if (!force && journalRecords <= 2 * books.size()) {
+            return;
+        }
+        flushLocked();
+        std::string text;
+        for (const auto& book : books) {
+            text += encode(book.first.first, book.first.second, book.second);
+        }
+        // closed first: Windows can't rename over a file that's open
+        fclose(journal);
+        journal = nullptr;
+        bool replaced = true;
+        std::string error;
+        try {
+            writeFileAtomically(path, text);
+        }
+        catch (const std::exception& e) {
+            replaced = false;
+            error = e.what();
+        }
+        journal = fopen(path.c_str(), "ab");
+        if (journal == nullptr) {
+            failure = "Error opening file: " + path;
+            throw std::runtime_error(failure);
+        }
+        if (!replaced) {
+            throw std::runtime_error(error);
+        }
+        journalRecords = books.size();
+        journalBytes = text.size();
+    }
+
+    // titles of the saved books in title order, repeated for every copy saved
+    std::vector<std::string> sortedTitles() const {
+        std::lock_guard<std::mutex> guard(lock);
+        std::vector<std::string> titles;
+        titles.reserve(total);
+        for (const auto& book : books) {
+            titles.insert(titles.end(), book.second, book.first.first);
+        }
+        return titles;
+    }
+};
@@ -0,0 +1,67 @@
+#pragma once
+#include <chrono>
+#include <cstdint>
+#include <iostream>
+#include <string>
+#include "Histogram.h"
+#include "Platform.h"
+#include "Trace.h"
+
+// Draws full screens without flicker. A frame is composed in memory and written with one
+// call: the cursor goes home, every line overwrites the old one and clears what's left of
+// it, and whatever the previous frame had below is cleared at the end. Nothing is ever
+// blanked first, so the terminal never shows a half-drawn screen, and no shell is spawned
+// to clear it. Uses ANSI escape sequences, which Windows 10 consoles take once enabled.
+class Screen {
+private:
+    std::string frame;
+    std::chrono::steady_clock::time_point started;
+    // time to compose and write each frame, in nanoseconds
+    LatencyHistogram frameTimes;
+    uint64_t lastFrame = 0;
+
+public:
+    Screen() {
+        enableConsoleEscapes();
+    }
+
+    // starts a new frame at the top left of the screen
+    void begin() {
+        started = std::chrono::steady_clock::now();
+        frame.clear();
+        frame += "\x1b[H";
+    }
+
+    void line(const std::string& text) {
+        frame += text;
+        frame += "\x1b[K\n";
+    }
+
+    // text left on the last line with the cursor after it, e.g. a prompt
+    void prompt(const std::string& text) {
+        frame += text;
+    }
+
+    // writes the frame, clearing everything below it
+    void present() {
+        frame += "\x1b[J";
+        // anything still buffered in cout belongs before this frame
+        std::cout.flush();
+        writeConsole(frame);
+        auto finished = std::chrono::steady_clock::now();
+        lastFrame = static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::nanoseconds>(finished - started).count());
+        frameTimes.record(lastFrame);
+        if (Tracer::shared().enabled()) {
+            Tracer::shared().record("render.frame", started, finished);
+        }
+    }
+
+    // nanoseconds the last frame took to compose and write
+    uint64_t lastFrameNanoseconds() const {
+        return lastFrame;
+    }
+
+    const LatencyHistogram& frameNanoseconds() const {
+        return frameTimes;
+    }
+};
@@ -0,0 +1,183 @@
+#pragma once
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// Number of books handed to a worker at a time when a scan runs in parallel
+const size_t MORSEL_SIZE = 64 * 1024;
+
+// Fixed-size pool of workers. Each worker owns a task deque and steals from the
+// back of the others once its own runs dry.
+class ThreadPool {
+private:
+    struct Worker {
+        std::mutex lock;
+        std::deque<std::function<void()>> tasks;
+    };
+
+    std::vector<std::unique_ptr<Worker>> workers;
+    std::vector<std::thread> threads;
+    std::mutex sleepLock;
+    std::condition_variable wakeUp;
+    std::atomic<size_t> pending{ 0 };
+    std::atomic<size_t> nextQueue{ 0 };
+    bool stopping = false;
+
+    // takes a task from queue `self` first, then steals from the others
+    bool tryRun(size_t self) {
+        std::function<void()> task;
+        for (size_t n = 0; n < workers.size() && !task; ++n) {
+            Worker& w = *workers[(self + n) % workers.size()];
+            std::lock_guard<std::mutex> guard(w.lock);
+            if (w.tasks.empty()) {
+                continue;
+            }
+            if (n == 0) {
+                task = std::move(w.tasks.front());
+                w.tasks.pop_front();
+            }
+            else {
+                task = std::move(w.tasks.back());
+                w.tasks.pop_back();
+            }
+        }
+        if (!task) {
+            return false;
+        }
+        pending.fetch_sub(1);
+        task();
+        return true;
+    }
+
+    void workerLoop(size_t self) {
+        while (true) {
+            if (tryRun(self)) {
+                continue;
+            }
+            std::unique_lock<std::mutex> guard(sleepLock);
+            wakeUp.wait(guard, [this] { return stopping || pending.load() > 0; });
+            if (stopping && pending.load() == 0) {
+                return;
+            }
+        }
+    }
+
+public:
+    // Starts `threadCount` workers, at least one
+    explicit ThreadPool(size_t threadCount = std::thread::hardware_concurrency()) {
+        threadCount = std::max<size_t>(threadCount, 1);
+        for (size_t i = 0; i < threadCount; ++i) {
+            workers.push_back(std::make_unique<Worker>());
+        }
+        for (size_t i = 0; i < threadCount; ++i) {
+            threads.emplace_back([this, i] { workerLoop(i); });
+        }
+    }
+
+    ~ThreadPool() {
+        {
+            std::lock_guard<std::mutex> guard(sleepLock);
+            stopping = true;
+        }
+        wakeUp.notify_all();
+        for (std::thread& t : threads) {
+            t.join();
+        }
+    }
+
+    ThreadPool(const ThreadPool&) = delete;
+    ThreadPool& operator=(const ThreadPool&) = delete;
+
+    // Pool shared by the whole program, sized to the machine
+    static ThreadPool& shared() {
+        static ThreadPool pool;
+        return pool;
+    }
+
+    size_t size() const {
+        return threads.size();
+    }
+
+    // queues a task, spreading tasks over the workers round robin
+    void submit(std::function<void()> task) {
+        // counted before it is visible so a worker can never take it and underflow the count
+        {
+            std::lock_guard<std::mutex> guard(sleepLock);
+            pending.fetch_add(1);
+        }
+        Worker& w = *workers[nextQueue.fetch_add(1) % workers.size()];
+        {
+            std::lock_guard<std::mutex> guard(w.lock);
+            w.tasks.push_back(std::move(task));
+        }
+        wakeUp.notify_one();
+    }
+
+    // Runs body(morsel, begin, end) for every morsel of [0, count) and waits for all of them.
+    // The calling thread runs tasks too, so nested calls from inside a task don't deadlock.
+    template <typename Body>
+    void forEachMorsel(size_t count, size_t morselSize, Body body) {
+        size_t morsels = (count + morselSize - 1) / morselSize;
+        if (morsels <= 1) {
+            if (count > 0) {
+                body(size_t(0), size_t(0), count);
+            }
+            return;
+        }
+        std::atomic<size_t> remaining{ morsels };
+        for (size_t m = 0; m < morsels; ++m) {
+            submit([&, m] {
+                size_t begin = m * morselSize;
+                body(m, begin, std::min(begin + morselSize, count));
+                remaining.fetch_sub(1);
+            });
+        }
+        size_t self = nextQueue.load();
+        while (remaining.load() > 0) {
+            if (!tryRun(self)) {
+                std::this_thread::yield();
+            }
+        }
+    }
+};
+
+// Chooses how a library scan runs: on the calling thread, or split into morsels over a pool
+struct ExecutionPolicy {
+    ThreadPool* pool = nullptr;
+
+    static ExecutionPolicy serial() {
+        return ExecutionPolicy();
+    }
+
+    static ExecutionPolicy parallel(ThreadPool& pool = ThreadPool::shared()) {
+        ExecutionPolicy policy;
+        policy.pool = &pool;
+        return policy;
+    }
+
+    // Runs body(morsel, begin, end) over [0, count), morsel numbers are below morselCount(count)
+    template <typename Body>
+    void forEachMorsel(size_t count, Body body) const {
+        if (pool == nullptr || count <= MORSEL_SIZE) {
+            if (count > 0) {
+                body(size_t(0), size_t(0), count);
+            }
+            return;
+        }
+        pool->forEachMorsel(count, MORSEL_SIZE, body);
+    }
+
+    size_t morselCount(size_t count) const {
+        if (pool == nullptr || count <= MORSEL_SIZE) {
+            return count > 0 ? 1 : 0;
+        }
+        return (count + MORSEL_SIZE - 1) / MORSEL_SIZE;
+    }
+};
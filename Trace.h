@@ -0,0 +1,171 @@
+#pragma once
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <map>
+#include <mutex>
+#include <ostream>
+#include <stdexcept>
+#include <string>
+#include <vector>
+#include "json.hpp"
+#include "Histogram.h"
+
+// One finished span, kept for the Chrome trace
+struct TraceEvent {
+    // a string literal, so it outlives the event
+    const char* name;
+    // nanoseconds since the tracer started
+    uint64_t start;
+    uint64_t duration;
+    uint32_t thread;
+};
+
+// Where the time goes, per operation. While on, every TraceSpan that ends adds its duration
+// to the latency histogram of its name, and, if events are kept, is kept as an event for
+// writeChromeTrace(). While off, which it starts as, a span costs one relaxed atomic load.
+// Names are dotted by phase, e.g. "load.read" inside "load"; nested spans of one thread show
+// up nested in a trace viewer.
+class Tracer {
+private:
+    std::atomic<bool> on{ false };
+    bool keepEvents = false;
+    size_t maxEvents = 0;
+    std::chrono::steady_clock::time_point epoch = std::chrono::steady_clock::now();
+
+    mutable std::mutex lock;
+    std::map<std::string, LatencyHistogram, std::less<>> latencies;
+    std::vector<TraceEvent> events;
+    // events past maxEvents, counted instead of kept
+    uint64_t dropped = 0;
+
+    static uint32_t threadNumber() {
+        static std::atomic<uint32_t> next{ 1 };
+        thread_local uint32_t number = next.fetch_add(1, std::memory_order_relaxed);
+        return number;
+    }
+
+public:
+    static Tracer& shared() {
+        static Tracer tracer;
+        return tracer;
+    }
+
+    // Starts recording from scratch. With keepEvents, up to maxEvents spans are kept for the
+    // trace; each takes 24 bytes.
+    void start(bool keepEvents, size_t maxEvents = 4 * 1024 * 1024) {
+        std::lock_guard<std::mutex> guard(lock);
+        latencies.clear();
+        events.clear();
+        dropped = 0;
+        this->keepEvents = keepEvents;
+        this->maxEvents = maxEvents;
+        epoch = std::chrono::steady_clock::now();
+        on.store(true, std::memory_order_release);
+    }
+
+    // stops recording; what was recorded stays until the next start()
+    void stop() {
+        on.store(false, std::memory_order_release);
+    }
+
+    bool enabled() const {
+        return on.load(std::memory_order_relaxed);
+    }
+
+    // records a span of operation name from begin to end
+    void record(const char* name, std::chrono::steady_clock::time_point begin, std::chrono::steady_clock::time_point end) {
+        uint64_t start = static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::nanoseconds>(begin - epoch).count());
+        uint64_t duration = static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::nanoseconds>(end - begin).count());
+        uint32_t thread = threadNumber();
+        std::lock_guard<std::mutex> guard(lock);
+        if (!enabled()) {
+            return;
+        }
+        auto it = latencies.find(name);
+        if (it == latencies.end()) {
+            it = latencies.emplace(name, LatencyHistogram()).first;
+        }
+        it->second.record(duration);
+        if (keepEvents) {
+            if (events.size() < maxEvents) {
+                events.push_back({ name, start, duration, thread });
+            }
+            else {
+                ++dropped;
+            }
+        }
+    }
+
+    // latency histogram of every operation recorded, in nanoseconds, keyed by name
+    nlohmann::json latencyReport() const {
+        std::lock_guard<std::mutex> guard(lock);
+        nlohmann::json report = nlohmann::json::object();
+        for (const auto& entry : latencies) {
+            report[entry.first] = latencyJson(entry.second);
+        }
+        return report;
+    }
+
+    // one line per operation: count, p50, p99 and max
+    void writeSummary(std::ostream& out) const {
+        std::lock_guard<std::mutex> guard(lock);
+        char line[160];
+        snprintf(line, sizeof(line), "%-24s %10s %12s %12s %12s\n", "operation", "count", "p50 us", "p99 us", "max us");
+        out << line;
+        for (const auto& entry : latencies) {
+            const LatencyHistogram& histogram = entry.second;
+            snprintf(line, sizeof(line), "%-24s %10llu %12.1f %12.1f %12.1f\n", entry.first.c_str(),
+                static_cast<unsigned long long>(histogram.count()), histogram.percentile(0.50) / 1000.0,
+                histogram.percentile(0.99) / 1000.0, histogram.max() / 1000.0);
+            out << line;
+        }
+    }
+
+    // Writes the kept spans in Chrome's trace event format, for chrome://tracing or Perfetto
+    void writeChromeTrace(const std::string& path) const {
+        FILE* out = fopen(path.c_str(), "wb");
+        if (out == nullptr) {
+            throw std::runtime_error("Error opening file: " + path);
+        }
+        std::lock_guard<std::mutex> guard(lock);
+        fputs("{\"displayTimeUnit\":\"ns\",\"traceEvents\":[", out);
+        for (size_t i = 0; i < events.size(); ++i) {
+            const TraceEvent& event = events[i];
+            // timestamps are in microseconds; names are literals with nothing to escape
+            fprintf(out, "%s\n{\"name\":\"%s\",\"cat\":\"books\",\"ph\":\"X\",\"pid\":1,\"tid\":%u,\"ts\":%.3f,\"dur\":%.3f}",
+                i == 0 ? "" : ",", event.name, event.thread, event.start / 1000.0, event.duration / 1000.0);
+        }
+        fprintf(out, "\n],\"otherData\":{\"droppedEvents\":%llu}}\n", static_cast<unsigned long long>(dropped));
+        bool failed = ferror(out) != 0;
+        if (fclose(out) != 0 || failed) {
+            throw std::runtime_error("Error writing file: " + path);
+        }
+    }
+};
+
+// Times the scope it lives in as one operation of the shared tracer. name must be a string
+// literal. Does nothing but check the tracer is on when it isn't.
+class TraceSpan {
+private:
+    const char* name;
+    bool active;
+    std::chrono::steady_clock::time_point begun;
+
+public:
+    explicit TraceSpan(const char* name) : name(name), active(Tracer::shared().enabled()) {
+        if (active) {
+            begun = std::chrono::steady_clock::now();
+        }
+    }
+
+    ~TraceSpan() {
+        if (active) {
+            Tracer::shared().record(name, begun, std::chrono::steady_clock::now());
+        }
+    }
+
+    TraceSpan(const TraceSpan&) = delete;
+    TraceSpan& operator=(const TraceSpan&) = delete;
+};
@@ -0,0 +1,58 @@
+# Profile-guided build, run by the pgo target:
+#   cmake -DSOURCE_DIR=... -DBUILD_DIR=... -DCXX_COMPILER=... -DCOMPILER_ID=... [-DLLVM_PROFDATA=...] [-DNATIVE=ON]
+#         -P cmake/Pgo.cmake
+# Builds instrumented binaries in BUILD_DIR, trains them on the benchmark workload and on a
+# batch of queries over a generated catalog, then rebuilds BUILD_DIR from the profiles.
+
+set(PROFILE_DIR ${BUILD_DIR}/profiles)
+set(TRAINING_DIR ${BUILD_DIR}/training)
+
+function(run)
+    execute_process(COMMAND ${ARGN} WORKING_DIRECTORY ${BUILD_DIR} RESULT_VARIABLE result)
+    if(NOT result EQUAL 0)
+        string(REPLACE ";" " " command "${ARGN}")
+        message(FATAL_ERROR "Failed (${result}): ${command}")
+    endif()
+endfunction()
+
+function(build stage)
+    run(${CMAKE_COMMAND} -S ${SOURCE_DIR} -B ${BUILD_DIR} -DCMAKE_BUILD_TYPE=Release -DCMAKE_CXX_COMPILER=${CXX_COMPILER}
+        -DBOOKS_NATIVE=${NATIVE} -DBOOKS_PGO=${stage} -DBOOKS_PGO_DIR=${PROFILE_DIR})
+    run(${CMAKE_COMMAND} --build ${BUILD_DIR} --target BooksManagement BooksBenchmarks)
+endfunction()
+
+if(COMPILER_ID MATCHES "Clang" AND NOT LLVM_PROFDATA)
+    message(FATAL_ERROR "PGO with Clang needs llvm-profdata")
+endif()
+
+file(REMOVE_RECURSE ${PROFILE_DIR} ${TRAINING_DIR})
+file(MAKE_DIRECTORY ${BUILD_DIR} ${TRAINING_DIR})
+message(STATUS "PGO: building instrumented binaries")
+build(GENERATE)
+
+message(STATUS "PGO: training on the benchmarks")
+run(${BUILD_DIR}/BooksBenchmarks --sizes 1000,10000,100000 --min-seconds 0.05
+    --out ${TRAINING_DIR}/benchmarks.json --directory ${TRAINING_DIR})
+
+message(STATUS "PGO: training on batch queries")
+run(${BUILD_DIR}/BooksManagement --generate ${TRAINING_DIR}/catalog.json --books 100000)
+set(queries "")
+foreach(language English Spanish French German Russian Chinese Japanese Italian)
+    foreach(title a an ka th ro)
+        string(APPEND queries "{\"id\": \"${language}-${title}\", \"language\": \"${language}\", \"title\": \"${title}\", \"ignoreCase\": true}\n")
+    endforeach()
+    string(APPEND queries "{\"id\": \"${language}\", \"dsl\": \"language:${language}\"}\n")
+endforeach()
+file(WRITE ${TRAINING_DIR}/queries.jsonl "${queries}")
+run(${BUILD_DIR}/BooksManagement --batch ${TRAINING_DIR}/queries.jsonl ${TRAINING_DIR}/results.jsonl
+    --catalog ${TRAINING_DIR}/catalog.json)
+
+if(COMPILER_ID MATCHES "Clang")
+    file(GLOB raw ${PROFILE_DIR}/*.profraw)
+    run(${LLVM_PROFDATA} merge -output=${PROFILE_DIR}/merged.profdata ${raw})
+endif()
+
+message(STATUS "PGO: building from the profiles")
+build(USE)
+file(REMOVE_RECURSE ${TRAINING_DIR})
+message(STATUS "PGO: optimized binaries are in ${BUILD_DIR}")